@@ -0,0 +1,349 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "atlas.h"
+#include "daemon.h"
+#include "tasks.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ATLAS_CANDIDATES 8
+
+typedef struct atlas_sprite {
+	const char *filename;
+	image_t *image;
+	size_t cellwidth, cellheight;
+	size_t x, y;
+} atlas_sprite_t;
+
+typedef struct skyline_node {
+	size_t x, y, width;
+} skyline_node_t;
+
+typedef struct atlas_packing {
+	size_t width, height;
+	size_t *positions;
+} atlas_packing_t;
+
+typedef struct atlas_state {
+	char **filenames;
+	atlas_sprite_t *sprites;
+	size_t *order;
+	size_t count;
+	unsigned int padding;
+	atlas_packing_t candidates[ATLAS_CANDIDATES];
+	image_t *atlas;
+} atlas_state_t;
+
+static size_t align (size_t value, size_t alignment)
+{
+	return ((value + alignment - 1) / alignment) * alignment;
+}
+
+static int skyline_fit (const skyline_node_t *nodes, size_t nnodes, size_t i, size_t width, size_t atlaswidth, size_t *y)
+{
+	size_t remaining = width;
+	if (nodes[i].x + width > atlaswidth)
+		return 0;
+	*y = 0;
+	for (; i < nnodes; i++)
+	{
+		if (nodes[i].y > *y)
+			*y = nodes[i].y;
+		if (nodes[i].width >= remaining)
+			return 1;
+		remaining -= nodes[i].width;
+	}
+	return 0;
+}
+
+static size_t skyline_insert (skyline_node_t *nodes, size_t nnodes, size_t i, size_t width, size_t y)
+{
+	size_t j;
+
+	memmove (&nodes[i + 1], &nodes[i], (nnodes - i) * sizeof (skyline_node_t));
+	nodes[i].y = y;
+	nodes[i].width = width;
+	nnodes++;
+
+	/* shrink or remove the nodes covered by the new one */
+	for (j = i + 1; j < nnodes;)
+	{
+		size_t end = nodes[i].x + nodes[i].width;
+		if (nodes[j].x >= end)
+			break;
+		if (nodes[j].x + nodes[j].width > end)
+		{
+			nodes[j].width -= end - nodes[j].x;
+			nodes[j].x = end;
+			break;
+		}
+		memmove (&nodes[j], &nodes[j + 1], (nnodes - j - 1) * sizeof (skyline_node_t));
+		nnodes--;
+	}
+
+	/* merge neighbours of equal height */
+	for (j = 0; j + 1 < nnodes;)
+	{
+		if (nodes[j].y == nodes[j + 1].y)
+		{
+			nodes[j].width += nodes[j + 1].width;
+			memmove (&nodes[j + 1], &nodes[j + 2], (nnodes - j - 2) * sizeof (skyline_node_t));
+			nnodes--;
+		}
+		else
+			j++;
+	}
+
+	return nnodes;
+}
+
+/* bottom left skyline packing with a fixed width, returns the resulting height */
+static size_t pack_skyline (const atlas_state_t *state, size_t atlaswidth, size_t *positions)
+{
+	skyline_node_t *nodes = (skyline_node_t*) malloc ((state->count + 1) * sizeof (skyline_node_t));
+	size_t nnodes = 1, height = 0, n;
+
+	if (nodes == NULL)
+		return 0;
+	nodes[0].x = 0;
+	nodes[0].y = 0;
+	nodes[0].width = atlaswidth;
+
+	for (n = 0; n < state->count; n++)
+	{
+		const atlas_sprite_t *sprite = &state->sprites[state->order[n]];
+		size_t i, besti = nnodes, besty = (size_t) -1, y;
+
+		for (i = 0; i < nnodes; i++)
+		{
+			if (skyline_fit (nodes, nnodes, i, sprite->cellwidth, atlaswidth, &y) && y < besty)
+			{
+				besty = y;
+				besti = i;
+			}
+		}
+		if (besti == nnodes)
+		{
+			free (nodes);
+			return 0;
+		}
+
+		positions[2 * state->order[n]] = nodes[besti].x;
+		positions[2 * state->order[n] + 1] = besty;
+		if (besty + sprite->cellheight > height)
+			height = besty + sprite->cellheight;
+
+		nnodes = skyline_insert (nodes, nnodes, besti, sprite->cellwidth, besty + sprite->cellheight);
+	}
+
+	free (nodes);
+	return height;
+}
+
+static void load_sprite (size_t i, void *arg)
+{
+	atlas_state_t *state = (atlas_state_t*) arg;
+	state->sprites[i].filename = state->filenames[i];
+	state->sprites[i].image = load_image (state->filenames[i]);
+}
+
+static void pack_candidate (size_t i, void *arg)
+{
+	atlas_state_t *state = (atlas_state_t*) arg;
+	atlas_packing_t *candidate = &state->candidates[i];
+	if (candidate->positions != NULL)
+		candidate->height = pack_skyline (state, candidate->width, candidate->positions);
+}
+
+/* copies a sprite into its cell, replicating its edges into the padding */
+static void blit_sprite (size_t i, void *arg)
+{
+	atlas_state_t *state = (atlas_state_t*) arg;
+	const atlas_sprite_t *sprite = &state->sprites[i];
+	const image_t *image = sprite->image;
+	size_t x, y;
+
+	for (y = 0; y < sprite->cellheight; y++)
+	{
+		size_t sy = (y < state->padding) ? 0 : y - state->padding;
+		float *dst = &state->atlas->data[((sprite->y + y) * state->atlas->width + sprite->x) * 4];
+		if (sy >= image->height)
+			sy = image->height - 1;
+		for (x = 0; x < sprite->cellwidth; x++)
+		{
+			size_t sx = (x < state->padding) ? 0 : x - state->padding;
+			if (sx >= image->width)
+				sx = image->width - 1;
+			memcpy (&dst[x * 4], &image->data[(sy * image->width + sx) * 4], 4 * sizeof (float));
+		}
+	}
+}
+
+static int compare_sprites (const void *a, const void *b, void *arg)
+{
+	const atlas_sprite_t *sprites = (const atlas_sprite_t*) arg;
+	const atlas_sprite_t *sa = &sprites[*(const size_t*) a];
+	const atlas_sprite_t *sb = &sprites[*(const size_t*) b];
+	if (sa->cellheight != sb->cellheight)
+		return (sa->cellheight > sb->cellheight) ? -1 : 1;
+	if (sa->cellwidth != sb->cellwidth)
+		return (sa->cellwidth > sb->cellwidth) ? -1 : 1;
+	return (*(const size_t*) a < *(const size_t*) b) ? -1 : 1;
+}
+
+static void cleanup_atlas (atlas_state_t *state)
+{
+	size_t i;
+	for (i = 0; i < ATLAS_CANDIDATES; i++)
+		free (state->candidates[i].positions);
+	if (state->sprites != NULL)
+	{
+		for (i = 0; i < state->count; i++)
+			free_image (state->sprites[i].image);
+	}
+	free (state->sprites);
+	free (state->order);
+}
+
+static char *build_table (const atlas_state_t *state)
+{
+	size_t i, size = 1;
+	char *table, *ptr;
+
+	for (i = 0; i < state->count; i++)
+		size += strlen (state->sprites[i].filename) + 4 * 21 + 5;
+
+	table = (char*) malloc (size);
+	if (table == NULL)
+		return NULL;
+
+	ptr = table;
+	*ptr = 0;
+	for (i = 0; i < state->count; i++)
+	{
+		const atlas_sprite_t *sprite = &state->sprites[i];
+		ptr += sprintf (ptr, "%zu %zu %zu %zu %s\n", sprite->x + state->padding, sprite->y + state->padding,
+				sprite->image->width, sprite->image->height, sprite->filename);
+	}
+	return table;
+}
+
+image_t *build_atlas (char **filenames, size_t count, unsigned int padding, unsigned int alignment, char **table)
+{
+	atlas_state_t state;
+	size_t i, minwidth = 0, area = 0, basewidth, best;
+
+	memset (&state, 0, sizeof (state));
+	state.filenames = filenames;
+	state.count = count;
+	state.padding = padding;
+	state.sprites = (atlas_sprite_t*) calloc (count, sizeof (atlas_sprite_t));
+	state.order = (size_t*) malloc (count * sizeof (size_t));
+	if (state.sprites == NULL || state.order == NULL)
+	{
+		print_error ("Out of memory.\n");
+		cleanup_atlas (&state);
+		return NULL;
+	}
+
+	parallel_for (count, load_sprite, &state);
+
+	for (i = 0; i < count; i++)
+	{
+		atlas_sprite_t *sprite = &state.sprites[i];
+		if (sprite->image == NULL)
+		{
+			print_error ("Cannot load image: %s\n", filenames[i]);
+			cleanup_atlas (&state);
+			return NULL;
+		}
+		sprite->cellwidth = align (sprite->image->width + 2 * padding, alignment);
+		sprite->cellheight = align (sprite->image->height + 2 * padding, alignment);
+		if (sprite->cellwidth > minwidth)
+			minwidth = sprite->cellwidth;
+		area += sprite->cellwidth * sprite->cellheight;
+		state.order[i] = i;
+	}
+
+	qsort_r (state.order, count, sizeof (size_t), compare_sprites, state.sprites);
+
+	/* pack with several widths at once and keep the smallest result */
+	basewidth = (size_t) ceil (sqrt ((double) area));
+	if (basewidth < minwidth)
+		basewidth = minwidth;
+	for (i = 0; i < ATLAS_CANDIDATES; i++)
+	{
+		state.candidates[i].width = align (basewidth + (basewidth * i) / ATLAS_CANDIDATES, alignment);
+		state.candidates[i].positions = (size_t*) malloc (2 * count * sizeof (size_t));
+	}
+
+	parallel_for (ATLAS_CANDIDATES, pack_candidate, &state);
+
+	best = ATLAS_CANDIDATES;
+	for (i = 0; i < ATLAS_CANDIDATES; i++)
+	{
+		atlas_packing_t *candidate = &state.candidates[i];
+		if (candidate->height == 0)
+			continue;
+		candidate->height = align (candidate->height, alignment);
+		if (best == ATLAS_CANDIDATES
+				|| candidate->width * candidate->height < state.candidates[best].width * state.candidates[best].height)
+			best = i;
+	}
+	if (best == ATLAS_CANDIDATES)
+	{
+		print_error ("Cannot pack atlas.\n");
+		cleanup_atlas (&state);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		state.sprites[i].x = state.candidates[best].positions[2 * i];
+		state.sprites[i].y = state.candidates[best].positions[2 * i + 1];
+	}
+
+	state.atlas = (image_t*) malloc (sizeof (image_t));
+	if (state.atlas != NULL)
+	{
+		state.atlas->width = state.candidates[best].width;
+		state.atlas->height = state.candidates[best].height;
+		state.atlas->data = (float*) calloc (state.atlas->width * state.atlas->height * 4, sizeof (float));
+	}
+	*table = build_table (&state);
+	if (state.atlas == NULL || state.atlas->data == NULL || *table == NULL)
+	{
+		print_error ("Out of memory.\n");
+		free_image (state.atlas);
+		free (*table);
+		*table = NULL;
+		cleanup_atlas (&state);
+		return NULL;
+	}
+
+	parallel_for (count, blit_sprite, &state);
+
+	cleanup_atlas (&state);
+	return state.atlas;
+}
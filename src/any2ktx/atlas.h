@@ -0,0 +1,31 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include "image.h"
+
+/* loads the given images and packs them into a single image; every sprite
+ * is surrounded by padding pixels which replicate its edges and its cell
+ * is aligned to the given block size. A table listing the rectangle of
+ * every sprite as "x y width height filename" lines is returned in table
+ * and must be freed by the caller. */
+image_t *build_atlas (char **filenames, size_t count, unsigned int padding, unsigned int alignment, char **table);
+
+#endif /* ATLAS_H */
@@ -0,0 +1,558 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "daemon.h"
+#include "tasks.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DAEMON_MAX_ARGSIZE 65536
+#define DAEMON_MAX_INPUTSIZE (1u << 30)
+/* seconds a client may take to send its request */
+#define DAEMON_TIMEOUT 30
+/* clients whose requests are read at the same time */
+#define DAEMON_MAX_CLIENTS 64
+#define DAEMON_MAX_ERROR 256
+
+/* parts of a request, in the order they are sent */
+enum { READ_ARGSIZE, READ_ARGS, READ_INPUTSIZE, READ_INPUT, READ_DONE };
+
+typedef struct request {
+	struct request *next;
+	int fd;
+	uint32_t argsize;
+	char *args;
+	char **argv;
+	int argc;
+	void *input;
+	uint32_t inputsize;
+	void *job;
+	int decoded;
+	/* the part of the request that is being read */
+	int stage;
+	uint8_t *pos;
+	size_t remaining;
+	time_t deadline;
+	/* the first error printed while handling the request */
+	char error[DAEMON_MAX_ERROR];
+} request_t;
+
+typedef struct queue {
+	request_t *first;
+	request_t *last;
+	size_t length;
+} queue_t;
+
+static const daemon_handler_t *handler;
+static int listen_fd = -1;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* signalled when the main thread has something to do */
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+/* signalled when a request was taken from the incoming queue */
+static pthread_cond_t space = PTHREAD_COND_INITIALIZER;
+/* signalled when a job is ready for decoding */
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+
+static queue_t incoming, decoding, ready;
+/* jobs being decoded or waiting for conversion; both queues are bounded,
+ * so a busy daemon stops accepting connections, which lets clients queue
+ * up in the listen backlog */
+static size_t inflight = 0;
+static size_t queue_limit;
+/* set when the listener stopped because of an error */
+static int listener_failed = 0;
+
+/* the error buffer of the request the calling thread is handling */
+static __thread char *request_error = NULL;
+
+void print_error (const char *format, ...)
+{
+	va_list args;
+
+	va_start (args, format);
+	if (request_error != NULL && request_error[0] == 0)
+	{
+		va_list copy;
+		va_copy (copy, args);
+		vsnprintf (request_error, DAEMON_MAX_ERROR, format, copy);
+		va_end (copy);
+		/* the reply is a single line */
+		request_error[strcspn (request_error, "\n")] = 0;
+	}
+	vfprintf (stderr, format, args);
+	va_end (args);
+}
+
+static void queue_push (queue_t *queue, request_t *request)
+{
+	request->next = NULL;
+	if (queue->last != NULL)
+		queue->last->next = request;
+	else
+		queue->first = request;
+	queue->last = request;
+	queue->length++;
+}
+
+static request_t *queue_pop (queue_t *queue)
+{
+	request_t *request = queue->first;
+	if (request != NULL)
+	{
+		queue->first = request->next;
+		if (queue->first == NULL)
+			queue->last = NULL;
+		queue->length--;
+	}
+	return request;
+}
+
+static int write_full (int fd, const void *buffer, size_t size)
+{
+	const uint8_t *p = (const uint8_t*) buffer;
+	while (size > 0)
+	{
+		ssize_t n = write (fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		p += n;
+		size -= n;
+	}
+	return 1;
+}
+
+static void free_request (request_t *request)
+{
+	if (request->job != NULL)
+		handler->release (request->job);
+	if (request->fd >= 0)
+		close (request->fd);
+	free (request->args);
+	free (request->argv);
+	free (request->input);
+	free (request);
+}
+
+static void respond (request_t *request, const char *error, const void *data, size_t size)
+{
+	char line[DAEMON_MAX_ERROR + 16];
+	if (error != NULL)
+		snprintf (line, sizeof (line), "ERROR %s\n", error);
+	else
+		snprintf (line, sizeof (line), "OK %zu\n", size);
+	if (write_full (request->fd, line, strlen (line)) && error == NULL && size > 0)
+		write_full (request->fd, data, size);
+}
+
+/* splits the arguments of a completely read request into argv */
+static int split_arguments (request_t *request)
+{
+	size_t i;
+	int arg;
+
+	/* argv [0] is the program name, as for the command line */
+	request->argc = 1;
+	for (i = 0; i < request->argsize; i++)
+		request->argc += (request->args[i] == 0 || i + 1 == request->argsize);
+	request->argv = (char**) calloc (request->argc + 1, sizeof (char*));
+	if (request->argv == NULL)
+		return 0;
+	request->argv[0] = "any2ktx";
+	for (i = 0, arg = 1; i < request->argsize; i += strlen (&request->args[i]) + 1)
+		request->argv[arg++] = &request->args[i];
+	request->argc = arg;
+	return 1;
+}
+
+/* sets up reading the next part of a request once the current one is
+ * complete; returns 0 if the request is invalid */
+static int next_stage (request_t *request)
+{
+	switch (request->stage)
+	{
+	case READ_ARGSIZE:
+		if (request->argsize == 0 || request->argsize > DAEMON_MAX_ARGSIZE)
+			return 0;
+		request->args = (char*) malloc (request->argsize + 1);
+		if (request->args == NULL)
+			return 0;
+		request->pos = (uint8_t*) request->args;
+		request->remaining = request->argsize;
+		break;
+	case READ_ARGS:
+		request->args[request->argsize] = 0;
+		request->pos = (uint8_t*) &request->inputsize;
+		request->remaining = sizeof (uint32_t);
+		break;
+	case READ_INPUTSIZE:
+		if (request->inputsize > DAEMON_MAX_INPUTSIZE)
+			return 0;
+		if (request->inputsize > 0)
+		{
+			request->input = malloc (request->inputsize);
+			if (request->input == NULL)
+				return 0;
+		}
+		request->pos = (uint8_t*) request->input;
+		request->remaining = request->inputsize;
+		break;
+	case READ_INPUT:
+		if (!split_arguments (request))
+			return 0;
+		break;
+	}
+	request->stage++;
+	return 1;
+}
+
+/* reads whatever a client has sent so far without blocking; returns 1 once
+ * the request is complete, 0 if more data is needed and -1 on errors */
+static int read_request (request_t *request)
+{
+	while (request->stage != READ_DONE)
+	{
+		ssize_t n;
+
+		if (request->remaining == 0)
+		{
+			if (!next_stage (request))
+				return -1;
+			continue;
+		}
+		n = read (request->fd, request->pos, request->remaining);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -1;
+		request->pos += n;
+		request->remaining -= n;
+	}
+	return 1;
+}
+
+static request_t *accept_request (int fd)
+{
+	request_t *request = (request_t*) calloc (1, sizeof (request_t));
+	if (request == NULL)
+	{
+		close (fd);
+		return NULL;
+	}
+	request->fd = fd;
+	request->stage = READ_ARGSIZE;
+	request->pos = (uint8_t*) &request->argsize;
+	request->remaining = sizeof (uint32_t);
+	request->deadline = time (NULL) + DAEMON_TIMEOUT;
+	return request;
+}
+
+/* hands a completely read request to the main thread */
+static void submit_request (request_t *request)
+{
+	struct timeval timeout = { DAEMON_TIMEOUT, 0 };
+
+	/* the reply is written by the main thread, which may wait for a client
+	 * that stops reading only for a limited time */
+	fcntl (request->fd, F_SETFL, fcntl (request->fd, F_GETFL) & ~O_NONBLOCK);
+	setsockopt (request->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+
+	pthread_mutex_lock (&lock);
+	while (incoming.length >= queue_limit)
+		pthread_cond_wait (&space, &lock);
+	queue_push (&incoming, request);
+	pthread_cond_signal (&changed);
+	pthread_mutex_unlock (&lock);
+}
+
+/* accepts connections and reads the requests of all clients at once, so
+ * that a slow client cannot hold up the others */
+static void *listener (void *arg)
+{
+	request_t *pending[DAEMON_MAX_CLIENTS];
+	struct pollfd fds[DAEMON_MAX_CLIENTS + 1];
+	size_t count = 0, polled, i;
+
+	(void) arg;
+	for (;;)
+	{
+		time_t now;
+
+		for (i = 0; i < count; i++)
+		{
+			fds[i].fd = pending[i]->fd;
+			fds[i].events = POLLIN;
+		}
+		/* no further connections are accepted while too many clients are
+		 * still sending their requests */
+		fds[count].fd = (count < DAEMON_MAX_CLIENTS) ? listen_fd : -1;
+		fds[count].events = POLLIN;
+		polled = count;
+
+		/* the timeout lets stalled clients expire */
+		if (poll (fds, polled + 1, 1000) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf (stderr, "Cannot wait for requests: %s\n", strerror (errno));
+			break;
+		}
+		now = time (NULL);
+
+		/* going backwards lets a finished request be replaced by the last
+		 * one, which has already been handled */
+		for (i = polled; i-- > 0;)
+		{
+			request_t *request = pending[i];
+			int status = 0;
+
+			if (fds[i].revents)
+				status = read_request (request);
+			if (status == 0 && now >= request->deadline)
+				status = -1;
+			if (status == 0)
+				continue;
+
+			pending[i] = pending[--count];
+			if (status > 0)
+				submit_request (request);
+			else
+				free_request (request);
+		}
+
+		if (fds[polled].revents & POLLIN)
+		{
+			request_t *request;
+			int fd = accept4 (listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
+			{
+				if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+					continue;
+				fprintf (stderr, "Cannot accept connections: %s\n", strerror (errno));
+				break;
+			}
+			request = accept_request (fd);
+			if (request != NULL)
+				pending[count++] = request;
+		}
+	}
+
+	/* without the listener no further requests arrive, so the main thread
+	 * has to stop the daemon */
+	for (i = 0; i < count; i++)
+		free_request (pending[i]);
+	pthread_mutex_lock (&lock);
+	listener_failed = 1;
+	pthread_cond_broadcast (&changed);
+	pthread_mutex_unlock (&lock);
+	return NULL;
+}
+
+static void *worker (void *arg)
+{
+	(void) arg;
+	for (;;)
+	{
+		request_t *request;
+
+		pthread_mutex_lock (&lock);
+		while ((request = queue_pop (&decoding)) == NULL)
+			pthread_cond_wait (&work, &lock);
+		pthread_mutex_unlock (&lock);
+
+		request_error = request->error;
+		request->decoded = handler->decode (request->job);
+		request_error = NULL;
+
+		pthread_mutex_lock (&lock);
+		queue_push (&ready, request);
+		pthread_cond_signal (&changed);
+		pthread_mutex_unlock (&lock);
+	}
+	return NULL;
+}
+
+static int open_socket (const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+
+	if (strlen (path) >= sizeof (addr.sun_path))
+	{
+		fprintf (stderr, "Socket path too long.\n");
+		return 0;
+	}
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, path);
+
+	/* a stale socket of a previous daemon is replaced */
+	if (!lstat (path, &st) && S_ISSOCK (st.st_mode))
+		unlink (path);
+
+	listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0 || bind (listen_fd, (struct sockaddr*) &addr, sizeof (addr))
+			|| listen (listen_fd, SOMAXCONN))
+	{
+		fprintf (stderr, "Cannot listen on %s: %s\n", path, strerror (errno));
+		return 0;
+	}
+	return 1;
+}
+
+/* prepares a request and hands it to the workers, or answers right away
+ * if it is invalid */
+static void prepare_request (request_t *request)
+{
+	request_error = request->error;
+	request->job = handler->prepare (request->argc, request->argv, request->input, request->inputsize);
+	request_error = NULL;
+	if (request->job == NULL)
+	{
+		respond (request, request->error[0] ? request->error : "invalid arguments", NULL, 0);
+		free_request (request);
+		return;
+	}
+
+	pthread_mutex_lock (&lock);
+	queue_push (&decoding, request);
+	inflight++;
+	pthread_cond_signal (&work);
+	pthread_mutex_unlock (&lock);
+}
+
+static void convert_request (request_t *request)
+{
+	char *output = NULL;
+	size_t size = 0;
+	FILE *out;
+	int result;
+
+	if (!request->decoded)
+	{
+		respond (request, request->error[0] ? request->error : "cannot load image", NULL, 0);
+		return;
+	}
+
+	out = open_memstream (&output, &size);
+	if (out == NULL)
+	{
+		respond (request, "out of memory", NULL, 0);
+		return;
+	}
+	request_error = request->error;
+	result = handler->convert (request->job, out);
+	request_error = NULL;
+	if (!result)
+	{
+		fclose (out);
+		respond (request, request->error[0] ? request->error : "conversion failed", NULL, 0);
+	}
+	else if (fclose (out))
+		respond (request, "out of memory", NULL, 0);
+	else
+		respond (request, NULL, output, size);
+	free (output);
+}
+
+int run_daemon (const char *path, const daemon_handler_t *h)
+{
+	unsigned int i, workers = task_concurrency ();
+	pthread_t thread;
+
+	handler = h;
+	queue_limit = 2 * workers;
+	signal (SIGPIPE, SIG_IGN);
+
+	if (!open_socket (path))
+		return 0;
+
+	for (i = 0; i < workers; i++)
+	{
+		if (pthread_create (&thread, NULL, worker, NULL))
+		{
+			fprintf (stderr, "Cannot start worker threads.\n");
+			return 0;
+		}
+		pthread_detach (thread);
+	}
+	if (pthread_create (&thread, NULL, listener, NULL))
+	{
+		fprintf (stderr, "Cannot start listener thread.\n");
+		return 0;
+	}
+	pthread_detach (thread);
+
+	for (;;)
+	{
+		request_t *request = NULL;
+
+		pthread_mutex_lock (&lock);
+		for (;;)
+		{
+			if (listener_failed)
+			{
+				pthread_mutex_unlock (&lock);
+				return 0;
+			}
+			/* new requests are prepared first to keep the workers busy */
+			if (incoming.first != NULL && inflight < queue_limit)
+			{
+				request = queue_pop (&incoming);
+				pthread_cond_signal (&space);
+				pthread_mutex_unlock (&lock);
+				prepare_request (request);
+				request = NULL;
+				pthread_mutex_lock (&lock);
+				continue;
+			}
+			request = queue_pop (&ready);
+			if (request != NULL)
+				break;
+			pthread_cond_wait (&changed, &lock);
+		}
+		pthread_mutex_unlock (&lock);
+
+		convert_request (request);
+		free_request (request);
+
+		pthread_mutex_lock (&lock);
+		inflight--;
+		pthread_mutex_unlock (&lock);
+	}
+	return 1;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Protocol: a client connects to the socket and sends one request:
+ *   uint32_t argsize, argsize bytes of zero terminated arguments,
+ *   uint32_t inputsize, inputsize bytes of inline input data
+ * in host byte order. The daemon answers with a line "OK <size>" followed
+ * by size bytes of inline output, or with a line "ERROR <message>", and
+ * closes the connection. */
+
+/* The first message a handler prints with print_error while working on a job
+ * is sent back as the error of the request. */
+typedef struct daemon_handler {
+	/* parses a request on the main thread; returns NULL if it is invalid */
+	void *(*prepare) (int argc, char **argv, const void *input, size_t inputsize);
+	/* decodes the input of a prepared job on a worker thread */
+	int (*decode) (void *job);
+	/* converts a decoded job on the main thread, inline output goes to out */
+	int (*convert) (void *job, FILE *out);
+	void (*release) (void *job);
+} daemon_handler_t;
+
+/* prints an error message to stderr and keeps it as the reply to the request
+ * the calling thread is handling, if any */
+void print_error (const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+/* serves requests until a fatal error occurs; the caller's thread is used
+ * for preparing and converting jobs, which keeps all OpenGL calls on it */
+int run_daemon (const char *path, const daemon_handler_t *handler);
+
+#endif /* DAEMON_H */
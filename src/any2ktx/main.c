@@ -24,7 +24,15 @@
 #include <string.h>
 #include "tables.h"
 #include "image.h"
+#include "pack.h"
+#include "atlas.h"
 #include "ktx.h"
+#include "keyvalue.h"
+#include "ktxfile.h"
+#include "tasks.h"
+#include "daemon.h"
+#include "context.h"
+#include "readback.h"
 
 ktx_header_t header = { KTX_MAGIC, 0x04030201, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0 };
 
@@ -37,29 +45,35 @@ int display = 0;
 const char *source_filename = NULL;
 image_t *source = NULL;
 
+int atlas = 0;
+char **atlas_filenames = NULL;
+size_t atlas_count = 0;
+unsigned int atlas_padding = 0;
+const char *atlas_table_filename = NULL;
+
+float coverage_cutoff = -1.0f;
+
+int normal_map = 0;
+const char *toksvig_filename = NULL;
+
 const char *dest_filename = NULL;
 
-float defaultalpha = 1.0f;
+keyvaluelist_t key_value_data = KEYVALUELIST_INIT;
 
-typedef struct keyvaluedata
-{
-	struct keyvaluedata *next;
-	uint32_t len;
-	char data[];
-} keyvaluedata_t;
-keyvaluedata_t *first_key_value_entry = NULL;
-keyvaluedata_t *last_key_value_entry = NULL;
+const char *daemon_socket = NULL;
+/* set while parsing the options of a daemon request */
+int serving = 0;
 
 int SetType (const char *type_name)
 {
 	if (header.glType != 0)
 	{
-		fprintf (stderr, "Only one type can be specified.\n");
+		print_error ("Only one type can be specified.\n");
 		return 0;
 	}
 	header.glType = table_lookup (type_table, type_name);
 	if (header.glType != 0) return 1;
-	fprintf (stderr, "Invalid type.\n");
+	print_error ("Invalid type.\n");
 	return 0;
 }
 
@@ -67,12 +81,12 @@ int SetFormat (const char *format_name)
 {
 	if (header.glFormat != 0)
 	{
-		fprintf (stderr, "Only one format can be specified.\n");
+		print_error ("Only one format can be specified.\n");
 		return 0;
 	}
 	header.glFormat = table_lookup (format_table, format_name);
 	if (header.glFormat != 0) return 1;
-	fprintf (stderr, "Invalid format.\n");
+	print_error ("Invalid format.\n");
 	return 0;
 }
 
@@ -80,7 +94,7 @@ int SetInternalFormat (const char *format_name)
 {
 	if (header.glInternalFormat != 0)
 	{
-		fprintf (stderr, "Only one internal format can be specified.\n");
+		print_error ("Only one internal format can be specified.\n");
 		return 0;
 	}
 	header.glInternalFormat = base_format_table_lookup (internal_format_table, format_name, &header.glBaseInternalFormat);
@@ -90,7 +104,7 @@ int SetInternalFormat (const char *format_name)
 		compressed = 1;
 		return 1;
 	}
-	fprintf (stderr, "Invalid internal format.\n");
+	print_error ("Invalid internal format.\n");
 	return 0;
 }
 
@@ -100,7 +114,7 @@ int SetLevels (const char *levelstr)
 	header.numberOfMipmapLevels = strtoul (levelstr, &endptr, 10);
 	if (levelstr + strlen (levelstr) != endptr)
 	{
-		fprintf (stderr, "Invalid number of mipmap levels requested.\n");
+		print_error ("Invalid number of mipmap levels requested.\n");
 		return 0;
 	}
 	return 1;
@@ -112,33 +126,94 @@ int SetDefaultAlpha (const char *alphastr)
 	defaultalpha = strtof (alphastr, &endptr);
 	if (alphastr + strlen (alphastr) != endptr)
 	{
-		fprintf (stderr, "Invalid default alpha value requested.\n");
+		print_error ("Invalid default alpha value requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int SetAtlasPadding (const char *paddingstr)
+{
+	char *endptr;
+	atlas_padding = strtoul (paddingstr, &endptr, 10);
+	if (paddingstr + strlen (paddingstr) != endptr)
+	{
+		print_error ("Invalid atlas padding requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int SetCoverageCutoff (const char *cutoffstr)
+{
+	char *endptr;
+	coverage_cutoff = strtof (cutoffstr, &endptr);
+	if (cutoffstr + strlen (cutoffstr) != endptr || coverage_cutoff <= 0.0f || coverage_cutoff > 1.0f)
+	{
+		print_error ("Invalid alpha test cutoff requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int SetColorspace (int colorspace)
+{
+	if (import_settings.colorspace != IMPORT_COLORSPACE_KEEP)
+	{
+		print_error ("Only one color space conversion can be specified.\n");
+		return 0;
+	}
+	import_settings.colorspace = colorspace;
+	return 1;
+}
+
+int SetSwizzle (const char *swizzlestr)
+{
+	int c;
+	if (strlen (swizzlestr) != 4)
+	{
+		print_error ("Invalid swizzle requested.\n");
 		return 0;
 	}
+	for (c = 0; c < 4; c++)
+	{
+		switch (swizzlestr[c])
+		{
+		case 'r': import_settings.swizzle[c] = 0; break;
+		case 'g': import_settings.swizzle[c] = 1; break;
+		case 'b': import_settings.swizzle[c] = 2; break;
+		case 'a': import_settings.swizzle[c] = 3; break;
+		case '0': import_settings.swizzle[c] = IMPORT_SWIZZLE_ZERO; break;
+		case '1': import_settings.swizzle[c] = IMPORT_SWIZZLE_ONE; break;
+		default:
+			print_error ("Invalid swizzle requested.\n");
+			return 0;
+		}
+	}
 	return 1;
 }
 
 int AddKeyValueData (const char *key, const char *value)
 {
-	uint32_t keylen = strlen (key);
-	uint32_t valuelen = strlen (value);
-	uint32_t len = keylen + valuelen + 2;
-	header.bytesOfKeyValueData += sizeof (uint32_t) + len + (3 - ((len + 3) % 4));
-
-	keyvaluedata_t *data = (keyvaluedata_t*) malloc (sizeof (keyvaluedata_t) + len);
-	data->next = NULL;
-	data->len = len;
-	memcpy (&data->data[0], key, keylen + 1);
-	memcpy (&data->data[keylen + 1], value, valuelen + 1);
-	if (first_key_value_entry == NULL)
-		first_key_value_entry = data;
-	if (last_key_value_entry == NULL)
-		last_key_value_entry = data;
-	else
+	if (!keyvalue_add (&key_value_data, key, value, strlen (value) + 1))
+	{
+		print_error ("Cannot add key value data.\n");
+		return 0;
+	}
+	header.bytesOfKeyValueData = keyvalue_size (&key_value_data);
+	return 1;
+}
+
+int SetJobs (const char *jobsstr)
+{
+	char *endptr;
+	unsigned long jobs = strtoul (jobsstr, &endptr, 10);
+	if (jobsstr + strlen (jobsstr) != endptr || jobs == 0)
 	{
-		last_key_value_entry->next = data;
-		last_key_value_entry = data;
+		print_error ("Invalid number of jobs requested.\n");
+		return 0;
 	}
+	task_set_concurrency (jobs);
 	return 1;
 }
 
@@ -147,6 +222,11 @@ void usage (char *appname)
 	fprintf (stdout, "Usage: %s [options] source dest\n"
 			"Options:\n"
 			"  -h, --help                Display this help message.\n"
+			"  -j, --jobs [count]        Limit the number of threads (default: number\n"
+			"                            of cores).\n"
+			"  -C, --context [backend]   Create the OpenGL context with glfw or egl. By\n"
+			"                            default a hidden GLFW window is used if a\n"
+			"                            display is available and EGL otherwise.\n"
 			"  -t, --type [type]         Specify the component type for\n"
 			"                            storing uncompressed image data.\n"
 			"  -f, --format [format]     Specify the format for storing\n"
@@ -158,13 +238,53 @@ void usage (char *appname)
 			"                            include in the output file.\n"
 			"  -a, --alpha [value]       Specify the default alpha value to be used if\n"
 			"                            the input image doesn't have an alpha channel\n"
+			"  -L, --linearize           Convert the colors of the input from sRGB to\n"
+			"                            linear.\n"
+			"  -E, --encode-srgb         Convert the colors of the input from linear to\n"
+			"                            sRGB.\n"
+			"  -P, --premultiply         Premultiply the colors by alpha.\n"
+			"  -w, --swizzle [channels]  Rearrange the channels, e.g. bgra or rrr1, where\n"
+			"                            0 and 1 stand for constant channels.\n"
+			"  -c, --coverage [cutoff]   Generate the mipmap levels on the CPU and scale\n"
+			"                            their alpha values so that the fraction of texels\n"
+			"                            passing an alpha test against the given cutoff\n"
+			"                            matches the base level.\n"
+			"  -n, --normal-map          Treat the source as a normal map. The mipmap\n"
+			"                            levels are generated on the CPU and\n"
+			"                            renormalized, and only the X and Y components\n"
+			"                            are stored, which requires an internal format\n"
+			"                            with two channels such as\n"
+			"                            GL_COMPRESSED_RG_RGTC2. Signed formats store\n"
+			"                            the components in [-1, 1], others in [0, 1].\n"
+			"  -T, --toksvig [file]      Write the variance of the normals of each texel\n"
+			"                            to a separate GL_R16 KTX file, which can be\n"
+			"                            added to the squared roughness when shading.\n"
 			"  -d, --display             Displays the image rather than converting it.\n"
 			"  -k, --key [key]           Specify a key for optional key value data.\n"
 			"  -v, --value [value]       Specify a value for optional key value data.\n"
+			"  -A, --atlas               Pack several source images into a single\n"
+			"                            texture atlas.\n"
+			"  -p, --padding [pixels]    Specify the number of pixels by which the edges\n"
+			"                            of each sprite in an atlas are extended.\n"
+			"  -u, --uv-table [file]     Write the table of sprite rectangles of an atlas\n"
+			"                            to a separate file instead of storing it as\n"
+			"                            key value data with the key ktxutils.atlas.\n"
+			"  -D, --daemon [socket]     Keep running and serve conversion requests on\n"
+			"                            the given Unix domain socket. Only the options\n"
+			"                            -a, -L, -E, -P, -w, -j and -C may be combined\n"
+			"                            with it and apply to all requests.\n"
 			"\n"
 			"Arguments:\n"
-			"  source                    Input image.\n"
-			"  dest                      Output file name.\n", appname);
+			"  source                    Input image(s), or - for stdin.\n"
+			"  dest                      Output file name, or - for stdout.\n"
+			"\n"
+			"Daemon requests:\n"
+			"  A client sends a 32-bit length followed by the zero terminated arguments\n"
+			"  of a conversion, e.g. \"-i\\0GL_RGBA8\\0...\\0in.png\\0out.ktx\\0\", and a\n"
+			"  32-bit length followed by inline input data, in host byte order. A source\n"
+			"  of - refers to the inline input and a dest of - returns the texture\n"
+			"  inline. The daemon answers \"OK <size>\\n\" followed by size bytes of\n"
+			"  output or \"ERROR <message>\\n\" and closes the connection.\n", appname);
 	exit (0);
 }
 
@@ -180,26 +300,84 @@ int parse_options (int argc, char **argv)
 			{ "internal", required_argument, 0, 'i' },
 			{ "levels", required_argument, 0, 'l' },
 			{ "alpha", required_argument, 0, 'a' },
+			{ "linearize", no_argument, 0, 'L' },
+			{ "encode-srgb", no_argument, 0, 'E' },
+			{ "premultiply", no_argument, 0, 'P' },
+			{ "swizzle", required_argument, 0, 'w' },
+			{ "coverage", required_argument, 0, 'c' },
+			{ "normal-map", no_argument, 0, 'n' },
+			{ "toksvig", required_argument, 0, 'T' },
 			{ "key", required_argument, 0, 'k' },
 			{ "value", required_argument, 0, 'v' },
+			{ "atlas", no_argument, 0, 'A' },
+			{ "padding", required_argument, 0, 'p' },
+			{ "uv-table", required_argument, 0, 'u' },
+			{ "daemon", required_argument, 0, 'D' },
+			{ "jobs", required_argument, 0, 'j' },
+			{ "context", required_argument, 0, 'C' },
 			{ 0, 0, 0, 0 }
 	};
 
 	while (1)
 	{
 		int option_index = 0;
-		c = getopt_long (argc, argv, "t:f:l:i:a:k:v:hd", long_options, &option_index);
+		c = getopt_long (argc, argv, "t:f:l:i:a:c:k:v:p:u:T:w:D:j:C:hdnALEP", long_options, &option_index);
 
 		if (c== -1) break;
 
+		if (serving && strchr ("aLEPwDdhjC", c) != NULL)
+		{
+			print_error ("Option -%c cannot be used in a daemon request.\n", c);
+			return 0;
+		}
+
 		switch (c)
 		{
+		case 'D':
+			daemon_socket = optarg;
+			break;
 		case 'a':
 			if (!SetDefaultAlpha (optarg)) return 0;
 			break;
+		case 'c':
+			if (!SetCoverageCutoff (optarg)) return 0;
+			break;
+		case 'L':
+			if (!SetColorspace (IMPORT_COLORSPACE_LINEARIZE)) return 0;
+			break;
+		case 'E':
+			if (!SetColorspace (IMPORT_COLORSPACE_ENCODE)) return 0;
+			break;
+		case 'P':
+			import_settings.premultiply = 1;
+			break;
+		case 'w':
+			if (!SetSwizzle (optarg)) return 0;
+			break;
+		case 'n':
+			normal_map = 1;
+			break;
+		case 'T':
+			toksvig_filename = optarg;
+			break;
 		case 'd':
 			display = 1;
 			break;
+		case 'A':
+			atlas = 1;
+			break;
+		case 'p':
+			if (!SetAtlasPadding (optarg)) return 0;
+			break;
+		case 'u':
+			atlas_table_filename = optarg;
+			break;
+		case 'j':
+			if (!SetJobs (optarg)) return 0;
+			break;
+		case 'C':
+			if (!context_set_backend (optarg)) return 0;
+			break;
 		case 'h':
 			usage (argv[0]);
 			break;
@@ -218,7 +396,7 @@ int parse_options (int argc, char **argv)
 		case 'k':
 			if (key != NULL)
 			{
-				fprintf (stderr, "A key without a value was specified.\n");
+				print_error ("A key without a value was specified.\n");
 				return 0;
 			}
 			key = optarg;
@@ -226,7 +404,7 @@ int parse_options (int argc, char **argv)
 		case 'v':
 			if (key == NULL)
 			{
-				fprintf (stderr, "A value without a key was specified.\n");
+				print_error ("A value without a key was specified.\n");
 				return 0;
 			}
 			if (!AddKeyValueData (key, optarg)) return 0;
@@ -237,32 +415,83 @@ int parse_options (int argc, char **argv)
 
 	if (key != NULL)
 	{
-		fprintf (stderr, "A key without a value was specified.\n");
+		print_error ("A key without a value was specified.\n");
 		return 0;
 	}
 
+	if (daemon_socket != NULL)
+	{
+		if (header.glInternalFormat != 0 || header.glType != 0 || header.glFormat != 0
+			|| header.numberOfMipmapLevels != 0 || display || atlas || normal_map
+			|| coverage_cutoff >= 0.0f || toksvig_filename != NULL || key_value_data.first != NULL
+			|| atlas_padding != 0 || atlas_table_filename != NULL || optind != argc)
+		{
+			print_error ("Conversion options are passed with each daemon request.\n");
+			return 0;
+		}
+		return 1;
+	}
+
 	if (header.glInternalFormat == 0)
 	{
-		fprintf (stderr, "No internal format was specified.\n");
+		print_error ("No internal format was specified.\n");
 		return 0;
 	}
 
 	if (compressed && (header.glType != 0 || header.glFormat != 0))
 	{
-		fprintf (stderr, "No type and format can be specified with a compressed internal format.\n");
+		print_error ("No type and format can be specified with a compressed internal format.\n");
 		return 0;
 	}
 	if (!compressed && (header.glType == 0 || header.glFormat == 0))
 	{
-		fprintf (stderr, "Type and format must be specified unless the internal format is a compressed format.\n");
+		print_error ("Type and format must be specified unless the internal format is a compressed format.\n");
+		return 0;
+	}
+
+	if (toksvig_filename != NULL && !normal_map)
+	{
+		print_error ("A variance output can only be specified for normal maps.\n");
+		return 0;
+	}
+
+	if (normal_map && header.glBaseInternalFormat != GL_RG)
+	{
+		print_error ("Normal maps require an internal format with the base format GL_RG.\n");
+		return 0;
+	}
+
+	if (normal_map && coverage_cutoff > 0.0f)
+	{
+		print_error ("Alpha coverage cannot be preserved for normal maps.\n");
+		return 0;
+	}
+
+	if (!atlas && (atlas_padding != 0 || atlas_table_filename != NULL))
+	{
+		print_error ("Atlas options can only be specified when building an atlas.\n");
 		return 0;
 	}
 
+	if (atlas)
+	{
+		atlas_filenames = &argv[optind];
+		atlas_count = argc - optind - (display ? 0 : 1);
+		if (optind >= argc || atlas_count == 0)
+		{
+			print_error ("Invalid number of arguments.\n");
+			return 0;
+		}
+		if (!display)
+			dest_filename = argv [argc - 1];
+		return 1;
+	}
+
 	if (display)
 	{
 		if (optind + 1 != argc)
 		{
-			fprintf (stderr, "Invalid number of arguments.\n");
+			print_error ("Invalid number of arguments.\n");
 			return 0;
 		}
 		else
@@ -274,7 +503,7 @@ int parse_options (int argc, char **argv)
 
 	if (optind + 2 != argc)
 	{
-		fprintf (stderr, "Invalid number of arguments.\n");
+		print_error ("Invalid number of arguments.\n");
 		return 0;
 	}
 
@@ -290,29 +519,219 @@ GLFWwindow *window = NULL;
 int create_context (void)
 {
 	if (display) {
-		window = glfwCreateWindow (source->width, source->height, "any2ktx", NULL, NULL);
-	} else {
-		glfwWindowHint (GLFW_VISIBLE, GL_FALSE);
-		window = glfwCreateWindow (64, 64, "any2ktx", NULL, NULL);
-	}
-    if (!window) {
-    	fprintf (stderr, "Cannot open window.\n");
-    	return 0;
-    }
-    glfwMakeContextCurrent (window);
+		window = context_create_window ("any2ktx", source->width, source->height);
+		if (!window)
+			return 0;
+	} else if (!context_create ("any2ktx"))
+		return 0;
 
-    if (glewInit () != GLEW_OK) {
-    	fprintf (stderr, "Cannot initialize GLEW.\n");
-    	return 0;
-    }
     if (compressed && !GLEW_ARB_texture_compression) {
-    	fprintf (stderr, "Texture compression requested, but not supported.\n");
+    	print_error ("Texture compression requested, but not supported.\n");
     	return 0;
     }
     glHint (GL_TEXTURE_COMPRESSION_HINT, GL_NICEST);
     return 1;
 }
 
+unsigned int intlog2 (unsigned int v)
+{
+	unsigned int r = 0;
+	while (v >>= 1) r++;
+	return r;
+}
+
+/* levels of packed float types are kept as 32 bit floats until they are
+ * encoded on the CPU */
+GLint upload_internal_format (void)
+{
+	return packed_float_type (header.glType) ? GL_RGB32F : header.glInternalFormat;
+}
+
+/* uploads mipmap levels generated from the unscaled previous level, with
+ * the alpha of each level scaled to preserve the alpha test coverage of
+ * the base level */
+int load_coverage_mipmaps (image_t *image)
+{
+	uint32_t level, levels = header.numberOfMipmapLevels;
+	float coverage = alpha_coverage (image, coverage_cutoff);
+	image_t *prev = image;
+	float scale = 1.0f;
+
+	if (coverage < 0.0f)
+	{
+		print_error ("Out of memory.\n");
+		return 0;
+	}
+
+	for (level = 1; level <= levels; level++)
+	{
+		image_t *next = NULL;
+		if (level < levels)
+		{
+			next = downsample_image (prev);
+			if (next == NULL)
+			{
+				if (prev != image) free_image (prev);
+				print_error ("Out of memory.\n");
+				return 0;
+			}
+		}
+		if (prev != image)
+		{
+			scale_alpha (prev, scale);
+			glTexImage2D (GL_TEXTURE_2D, level - 1, upload_internal_format (), prev->width, prev->height, 0, GL_RGBA, GL_FLOAT, prev->data);
+			free_image (prev);
+		}
+		if (next != NULL)
+		{
+			scale = alpha_coverage_scale (next, coverage_cutoff, coverage);
+			if (scale < 0.0f)
+			{
+				free_image (next);
+				print_error ("Out of memory.\n");
+				return 0;
+			}
+		}
+		prev = next;
+	}
+
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	return 1;
+}
+
+/* signed and floating point formats store normal components in [-1, 1] */
+int signed_normals (GLenum internalformat)
+{
+	switch (internalformat)
+	{
+	case GL_RG8_SNORM:
+	case GL_RG16_SNORM:
+	case GL_RG16F:
+	case GL_RG32F:
+	case GL_COMPRESSED_SIGNED_RG_RGTC2:
+	case GL_COMPRESSED_SIGNED_RG11_EAC:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+FILE *open_variance_file (const image_t *image, uint32_t levels)
+{
+	ktx_header_t h = { KTX_MAGIC, 0x04030201, GL_UNSIGNED_SHORT, 2, GL_RED, GL_R16, GL_RED, 0, 0, 0, 0, 1, 0, 0 };
+	FILE *f = fopen (toksvig_filename, "wb");
+	if (!f)
+	{
+		print_error ("Cannot open variance output file for writing.\n");
+		return NULL;
+	}
+	h.pixelWidth = image->width;
+	h.pixelHeight = image->height;
+	h.numberOfMipmapLevels = levels;
+	if (fwrite (&h, 1, sizeof (h), f) != sizeof (h))
+	{
+		fclose (f);
+		print_error ("Could not write ktx header.\n");
+		return NULL;
+	}
+	return f;
+}
+
+/* uploads renormalized mipmap levels that are box filtered from the unit
+ * normals of the base level and optionally writes their variance; the
+ * level images shrink in place, as every level is smaller than the last */
+int load_normal_levels (image_t *image, uint32_t levels, image_t *encoded, image_t *variance, uint8_t *packed, FILE *f)
+{
+	image_t *average = image;
+	uint32_t level;
+
+	for (level = 0; level < levels; level++)
+	{
+		if (level > 0)
+		{
+			image_t *next = downsample_image (average);
+			if (average != image)
+				free_image (average);
+			average = next;
+			if (average == NULL)
+			{
+				print_error ("Out of memory.\n");
+				return 0;
+			}
+		}
+
+		encoded->width = average->width;
+		encoded->height = average->height;
+		if (variance != NULL)
+		{
+			variance->width = average->width;
+			variance->height = average->height;
+		}
+		encode_normals (average, encoded, variance, signed_normals (header.glInternalFormat));
+		glTexImage2D (GL_TEXTURE_2D, level, upload_internal_format (), encoded->width, encoded->height, 0, GL_RGBA, GL_FLOAT, encoded->data);
+
+		if (f != NULL)
+		{
+			uint32_t imageSize = packed_image_size (variance->width, variance->height, GL_RED, GL_UNSIGNED_SHORT);
+			pack_image (variance, GL_RED, GL_UNSIGNED_SHORT, packed);
+			if (fwrite (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)
+					|| fwrite (packed, 1, imageSize, f) != imageSize)
+			{
+				if (average != image)
+					free_image (average);
+				print_error ("Could not write variance data.\n");
+				return 0;
+			}
+		}
+	}
+
+	if (average != image)
+		free_image (average);
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	return 1;
+}
+
+int load_normal_mipmaps (image_t *image)
+{
+	uint32_t levels = (header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels;
+	image_t *encoded, *variance = NULL;
+	uint8_t *packed = NULL;
+	FILE *f = NULL;
+	int result;
+
+	decode_normals (image);
+
+	encoded = create_image (image->width, image->height);
+	if (toksvig_filename != NULL)
+	{
+		variance = create_image (image->width, image->height);
+		packed = (uint8_t*) malloc (packed_image_size (image->width, image->height, GL_RED, GL_UNSIGNED_SHORT));
+	}
+	if (encoded == NULL || (toksvig_filename != NULL && (variance == NULL || packed == NULL)))
+	{
+		free_image (encoded);
+		free_image (variance);
+		free (packed);
+		print_error ("Out of memory.\n");
+		return 0;
+	}
+	if (toksvig_filename != NULL)
+		f = open_variance_file (image, levels);
+
+	result = (toksvig_filename == NULL || f != NULL)
+			&& load_normal_levels (image, levels, encoded, variance, packed, f);
+
+	free_image (encoded);
+	free_image (variance);
+	free (packed);
+	if (f != NULL && fclose (f) && result)
+	{
+		print_error ("Could not write variance data.\n");
+		result = 0;
+	}
+	return result;
+}
+
 GLuint load_texture (image_t *image)
 {
 	GLuint texture;
@@ -320,15 +739,36 @@ GLuint load_texture (image_t *image)
 
 	glBindTexture (GL_TEXTURE_2D, texture);
 
-	glTexImage2D (GL_TEXTURE_2D, 0, header.glInternalFormat, image->width, image->height, 0, GL_RGBA, GL_FLOAT, image->data);
+	if (normal_map)
+	{
+		if (!load_normal_mipmaps (image) || glGetError () != GL_NO_ERROR)
+		{
+			print_error ("Cannot load texture.\n");
+			return 0;
+		}
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+						 (header.numberOfMipmapLevels != 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		return texture;
+	}
+
+	glTexImage2D (GL_TEXTURE_2D, 0, upload_internal_format (), image->width, image->height, 0, GL_RGBA, GL_FLOAT, image->data);
 	if (glGetError () != GL_NO_ERROR)
 	{
-		fprintf (stderr, "Cannot load texture.\n");
+		print_error ("Cannot load texture.\n");
 		return 0;
 	}
 	if (header.numberOfMipmapLevels != 1)
 	{
-		glGenerateMipmap (GL_TEXTURE_2D);
+		if (coverage_cutoff > 0.0f)
+		{
+			if (!load_coverage_mipmaps (image) || glGetError () != GL_NO_ERROR)
+			{
+				print_error ("Cannot load mipmap levels.\n");
+				return 0;
+			}
+		}
+		else
+			glGenerateMipmap (GL_TEXTURE_2D);
 		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	}
 	else
@@ -341,57 +781,408 @@ GLuint load_texture (image_t *image)
 
 void cleanup (void)
 {
-	while (first_key_value_entry != NULL)
-	{
-		keyvaluedata_t *data = first_key_value_entry;
-		first_key_value_entry = first_key_value_entry->next;
-		free (data);
-	}
+	keyvalue_free (&key_value_data);
     if (texture)
     	glDeleteTextures (1, &texture);
 
     if (source)
 		free_image (source);
 
-    if (window != NULL)
-        glfwDestroyWindow (window);
+	context_destroy ();
+	image_terminate ();
+}
 
-	glfwTerminate ();
+int store_atlas_table (const char *table)
+{
+	if (atlas_table_filename != NULL)
+	{
+		FILE *f = fopen (atlas_table_filename, "w");
+		if (!f)
+		{
+			print_error ("Cannot open atlas table for writing.\n");
+			return 0;
+		}
+		if (fputs (table, f) == EOF)
+		{
+			fclose (f);
+			print_error ("Could not write atlas table.\n");
+			return 0;
+		}
+		if (fclose (f))
+		{
+			print_error ("Could not write atlas table.\n");
+			return 0;
+		}
+		return 1;
+	}
+	return AddKeyValueData ("ktxutils.atlas", table);
 }
 
-unsigned int intlog2 (unsigned int v)
+void prepare_header (void)
 {
-	unsigned int r = 0;
-	while (v >>= 1) r++;
-	return r;
+	header.pixelWidth = source->width;
+	header.pixelHeight = source->height;
+
+	/* scaled levels cannot be regenerated by the loader */
+	if ((coverage_cutoff > 0.0f || normal_map) && header.numberOfMipmapLevels == 0)
+		header.numberOfMipmapLevels = intlog2 (header.pixelWidth) + 1;
+
+	if (header.numberOfMipmapLevels > intlog2 (header.pixelWidth) + 1)
+		header.numberOfMipmapLevels = intlog2 (header.pixelWidth) + 1;
+	if (header.numberOfMipmapLevels > intlog2 (header.pixelHeight) + 1)
+		header.numberOfMipmapLevels = intlog2 (header.pixelHeight) + 1;
+}
+
+/* writes the header, the key value data and all levels of the texture */
+int write_texture (FILE *f)
+{
+	if (fwrite (&header, 1, sizeof (header), f) != sizeof (header)) {
+		print_error ("Could not write ktx header.\n");
+		return 0;
+	}
+
+	if (!keyvalue_write (&key_value_data, f)) {
+		print_error ("Could not write key value pair.\n");
+		return 0;
+	}
+
+	if (compressed)
+	{
+		glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+		if (!compressed) {
+			print_error ("Compressed texture format requested, but OpenGL reports an uncompressed texture.\n");
+			return 0;
+		}
+		glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &header.glInternalFormat);
+
+		int level;
+		readback_t *readback = readback_open (f);
+		if (readback == NULL)
+			return 0;
+		for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
+		{
+			uint32_t imageSize = 0;
+			glGetTexLevelParameteriv (GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &imageSize);
+			if (!readback_level (readback, level, 0, 0, imageSize))
+				break;
+		}
+		if (!readback_close (readback))
+			return 0;
+	}
+	else
+	{
+		int pixelSize = 0;
+		int components = 0;
+		switch (header.glBaseInternalFormat)
+		{
+		case GL_RED:
+		case GL_DEPTH_COMPONENT:
+			components = 1;
+			break;
+		case GL_RG:
+		case GL_DEPTH_STENCIL:
+			components = 2;
+			break;
+		case GL_RGB:
+			components = 3;
+			break;
+		case GL_RGBA:
+			components = 4;
+			break;
+		default:
+			print_error ("Invalid base internal format.\n");
+			return 0;
+		}
+		switch (header.glType)
+		{
+		case GL_UNSIGNED_BYTE:
+		case GL_BYTE:
+			pixelSize = components;
+			header.glTypeSize = 1;
+			break;
+		case GL_UNSIGNED_SHORT:
+		case GL_SHORT:
+		case GL_HALF_FLOAT:
+			pixelSize = components * 2;
+			header.glTypeSize = 2;
+			break;
+		case GL_UNSIGNED_INT:
+		case GL_INT:
+		case GL_FLOAT:
+			pixelSize = components * 4;
+			header.glTypeSize = 4;
+			break;
+		case GL_UNSIGNED_BYTE_3_3_2:
+		case GL_UNSIGNED_BYTE_2_3_3_REV:
+			if (components != 3) {
+				print_error ("Base internal format conflicts with type.\n");
+				return 0;
+			}
+			pixelSize = 1;
+			header.glTypeSize = 1;
+			break;
+		case GL_UNSIGNED_SHORT_5_6_5:
+		case GL_UNSIGNED_SHORT_5_6_5_REV:
+			if (components != 3) {
+				print_error ("Base internal format conflicts with type.\n");
+				return 0;
+			}
+			pixelSize = 2;
+			header.glTypeSize = 2;
+			break;
+		case GL_UNSIGNED_SHORT_4_4_4_4:
+		case GL_UNSIGNED_SHORT_4_4_4_4_REV:
+		case GL_UNSIGNED_SHORT_5_5_5_1:
+		case GL_UNSIGNED_SHORT_1_5_5_5_REV:
+			if (components != 4) {
+				print_error ("Base internal format conflicts with type.\n");
+				return 0;
+			}
+			pixelSize = 2;
+			header.glTypeSize = 2;
+			break;
+		case GL_UNSIGNED_INT_8_8_8_8:
+		case GL_UNSIGNED_INT_8_8_8_8_REV:
+		case GL_UNSIGNED_INT_10_10_10_2:
+		case GL_UNSIGNED_INT_2_10_10_10_REV:
+			if (components != 4) {
+				print_error ("Base internal format conflicts with type.\n");
+				return 0;
+			}
+			pixelSize = 4;
+			header.glTypeSize = 4;
+			break;
+		case GL_UNSIGNED_INT_5_9_9_9_REV:
+		case GL_UNSIGNED_INT_10F_11F_11F_REV:
+			if (components != 3 || header.glFormat != GL_RGB) {
+				print_error ("Base internal format conflicts with type.\n");
+				return 0;
+			}
+			pixelSize = 4;
+			header.glTypeSize = 4;
+			break;
+		default:
+			print_error ("Invalid type.\n");
+			return 0;
+		}
+
+		int level;
+		readback_t *readback = readback_open (f);
+		if (readback == NULL)
+			return 0;
+		for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
+		{
+			uint32_t imageSize = (header.pixelWidth >> level) * (header.pixelHeight >> level) * pixelSize;
+			if (!readback_level (readback, level, header.glFormat, header.glType, imageSize))
+				break;
+		}
+		if (!readback_close (readback))
+			return 0;
+	}
+
+	return 1;
+}
+
+typedef struct job {
+	ktx_header_t header;
+	int compressed;
+	const char *source_filename;
+	char **atlas_filenames;
+	size_t atlas_count;
+	unsigned int atlas_padding;
+	const char *atlas_table_filename;
+	char *atlas_table;
+	float coverage_cutoff;
+	int normal_map;
+	const char *toksvig_filename;
+	const char *dest_filename;
+	keyvaluelist_t key_value_data;
+	const void *input;
+	size_t inputsize;
+	image_t *source;
+} job_t;
+
+/* parses the arguments of a daemon request into a job, starting from the
+ * same defaults as the command line */
+void *prepare_job (int argc, char **argv, const void *input, size_t inputsize)
+{
+	static const ktx_header_t default_header = { KTX_MAGIC, 0x04030201, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0 };
+	job_t *job;
+	int result;
+
+	header = default_header;
+	compressed = 0;
+	source_filename = NULL;
+	atlas = 0;
+	atlas_filenames = NULL;
+	atlas_count = 0;
+	atlas_padding = 0;
+	atlas_table_filename = NULL;
+	coverage_cutoff = -1.0f;
+	normal_map = 0;
+	toksvig_filename = NULL;
+	dest_filename = NULL;
+
+	serving = 1;
+	optind = 0;
+	result = parse_options (argc, argv);
+	serving = 0;
+	if (!result)
+	{
+		keyvalue_free (&key_value_data);
+		return NULL;
+	}
+
+	job = (job_t*) calloc (1, sizeof (job_t));
+	if (job == NULL)
+	{
+		keyvalue_free (&key_value_data);
+		return NULL;
+	}
+	job->header = header;
+	job->compressed = compressed;
+	job->source_filename = source_filename;
+	if (atlas)
+	{
+		job->atlas_filenames = atlas_filenames;
+		job->atlas_count = atlas_count;
+	}
+	job->atlas_padding = atlas_padding;
+	job->atlas_table_filename = atlas_table_filename;
+	job->coverage_cutoff = coverage_cutoff;
+	job->normal_map = normal_map;
+	job->toksvig_filename = toksvig_filename;
+	job->dest_filename = dest_filename;
+	job->key_value_data = key_value_data;
+	key_value_data.first = key_value_data.last = NULL;
+	job->input = input;
+	job->inputsize = inputsize;
+	return job;
+}
+
+/* loads the source image of a job, called from the worker threads */
+int decode_job (void *arg)
+{
+	job_t *job = (job_t*) arg;
+	if (job->atlas_filenames != NULL)
+		job->source = build_atlas (job->atlas_filenames, job->atlas_count, job->atlas_padding,
+								   job->compressed ? 4 : 1, &job->atlas_table);
+	else if (!strcmp (job->source_filename, "-"))
+		job->source = load_image_memory (job->input, job->inputsize);
+	else
+		job->source = load_image (job->source_filename);
+	return job->source != NULL;
+}
+
+/* uploads the image of a job and writes the texture either to its
+ * destination file or to out */
+int convert_job (void *arg, FILE *out)
+{
+	job_t *job = (job_t*) arg;
+	FILE *f = out;
+	int result;
+
+	header = job->header;
+	compressed = job->compressed;
+	coverage_cutoff = job->coverage_cutoff;
+	normal_map = job->normal_map;
+	toksvig_filename = job->toksvig_filename;
+	atlas_table_filename = job->atlas_table_filename;
+	key_value_data = job->key_value_data;
+	job->key_value_data.first = job->key_value_data.last = NULL;
+	source = job->source;
+
+	/* errors of a previous job must not be attributed to this one */
+	while (glGetError () != GL_NO_ERROR);
+
+	result = (job->atlas_table == NULL || store_atlas_table (job->atlas_table));
+	if (result)
+	{
+		prepare_header ();
+		texture = load_texture (source);
+		result = (texture != 0);
+	}
+	if (result && strcmp (job->dest_filename, "-"))
+	{
+		f = fopen (job->dest_filename, "wb");
+		if (!f)
+			print_error ("Cannot open output file for writing.\n");
+		result = (f != NULL);
+	}
+	if (result)
+		result = write_texture (f);
+	if (f != NULL && f != out && fclose (f) && result)
+	{
+		print_error ("Could not write output file.\n");
+		result = 0;
+	}
+
+	if (texture)
+		glDeleteTextures (1, &texture);
+	texture = 0;
+	source = NULL;
+	keyvalue_free (&key_value_data);
+	return result;
+}
+
+void release_job (void *arg)
+{
+	job_t *job = (job_t*) arg;
+	if (job->source != NULL)
+		free_image (job->source);
+	free (job->atlas_table);
+	keyvalue_free (&job->key_value_data);
+	free (job);
+}
+
+int run_conversion_daemon (void)
+{
+	static const daemon_handler_t handler = { prepare_job, decode_job, convert_job, release_job };
+
+	image_init ();
+	if (!create_context ())
+		return 0;
+	return run_daemon (daemon_socket, &handler);
 }
 
 int main (int argc, char *argv[])
 {
 	if (!parse_options (argc, argv)) {
-		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
+		print_error ("Invalid arguments. For help type %s -h.\n", argv[0]);
 		return -1;
 	}
 
-	if (!glfwInit ())
+	if (daemon_socket != NULL)
 	{
-		fprintf (stderr, "Cannot initialize GLFW.\n");
+		run_conversion_daemon ();
+		cleanup ();
 		return -1;
 	}
 
-	source = load_image (source_filename);
+	image_init ();
+
+	if (atlas)
+	{
+		char *table = NULL;
+		source = build_atlas (atlas_filenames, atlas_count, atlas_padding, compressed ? 4 : 1, &table);
+		if (!source || !store_atlas_table (table))
+		{
+			free (table);
+			cleanup ();
+			return -1;
+		}
+		free (table);
+	}
+	else
+	{
+		source = load_image (source_filename);
+	}
 	if (!source)
 	{
 		cleanup ();
 		return -1;
 	}
-	header.pixelWidth = source->width;
-	header.pixelHeight = source->height;
-
-	if (header.numberOfMipmapLevels > intlog2 (header.pixelWidth) + 1)
-		header.numberOfMipmapLevels = intlog2 (header.pixelWidth) + 1;
-	if (header.numberOfMipmapLevels > intlog2 (header.pixelHeight) + 1)
-		header.numberOfMipmapLevels = intlog2 (header.pixelHeight) + 1;
+	prepare_header ();
 
 	if (!create_context ())
 	{
@@ -433,211 +1224,22 @@ int main (int argc, char *argv[])
 	}
 	else
 	{
-		FILE *f = fopen (dest_filename, "wb");
+		FILE *f = ktx_fopen (dest_filename, "wb");
 		if (!f) {
-			fprintf (stderr, "Cannot open output file for writing.\n");
+			print_error ("Cannot open output file for writing.\n");
 			cleanup ();
 			return -1;
 		}
 
-		if (fwrite (&header, 1, sizeof (header), f) != sizeof (header)) {
+		if (!write_texture (f)) {
 			fclose (f);
-			fprintf (stderr, "Could not write ktx header.\n");
 			cleanup ();
 			return -1;
 		}
-
-		{
-			keyvaluedata_t *data;
-			for (data = first_key_value_entry; data != NULL; data = data->next)
-			{
-				int i;
-				if (fwrite (&data->len, 1, sizeof (uint32_t) + data->len, f) != sizeof (uint32_t) + data->len) {
-					fclose (f);
-					fprintf (stderr, "Could not write key value pair.\n");
-					cleanup ();
-					return -1;
-				}
-				for (i = 0; i < (3 - ((data->len + 3) % 4)); i++)
-					fputc (0, f);
-			}
-		}
-
-		if (compressed)
-		{
-			glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
-			if (!compressed) {
-				fclose (f);
-				fprintf (stderr, "Compressed texture format requested, but OpenGL reports an uncompressed texture.\n");
-				cleanup ();
-				return -1;
-			}
-			glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &header.glInternalFormat);
-
-			int level;
-			for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
-			{
-				uint32_t imageSize = 0;
-				glGetTexLevelParameteriv (GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &imageSize);
-
-				if (fwrite (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
-					fclose (f);
-					fprintf (stderr, "Could not write image size.\n");
-					cleanup ();
-					return -1;
-				}
-
-				void *data = malloc (imageSize);
-				glGetCompressedTexImage (GL_TEXTURE_2D, level, data);
-				if (fwrite (data, 1, imageSize, f) != imageSize) {
-					free (data);
-					fclose (f);
-					fprintf (stderr, "Could not write image data.\n");
-					cleanup ();
-					return -1;
-				}
-				free (data);
-
-				{
-					int i;
-					for (i = 0; i < (3 - ((imageSize + 3) % 4)); i++) {
-						fputc (0, f);
-					}
-				}
-			}
-
-			fclose (f);
-
-		}
-		else
-		{
-			int pixelSize = 0;
-			int components = 0;
-			switch (header.glBaseInternalFormat)
-			{
-			case GL_RED:
-			case GL_DEPTH_COMPONENT:
-				components = 1;
-				break;
-			case GL_RG:
-			case GL_DEPTH_STENCIL:
-				components = 2;
-				break;
-			case GL_RGB:
-				components = 3;
-				break;
-			case GL_RGBA:
-				components = 4;
-				break;
-			default:
-				fclose (f);
-				fprintf (stderr, "Invalid base internal format.\n");
-				cleanup ();
-				return -1;
-			}
-			switch (header.glType)
-			{
-			case GL_UNSIGNED_BYTE:
-			case GL_BYTE:
-				pixelSize = components;
-				header.glTypeSize = 1;
-				break;
-			case GL_UNSIGNED_SHORT:
-			case GL_SHORT:
-				pixelSize = components * 2;
-				header.glTypeSize = 2;
-				break;
-			case GL_UNSIGNED_INT:
-			case GL_INT:
-			case GL_FLOAT:
-				pixelSize = components * 4;
-				header.glTypeSize = 4;
-				break;
-			case GL_UNSIGNED_BYTE_3_3_2:
-			case GL_UNSIGNED_BYTE_2_3_3_REV:
-				if (components != 3) {
-					fclose (f);
-					fprintf (stderr, "Base internal format conflicts with type.\n");
-					cleanup ();
-					return -1;
-				}
-				pixelSize = 1;
-				header.glTypeSize = 1;
-				break;
-			case GL_UNSIGNED_SHORT_5_6_5:
-			case GL_UNSIGNED_SHORT_5_6_5_REV:
-				if (components != 3) {
-					fclose (f);
-					fprintf (stderr, "Base internal format conflicts with type.\n");
-					cleanup ();
-					return -1;
-				}
-				pixelSize = 2;
-				header.glTypeSize = 2;
-				break;
-			case GL_UNSIGNED_SHORT_4_4_4_4:
-			case GL_UNSIGNED_SHORT_4_4_4_4_REV:
-			case GL_UNSIGNED_SHORT_5_5_5_1:
-			case GL_UNSIGNED_SHORT_1_5_5_5_REV:
-				if (components != 4) {
-					fclose (f);
-					fprintf (stderr, "Base internal format conflicts with type.\n");
-					cleanup ();
-					return -1;
-				}
-				pixelSize = 2;
-				header.glTypeSize = 2;
-				break;
-			case GL_UNSIGNED_INT_8_8_8_8:
-			case GL_UNSIGNED_INT_8_8_8_8_REV:
-			case GL_UNSIGNED_INT_10_10_10_2:
-			case GL_UNSIGNED_INT_2_10_10_10_REV:
-				if (components != 4) {
-					fclose (f);
-					fprintf (stderr, "Base internal format conflicts with type.\n");
-					cleanup ();
-					return -1;
-				}
-				pixelSize = 4;
-				header.glTypeSize = 4;
-				break;
-			default:
-				fclose (f);
-				fprintf (stderr, "Invalid type.\n");
-				cleanup ();
-				return -1;
-			}
-
-			int level;
-			void *data = malloc ((header.pixelWidth * header.pixelHeight * pixelSize + 0xFF) & ~0xFF);
-			for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
-			{
-				uint32_t imageSize = (header.pixelWidth >> level) * (header.pixelHeight >> level) * pixelSize;
-				if (fwrite (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
-					free (data);
-					fclose (f);
-					fprintf (stderr, "Could not write image size.\n");
-					cleanup ();
-					return -1;
-				}
-
-				glGetTexImage (GL_TEXTURE_2D, level, header.glFormat, header.glType, data);
-				if (fwrite (data, 1, imageSize, f) != imageSize) {
-					free (data);
-					fclose (f);
-					fprintf (stderr, "Could not write image data.\n");
-					cleanup ();
-					return -1;
-				}
-
-				{
-					int i;
-					for (i = 0; i < (3 - ((imageSize + 3) % 4)); i++) {
-						fputc (0, f);
-					}
-				}
-			}
-			free (data);
+		if (fclose (f)) {
+			print_error ("Could not write output file.\n");
+			cleanup ();
+			return -1;
 		}
 	}
 
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#define CONTEXT_AUTO 0
+#define CONTEXT_GLFW 1
+#define CONTEXT_EGL 2
+
+/* selects how OpenGL contexts are created by name, one of auto, glfw or
+ * egl; must be called before context_create */
+int context_set_backend (const char *name);
+
+/* creates an OpenGL context without a window, makes it current on the
+ * calling thread and initializes GLEW; the automatic backend uses a hidden
+ * GLFW window if a display is available and EGL without any surface
+ * otherwise, which works on servers without X or Wayland */
+int context_create (const char *title);
+
+/* opens a visible GLFW window of the given size instead, which is required
+ * for displaying images */
+GLFWwindow *context_create_window (const char *title, int width, int height);
+
+/* destroys the context and terminates GLFW; safe to call in any case */
+void context_destroy (void);
+
+#endif /* CONTEXT_H */
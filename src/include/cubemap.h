@@ -0,0 +1,34 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+/* faces are numbered in OpenGL order: +X, -X, +Y, -Y, +Z, -Z */
+
+/* unnormalized direction through the point (s, t) in [-1, 1] of a face,
+ * with t = -1 at the first row of the face */
+void cubemap_direction (int face, float s, float t, float *dir);
+
+/* maps a direction to a face and the coordinates (s, t) in [-1, 1] */
+int cubemap_face (const float *dir, float *s, float *t);
+
+/* solid angle covered by texel (x, y) of a face of the given size */
+float cubemap_texel_solid_angle (unsigned int size, unsigned int x, unsigned int y);
+
+#endif /* CUBEMAP_H */
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HALF_H
+#define HALF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* convert between floats and IEEE 754 half floats, rounding to the nearest
+ * even value and preserving infinities, NaNs and denormals; F16C
+ * instructions are used if the CPU supports them */
+void float_to_half (const float *src, uint16_t *dst, size_t count);
+void half_to_float (const uint16_t *src, float *dst, size_t count);
+
+#endif /* HALF_H */
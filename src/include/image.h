@@ -0,0 +1,108 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct image {
+	size_t width;
+	size_t height;
+	float *data;
+} image_t;
+
+/* alpha value used for images without an alpha channel */
+extern float defaultalpha;
+
+#define IMPORT_COLORSPACE_KEEP 0
+#define IMPORT_COLORSPACE_LINEARIZE 1
+#define IMPORT_COLORSPACE_ENCODE 2
+
+#define IMPORT_SWIZZLE_ZERO 4
+#define IMPORT_SWIZZLE_ONE 5
+
+/* conversions applied to every loaded image in a single pass: missing alpha
+ * is filled with defaultalpha, colors are converted from or to sRGB and
+ * premultiplied by alpha in linear space, then the channels are swizzled;
+ * swizzle holds the source channel 0-3 or IMPORT_SWIZZLE_ZERO/ONE */
+typedef struct import_settings {
+	int colorspace;
+	int premultiply;
+	int swizzle[4];
+} import_settings_t;
+
+extern import_settings_t import_settings;
+
+/* must be called before any images are loaded; load_image may then be
+ * called from several threads at once */
+void image_init (void);
+void image_terminate (void);
+
+/* import settings must not be changed after image_init; a filename of
+ * "-" reads the image from stdin */
+image_t *load_image (const char *filename);
+/* decodes an image file that was already read into memory */
+image_t *load_image_memory (const void *data, size_t size);
+/* writes an image in the format given by the file name extension; "-"
+ * writes PNG to stdout */
+int save_image (const image_t *image, const char *filename);
+image_t *create_image (size_t width, size_t height);
+void free_image (image_t *image);
+
+/* writes PNG files row by row, so that images of any size can be written
+ * with little memory; rows hold RGBA values with a depth of 8 or 16 bits
+ * in host byte order and "-" writes to stdout; PNG output requires libpng,
+ * which png_writer_available reports */
+typedef struct png_writer png_writer_t;
+
+int png_writer_available (void);
+png_writer_t *png_writer_open (const char *filename, size_t width, size_t height, int depth);
+int png_writer_write (png_writer_t *writer, const void *rows, size_t count, size_t stride);
+/* finishes the file and returns 0 if any part of it could not be written */
+int png_writer_close (png_writer_t *writer);
+
+/* returns the next mipmap level of an image using a box filter */
+image_t *downsample_image (const image_t *image);
+
+/* fraction of texels whose alpha value passes an alpha test against cutoff,
+ * i.e. is not less than the cutoff; returns a negative value on failure */
+float alpha_coverage (const image_t *image, float cutoff);
+
+/* factor by which the alpha values of an image need to be scaled so that
+ * the given fraction of its texels passes the alpha test, or a negative
+ * value on failure */
+float alpha_coverage_scale (const image_t *image, float cutoff, float coverage);
+
+/* multiplies all alpha values by scale, clamping them to 1 */
+void scale_alpha (image_t *image, float scale);
+
+/* converts colors into unit normals in place; box filtering the result with
+ * downsample_image yields the average normal of each texel's footprint */
+void decode_normals (image_t *image);
+
+/* stores the normalized x and y components of the averaged normals in the
+ * red and green channels of dst, mapped to [0, 1] unless snorm is set;
+ * optionally writes the variance of the normals within each texel, which
+ * is derived from the length of the average as in Toksvig's method */
+void encode_normals (const image_t *image, image_t *dst, image_t *variance, int snorm);
+
+
+#endif /* IMAGE_H */
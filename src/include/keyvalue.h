@@ -0,0 +1,54 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KEYVALUE_H
+#define KEYVALUE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct keyvaluedata
+{
+	struct keyvaluedata *next;
+	uint32_t len;
+	char data[];
+} keyvaluedata_t;
+
+typedef struct keyvaluelist
+{
+	keyvaluedata_t *first;
+	keyvaluedata_t *last;
+} keyvaluelist_t;
+
+#define KEYVALUELIST_INIT { NULL, NULL }
+
+int keyvalue_add (keyvaluelist_t *list, const char *key, const void *value, uint32_t valuelen);
+/* replaces the value of an existing key or appends a new entry */
+int keyvalue_set (keyvaluelist_t *list, const char *key, const void *value, uint32_t valuelen);
+int keyvalue_remove (keyvaluelist_t *list, const char *key);
+keyvaluedata_t *keyvalue_find (const keyvaluelist_t *list, const char *key);
+const char *keyvalue_value (const keyvaluedata_t *data, uint32_t *valuelen);
+void keyvalue_free (keyvaluelist_t *list);
+
+/* size of the serialized list including padding, i.e. bytesOfKeyValueData */
+uint32_t keyvalue_size (const keyvaluelist_t *list);
+int keyvalue_parse (keyvaluelist_t *list, const void *data, uint32_t size);
+void keyvalue_serialize (const keyvaluelist_t *list, void *buffer);
+int keyvalue_write (const keyvaluelist_t *list, FILE *f);
+
+#endif /* KEYVALUE_H */
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KTXFILE_H
+#define KTXFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "ktx.h"
+#include "keyvalue.h"
+
+#define KTX_ENDIANNESS 0x04030201
+
+#define KTX_PADDING(size) (3 - (((size) + 3) % 4))
+
+#define KTX_MAX_LEVELS 32
+
+/* files that store their mipmap levels smallest first carry the value
+ * "reverse" under this key; standard files store level 0 first */
+#define KTX_LEVEL_ORDER_KEY "ktxutils.levelorder"
+
+/* number of mipmap levels actually stored in a file with the given header */
+uint32_t ktx_level_count (const ktx_header_t *header);
+
+/* number of bytes following the imageSize field of a mipmap level,
+ * including cube and mipmap padding */
+off_t ktx_level_data_size (const ktx_header_t *header, uint32_t imageSize);
+
+/* number of array elements and of z slices of a mipmap level, at least 1 */
+uint32_t ktx_layer_count (const ktx_header_t *header);
+uint32_t ktx_slice_count (const ktx_header_t *header, uint32_t level);
+
+/* locates a single 2D image within the data following the imageSize field
+ * of a mipmap level and stores its size in size */
+const uint8_t *ktx_subimage (const ktx_header_t *header, const uint8_t *data, uint32_t imageSize,
+		uint32_t level, uint32_t layer, uint32_t face, uint32_t slice, uint32_t *size);
+
+int ktx_read_image_size (int fd, off_t offset, uint32_t *imageSize);
+
+int ktx_levels_reversed (const keyvaluelist_t *list);
+
+/* locates the imageSize field of every stored mipmap level by following
+ * the imageSize fields through the file; image_sizes may be NULL */
+int ktx_index_levels_fd (int fd, const ktx_header_t *header, int reversed, off_t *offsets, uint32_t *image_sizes);
+
+typedef struct ktx_mapping {
+	const uint8_t *data;
+	size_t size;
+} ktx_mapping_t;
+
+/* maps a whole file read-only and asks the kernel to read it ahead, as
+ * the levels are mostly accessed in order */
+int ktx_map (const char *filename, ktx_mapping_t *mapping);
+void ktx_unmap (ktx_mapping_t *mapping);
+
+/* returns the header of a mapped file or NULL if it is not a KTX file */
+const ktx_header_t *ktx_mapped_header (const ktx_mapping_t *mapping);
+
+/* computes the offset of the imageSize field of every stored mipmap level
+ * in either level order and checks that all levels lie within the mapping */
+int ktx_index_levels (const ktx_mapping_t *mapping, size_t *offsets);
+
+/* the same for size bytes of level data that follow the key value data,
+ * with the offsets relative to data */
+int ktx_index_level_data (const ktx_header_t *header, int reversed, const uint8_t *data, size_t size, size_t *offsets);
+
+/* copies length bytes between two file descriptors without passing them
+ * through user space if the kernel supports it */
+int ktx_copy_data (int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t length);
+
+/* reads a stream up to its end into a buffer allocated with malloc;
+ * returns NULL if reading fails or memory runs out */
+uint8_t *ktx_read_stream (FILE *f, size_t *size);
+
+/* opens a file like fopen, but "-" refers to stdin or stdout depending
+ * on the mode */
+FILE *ktx_fopen (const char *filename, const char *mode);
+
+/* skip or copy data by reading it sequentially, so that these work on
+ * pipes as well */
+int ktx_fskip (FILE *f, off_t length);
+int ktx_fcopy (FILE *in, FILE *out, off_t length);
+
+int ktx_read_keyvalue (int fd, const ktx_header_t *header, keyvaluelist_t *list);
+
+/* reads individual mipmap levels in any order, e.g. smallest first for
+ * streaming; opening a file reads only its header, the key value data and
+ * the imageSize fields and maps the rest without reading it */
+typedef struct ktx_reader {
+	int fd;
+	ktx_header_t header;
+	int reversed;
+	off_t offsets[KTX_MAX_LEVELS];
+	uint32_t image_sizes[KTX_MAX_LEVELS];
+	ktx_mapping_t mapping;
+} ktx_reader_t;
+
+int ktx_reader_open (const char *filename, ktx_reader_t *reader);
+void ktx_reader_close (ktx_reader_t *reader);
+/* asks the kernel to read the given range of levels ahead */
+void ktx_reader_prefetch (const ktx_reader_t *reader, uint32_t first, uint32_t last);
+/* size of the data of a level following its imageSize field */
+off_t ktx_reader_level_size (const ktx_reader_t *reader, uint32_t level);
+/* reads ktx_reader_level_size bytes, i.e. all faces including padding */
+int ktx_reader_read_level (const ktx_reader_t *reader, uint32_t level, void *data);
+/* the same data within the mapping, e.g. to upload it without a copy */
+const uint8_t *ktx_reader_level_data (const ktx_reader_t *reader, uint32_t level);
+
+/* replaces the key value data of a KTX file; the file is updated in place
+ * if the new data has the same size as the old, otherwise it is rewritten
+ * to a temporary file which then replaces the original */
+int ktx_replace_keyvalue (const char *filename, const keyvaluelist_t *list);
+
+#endif /* KTXFILE_H */
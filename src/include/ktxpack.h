@@ -0,0 +1,97 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef KTXPACK_H
+#define KTXPACK_H
+
+#include <stdint.h>
+#include "ktxfile.h"
+
+/* A pack stores many KTX files in one archive. The archive starts with a
+ * directory made up of the header, one hash seed per bucket, the entry
+ * slots and a table of zero terminated names. The directory and every
+ * stored file start at a multiple of KTXPACK_ALIGNMENT, so files can be
+ * used in place from a mapping of the archive. Names are looked up through
+ * a perfect hash: a name selects a bucket, and the seed of that bucket
+ * selects a slot that no other name of the pack maps to. All fields are
+ * stored in the byte order given by endianness. */
+
+#define KTXPACK_MAGIC { 0xAB, 0x4B, 0x54, 0x58, 0x50, 0x41, 0x43, 0x4B }
+#define KTXPACK_VERSION 1
+#define KTXPACK_ALIGNMENT 4096
+/* name_offset of an unused slot */
+#define KTXPACK_EMPTY_SLOT 0xFFFFFFFF
+
+typedef struct ktxpack_header {
+	uint8_t identifier[8];
+	uint32_t endianness;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t bucket_count;
+	uint32_t slot_count;
+	uint32_t names_size;
+	uint64_t seeds_offset;
+	uint64_t slots_offset;
+	uint64_t names_offset;
+	uint64_t directory_size;
+} ktxpack_header_t;
+
+/* copied from the header of the stored KTX file */
+typedef struct ktxpack_entry {
+	uint64_t offset;
+	uint64_t size;
+	uint32_t name_offset;
+	uint32_t name_length;
+	uint32_t glInternalFormat;
+	uint32_t glFormat;
+	uint32_t glType;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t numberOfArrayElements;
+	uint32_t numberOfFaces;
+	uint32_t numberOfMipmapLevels;
+	uint32_t reserved;
+} ktxpack_entry_t;
+
+uint64_t ktxpack_hash (const char *name, size_t length);
+uint32_t ktxpack_bucket (const ktxpack_header_t *header, uint64_t hash);
+uint32_t ktxpack_slot (const ktxpack_header_t *header, uint64_t hash, uint32_t seed);
+
+typedef struct ktxpack {
+	ktx_mapping_t mapping;
+	const ktxpack_header_t *header;
+	const uint32_t *seeds;
+	const ktxpack_entry_t *slots;
+	const char *names;
+} ktxpack_t;
+
+/* maps an archive and validates its directory */
+int ktxpack_open (const char *filename, ktxpack_t *pack);
+void ktxpack_close (ktxpack_t *pack);
+
+/* returns the entry of the given name or NULL */
+const ktxpack_entry_t *ktxpack_find (const ktxpack_t *pack, const char *name);
+const char *ktxpack_name (const ktxpack_t *pack, const ktxpack_entry_t *entry);
+
+/* points view at the stored file without copying it; the view can be used
+ * with ktx_mapped_header and ktx_index_levels, but must not be unmapped
+ * and is only valid until the pack is closed */
+void ktxpack_view (const ktxpack_t *pack, const ktxpack_entry_t *entry, ktx_mapping_t *view);
+
+#endif /* KTXPACK_H */
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PACK_H
+#define PACK_H
+
+#include <GL/glew.h>
+#include "image.h"
+
+/* size of a single packed pixel in bytes or 0 if the combination of
+ * format and type cannot be packed on the CPU */
+size_t packed_pixel_size (GLenum format, GLenum type);
+
+/* size of a packed image whose rows are aligned to four bytes, as
+ * required for KTX files */
+size_t packed_image_size (size_t width, size_t height, GLenum format, GLenum type);
+
+/* shared exponent and packed float types, which are encoded from 32 bit
+ * floats on the CPU so that their rounding does not depend on the driver */
+int packed_float_type (GLenum type);
+
+/* converts count RGBA float pixels into the given format and type */
+int pack_pixels (const float *src, size_t count, GLenum format, GLenum type, void *dst);
+int pack_image (const image_t *image, GLenum format, GLenum type, void *dst);
+
+/* converts count packed pixels into RGBA floats, missing color components
+ * are set to zero and a missing alpha component to one */
+int unpack_pixels (const void *src, size_t count, GLenum format, GLenum type, float *dst);
+
+#endif /* PACK_H */
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <GL/glew.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* writes mipmap levels of the texture bound to GL_TEXTURE_2D to a KTX
+ * file; every level is read back into one of two pixel buffer objects
+ * while an I/O thread writes the previous one, so that transfers and disk
+ * writes overlap; the buffers are reused and only grow to the size of the
+ * largest level */
+typedef struct readback readback_t;
+
+/* nothing else may be written to the file until readback_close */
+readback_t *readback_open (FILE *f);
+
+/* reads back a level in the given format and type, or its compressed
+ * image if format is 0, and queues it to be written preceded by imageSize
+ * and followed by padding; packed float types are read back as floats and
+ * encoded on the CPU; returns 0 once writing has failed */
+int readback_level (readback_t *readback, GLint level, GLenum format, GLenum type, uint32_t imageSize);
+
+/* writes the remaining level and releases the buffers, returns 0 if
+ * anything could not be written */
+int readback_close (readback_t *readback);
+
+#endif /* READBACK_H */
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <stddef.h>
+
+typedef void (*task_func_t) (size_t index, void *arg);
+
+/* limits the number of threads used for parallel execution, including
+ * the calling thread; must be called before parallel_for is first used */
+void task_set_concurrency (unsigned int n);
+
+/* number of worker threads used for parallel execution */
+unsigned int task_concurrency (void);
+
+/* calls func (i, arg) for every i in [0, count) using all available cores
+ * and returns once all calls have finished; func may call parallel_for
+ * itself, and the nested iterations are shared by all threads */
+void parallel_for (size_t count, task_func_t func, void *arg);
+
+#endif /* TASKS_H */
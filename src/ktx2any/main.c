@@ -16,221 +16,626 @@
  * You should have received a copy of the GNU General Public License
  * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <GL/glew.h>
-#include <GLFW/glfw3.h>
 #include "ktx.h"
-#include <string.h>
-#define MAGICKCORE_QUANTUM_DEPTH 32
-#define MAGICKCORE_HDRI_ENABLE 1
-#include <MagickWand/MagickWand.h>
+#include "ktxfile.h"
+#include "image.h"
+#include "pack.h"
+#include "tasks.h"
+#include "context.h"
+
+/* a single 2D image of the texture and the file it is exported to */
+typedef struct subimage {
+	uint32_t level, layer, face, slice;
+	size_t width, height;
+	const uint8_t *data;
+	uint32_t size;
+	char *filename;
+	image_t *image;
+	int result;
+} subimage_t;
+
+typedef struct range {
+	uint32_t first, last;
+} range_t;
+
+#define RANGE_ALL { 0, UINT32_MAX }
 
-GLFWwindow *window = NULL;
-FILE *f = NULL;
-ktx_header_t header;
 GLuint texture = 0;
-float *imagedata = NULL;
-
-int load_texture (void)
+ktx_mapping_t input = { NULL, 0 };
+/* stdin is read into memory instead of being mapped */
+uint8_t *input_buffer = NULL;
+const ktx_header_t *header = NULL;
+size_t offsets[KTX_MAX_LEVELS];
+subimage_t *subimages = NULL;
+size_t subimage_count = 0;
+
+const char *input_filename = NULL;
+const char *output_filename = NULL;
+int export_all = 0;
+range_t levels = RANGE_ALL;
+range_t faces = RANGE_ALL;
+range_t layers = RANGE_ALL;
+range_t slices = RANGE_ALL;
+/* PNG output is written in bands of rows instead of whole float images */
+int streaming = 0;
+
+#define STREAM_BAND_HEIGHT 64
+
+int SetRange (const char *str, range_t *range, const char *name)
 {
-	glGenTextures (1, &texture);
+	char *endptr;
+	int valid;
 
-	glBindTexture (GL_TEXTURE_2D, texture);
+	range->first = range->last = strtoul (str, &endptr, 10);
+	valid = endptr != str;
+	if (valid && *endptr == '-')
+	{
+		str = endptr + 1;
+		range->last = UINT32_MAX;
+		if (*str)
+		{
+			range->last = strtoul (str, &endptr, 10);
+			valid = endptr != str;
+		}
+		else
+			endptr = (char*) str;
+	}
+	if (!valid || *endptr || range->last < range->first)
+	{
+		fprintf (stderr, "Invalid %s requested.\n", name);
+		return 0;
+	}
+	export_all = 1;
+	return 1;
+}
+
+int SetJobs (const char *jobsstr)
+{
+	char *endptr;
+	unsigned long jobs = strtoul (jobsstr, &endptr, 10);
+	if (jobsstr + strlen (jobsstr) != endptr || jobs == 0)
+	{
+		fprintf (stderr, "Invalid number of jobs requested.\n");
+		return 0;
+	}
+	task_set_concurrency (jobs);
+	return 1;
+}
 
-	int level;
+void usage (char *appname)
+{
+	fprintf (stdout, "Usage: %s [options] ktxfile outputfile\n"
+			"Options:\n"
+			"  -h, --help                Display this help message.\n"
+			"  -j, --jobs [count]        Limit the number of threads (default: number\n"
+			"                            of cores).\n"
+			"  -C, --context [backend]   Create the OpenGL context with glfw or egl. By\n"
+			"                            default a hidden GLFW window is used if a\n"
+			"                            display is available and EGL otherwise.\n"
+			"  -A, --all                 Export all levels, faces, array elements\n"
+			"                            and slices.\n"
+			"  -l, --levels [first-last] Export the given mipmap levels.\n"
+			"  -f, --faces [first-last]  Export the given cube map faces.\n"
+			"  -a, --array [first-last]  Export the given array elements.\n"
+			"  -s, --slices [first-last] Export the given slices of a 3D texture.\n"
+			"\n"
+			"Ranges may consist of a single number or omit their last value.\n"
+			"Without options, level 0 of the first face and array element is\n"
+			"written to outputfile. Otherwise every image selected by the\n"
+			"options is written to a file named\n"
+			"<name>_l<level>_f<face>_a<element>[_s<slice>].<ext> after the\n"
+			"outputfile <name>.<ext>, where _s only appears for 3D textures.\n"
+			"\n"
+			"PNG files are written in bands of rows with 8 bits per channel for\n"
+			"8 bit and compressed sources and 16 bits otherwise.\n"
+			"\n"
+			"Arguments:\n"
+			"  ktxfile                   KTX file to export, - for stdin.\n"
+			"  outputfile                Image file to write, - for PNG on stdout.\n", appname);
+	exit (0);
+}
 
-	for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
+int parse_options (int argc, char **argv)
+{
+	int c = 0;
+	static struct option long_options[] = {
+			{ "help", no_argument, 0, 'h' },
+			{ "all", no_argument, 0, 'A' },
+			{ "levels", required_argument, 0, 'l' },
+			{ "faces", required_argument, 0, 'f' },
+			{ "array", required_argument, 0, 'a' },
+			{ "slices", required_argument, 0, 's' },
+			{ "jobs", required_argument, 0, 'j' },
+			{ "context", required_argument, 0, 'C' },
+			{ 0, 0, 0, 0 }
+	};
+
+	while (1)
 	{
-		uint32_t imageSize = 0;
-		if (fread (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
-			fprintf (stderr, "Could not read image size\n");
-			return 0;
-		}
-		void *data = malloc (imageSize);
+		int option_index = 0;
+		c = getopt_long (argc, argv, "l:f:a:s:j:C:hA", long_options, &option_index);
 
-		if (fread (data, 1, imageSize, f) != imageSize) {
-			fprintf (stderr, "Could not read image data\n");
-			free (data);
-			return 0;
-		}
+		if (c== -1) break;
 
-		if (header.glType != 0)
+		switch (c)
 		{
-			glTexImage2D (GL_TEXTURE_2D, level, header.glInternalFormat, (header.pixelWidth >> level), (header.pixelHeight >> level), 0,
-					header.glFormat, header.glType, data);
-		}
-		else
-		{
-			glCompressedTexImage2D (GL_TEXTURE_2D, level, header.glInternalFormat,
-					(header.pixelWidth >> level), (header.pixelHeight >> level), 0,
-					imageSize, data);
+		case 'j':
+			if (!SetJobs (optarg)) return 0;
+			break;
+		case 'C':
+			if (!context_set_backend (optarg)) return 0;
+			break;
+		case 'h':
+			usage (argv[0]);
+			break;
+		case 'A':
+			export_all = 1;
+			break;
+		case 'l':
+			if (!SetRange (optarg, &levels, "levels")) return 0;
+			break;
+		case 'f':
+			if (!SetRange (optarg, &faces, "faces")) return 0;
+			break;
+		case 'a':
+			if (!SetRange (optarg, &layers, "array elements")) return 0;
+			break;
+		case 's':
+			if (!SetRange (optarg, &slices, "slices")) return 0;
+			break;
+		default:
+			return 0;
 		}
+	}
 
-		free (data);
+	if (argc - optind != 2)
+	{
+		fprintf (stderr, "Invalid number of arguments.\n");
+		return 0;
+	}
+	input_filename = argv[optind];
+	output_filename = argv[optind + 1];
 
-		{
-			int skip = (3 - ((imageSize + 3) % 4));
-			if (skip > 0)
-			{
-				if (fseek (f, skip, SEEK_CUR))
-				{
-					fprintf (stderr, "Could not skip padding bytes\n");
-					return 0;
-				}
-			}
-		}
+	if (export_all && !strcmp (output_filename, "-"))
+	{
+		fprintf (stderr, "Several images cannot be written to stdout.\n");
+		return 0;
+	}
+	if (!export_all)
+	{
+		levels.last = faces.last = layers.last = slices.last = 0;
 	}
 
-	if (header.numberOfMipmapLevels == 0) {
-		glGenerateMipmap (GL_TEXTURE_2D);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	} else if (header.numberOfMipmapLevels == 1) {
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	} else {
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.numberOfMipmapLevels);
+	{
+		const char *ext = strrchr (output_filename, '.');
+		streaming = png_writer_available ()
+				&& (!strcmp (output_filename, "-") || (ext != NULL && !strcasecmp (ext, ".png")));
 	}
+	return 1;
+}
+
+/* reads all of stdin, which need not be seekable */
+int read_stdin (void)
+{
+	size_t size;
 
+	input_buffer = ktx_read_stream (stdin, &size);
+	if (input_buffer == NULL)
+	{
+		fprintf (stderr, "Cannot read KTX file from stdin.\n");
+		return 0;
+	}
+	input.data = input_buffer;
+	input.size = size;
 	return 1;
 }
 
-int load_ktx_header (void)
+int load_input (void)
 {
-	if (fread (&header, 1, sizeof (ktx_header_t), f) != sizeof (ktx_header_t)) {
-		fprintf (stderr, "Cannot read KTX header.\n");
+	if (!strcmp (input_filename, "-"))
+	{
+		if (!read_stdin ())
+			return 0;
+	}
+	else if (!ktx_map (input_filename, &input))
+	{
+		fprintf (stderr, "Cannot open input file.\n");
 		return 0;
 	}
 
-	const uint8_t ktx_magic[] = KTX_MAGIC;
-	if (memcmp (&header.identifier[0], &ktx_magic[0], sizeof (ktx_magic))) {
+	header = ktx_mapped_header (&input);
+	if (header == NULL) {
 		fprintf (stderr, "Not a KTX file.\n");
 		return 0;
 	}
-
-	if (fseek (f, header.bytesOfKeyValueData, SEEK_CUR)) {
-		fprintf (stderr, "Could not skip key value data.\n");
+	if (header->endianness != KTX_ENDIANNESS || header->numberOfMipmapLevels > KTX_MAX_LEVELS
+			|| header->numberOfFaces == 0 || !ktx_index_levels (&input, offsets)) {
+		fprintf (stderr, "Invalid KTX file.\n");
 		return 0;
 	}
-
 	return 1;
 }
 
-int create_window (void)
+char *subimage_filename (const subimage_t *s)
 {
-	glfwWindowHint (GLFW_VISIBLE, GL_FALSE);
-	window = glfwCreateWindow (64, 64, "ktxviewer", NULL, NULL);
-    if (!window) {
-    	fprintf (stderr, "Cannot open window.\n");
-    	return 0;
-    }
-    glfwMakeContextCurrent (window);
-
-    if (glewInit () != GLEW_OK) {
-    	fprintf (stderr, "Cannot initialize GLEW.\n");
-    	return 0;
-    }
-
-    return 1;
+	const char *slash = strrchr (output_filename, '/');
+	const char *ext = strrchr (output_filename, '.');
+	size_t stem, len;
+	char *filename;
+
+	if (!export_all)
+		return strdup (output_filename);
+
+	if (ext == NULL || (slash != NULL && ext < slash))
+		ext = output_filename + strlen (output_filename);
+	stem = ext - output_filename;
+	len = stem + strlen (ext) + 64;
+	filename = (char*) malloc (len);
+	if (filename == NULL)
+		return NULL;
+	if (header->pixelDepth != 0)
+		snprintf (filename, len, "%.*s_l%u_f%u_a%u_s%u%s", (int) stem, output_filename,
+				s->level, s->face, s->layer, s->slice, ext);
+	else
+		snprintf (filename, len, "%.*s_l%u_f%u_a%u%s", (int) stem, output_filename,
+				s->level, s->face, s->layer, ext);
+	return filename;
 }
 
+uint32_t range_end (const range_t *range, uint32_t count)
+{
+	return (range->last < count) ? range->last + 1 : count;
+}
 
-void cleanup (void)
+/* collects the images selected by the options */
+int select_subimages (void)
 {
-	if (imagedata != NULL) free (imagedata);
-	if (texture != 0) glDeleteTextures (1, &texture);
-    if (window != NULL) glfwDestroyWindow (window);
-	if (f != NULL) fclose (f);
-	glfwTerminate ();
+	uint32_t level, layer, face, slice;
+	size_t capacity = 0;
+
+	for (level = levels.first; level < range_end (&levels, ktx_level_count (header)); level++)
+	for (layer = layers.first; layer < range_end (&layers, ktx_layer_count (header)); layer++)
+	for (face = faces.first; face < range_end (&faces, header->numberOfFaces); face++)
+	for (slice = slices.first; slice < range_end (&slices, ktx_slice_count (header, level)); slice++)
+	{
+		const uint8_t *data = input.data + offsets[level];
+		uint32_t imageSize;
+		subimage_t *s;
+
+		if (subimage_count == capacity)
+		{
+			capacity = capacity ? 2 * capacity : 64;
+			s = (subimage_t*) realloc (subimages, capacity * sizeof (subimage_t));
+			if (s == NULL)
+			{
+				fprintf (stderr, "Out of memory.\n");
+				return 0;
+			}
+			subimages = s;
+		}
+
+		s = &subimages[subimage_count];
+		memset (s, 0, sizeof (subimage_t));
+		s->level = level;
+		s->layer = layer;
+		s->face = face;
+		s->slice = slice;
+		s->width = header->pixelWidth >> level;
+		s->height = header->pixelHeight >> level;
+		if (s->width == 0) s->width = 1;
+		if (s->height == 0) s->height = 1;
+		memcpy (&imageSize, data, sizeof (uint32_t));
+		s->data = ktx_subimage (header, data + sizeof (uint32_t), imageSize, level, layer, face, slice, &s->size);
+		s->filename = subimage_filename (s);
+		subimage_count++;
+		if (s->filename == NULL)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			return 0;
+		}
+	}
+
+	if (subimage_count == 0)
+	{
+		fprintf (stderr, "No images selected.\n");
+		return 0;
+	}
+	return 1;
 }
 
-void WandException (MagickWand *wand)
+int create_context (void)
 {
-	char *desc;
-	ExceptionType type;
-	desc = MagickGetException (wand, &type);
-	fprintf(stderr,"%s %s %lu %s\n", GetMagickModule (), desc);
-	MagickRelinquishMemory (desc);
+	if (!context_create ("ktx2any"))
+		return 0;
+
+	glGenTextures (1, &texture);
+	glBindTexture (GL_TEXTURE_2D, texture);
+	glPixelStorei (GL_PACK_ALIGNMENT, 4);
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+	return 1;
 }
 
-int image_save (const char *filename) {
-	MagickWand *wand;
-	PixelWand *color;
+void upload_subimage (const subimage_t *s)
+{
+	if (header->glType != 0)
+		glTexImage2D (GL_TEXTURE_2D, 0, header->glInternalFormat, s->width, s->height, 0,
+				header->glFormat, header->glType, s->data);
+	else
+		glCompressedTexImage2D (GL_TEXTURE_2D, 0, header->glInternalFormat, s->width, s->height, 0,
+				s->size, s->data);
+}
 
-	MagickWandGenesis ();
-	wand = NewMagickWand ();
+/* decodes an image through OpenGL, which requires the main thread */
+int read_back_subimage (subimage_t *s)
+{
+	s->image = create_image (s->width, s->height);
+	if (s->image == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return 0;
+	}
 
-	color = NewPixelWand ();
-	PixelSetColor (color, "black");
+	upload_subimage (s);
+	glGetTexImage (GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, s->image->data);
 
-	if (MagickNewImage (wand, header.pixelWidth, header.pixelHeight, color) != MagickTrue) {
-		WandException (wand);
-		DestroyMagickWand (wand);
-		MagickWandTerminus ();
+	if (glGetError () != GL_NO_ERROR)
+	{
+		fprintf (stderr, "Cannot decode image data.\n");
 		return 0;
 	}
+	return 1;
+}
+
+/* 8 bit and compressed sources are written with 8 bits per channel,
+ * everything else with 16 */
+int output_depth (void)
+{
+	return (header->glType == 0 || header->glType == GL_UNSIGNED_BYTE || header->glType == GL_BYTE) ? 8 : 16;
+}
+
+void quantize (const float *src, size_t count, int depth, void *dst)
+{
+	size_t i;
+	if (depth == 8)
+	{
+		uint8_t *d = (uint8_t*) dst;
+		for (i = 0; i < count; i++)
+		{
+			float v = (src[i] < 0.0f) ? 0.0f : ((src[i] > 1.0f) ? 1.0f : src[i]);
+			d[i] = (uint8_t) (v * 255.0f + 0.5f);
+		}
+	}
+	else
+	{
+		uint16_t *d = (uint16_t*) dst;
+		for (i = 0; i < count; i++)
+		{
+			float v = (src[i] < 0.0f) ? 0.0f : ((src[i] > 1.0f) ? 1.0f : src[i]);
+			d[i] = (uint16_t) (v * 65535.0f + 0.5f);
+		}
+	}
+}
 
-	if (MagickImportImagePixels (wand, 0, 0, header.pixelWidth, header.pixelHeight, "RGBA", FloatPixel, imagedata) != MagickTrue) {
-		WandException (wand);
-		DestroyMagickWand (wand);
-		MagickWandTerminus ();
+/* converts a packed image band by band straight from the input and writes
+ * it as PNG; RGBA data that already has the output depth is passed through */
+int stream_subimage (const subimage_t *s)
+{
+	size_t stride = packed_image_size (s->width, 1, header->glFormat, header->glType);
+	int depth = output_depth ();
+	int direct = header->glFormat == GL_RGBA
+			&& header->glType == ((depth == 8) ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT);
+	size_t rowsize = s->width * 4 * (depth / 8);
+	float *band = NULL;
+	uint8_t *rows = NULL;
+	png_writer_t *writer;
+	size_t y, i;
+	int result = 1;
+
+	if (s->size < stride * s->height)
+	{
+		fprintf (stderr, "Invalid image size.\n");
 		return 0;
 	}
+	if (!direct)
+	{
+		band = (float*) malloc (s->width * STREAM_BAND_HEIGHT * 4 * sizeof (float));
+		rows = (uint8_t*) malloc (rowsize * STREAM_BAND_HEIGHT);
+		if (band == NULL || rows == NULL)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			free (band);
+			free (rows);
+			return 0;
+		}
+	}
+
+	writer = png_writer_open (s->filename, s->width, s->height, depth);
+	for (y = 0; y < s->height && writer != NULL && result; y += STREAM_BAND_HEIGHT)
+	{
+		size_t count = (s->height - y < STREAM_BAND_HEIGHT) ? s->height - y : STREAM_BAND_HEIGHT;
+		if (direct)
+		{
+			result = png_writer_write (writer, s->data + y * stride, count, stride);
+			continue;
+		}
+		for (i = 0; i < count; i++)
+			unpack_pixels (s->data + (y + i) * stride, s->width, header->glFormat, header->glType,
+					&band[i * s->width * 4]);
+		quantize (band, count * s->width * 4, depth, rows);
+		result = png_writer_write (writer, rows, count, rowsize);
+	}
+	if (writer == NULL || !png_writer_close (writer))
+		result = 0;
+
+	free (band);
+	free (rows);
+	return result;
+}
 
-	if (MagickWriteImage (wand, filename) != MagickTrue) {
-		WandException (wand);
-		DestroyMagickWand (wand);
-		MagickWandTerminus ();
+/* reads an image back from OpenGL in bands if the driver can read parts of
+ * a texture and as a whole otherwise, in either case at the output depth
+ * instead of as floats */
+int stream_gl_subimage (const subimage_t *s)
+{
+	int depth = output_depth ();
+	GLenum type = (depth == 8) ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
+	size_t rowsize = s->width * 4 * (depth / 8);
+	size_t band = GLEW_ARB_get_texture_sub_image ? STREAM_BAND_HEIGHT : s->height;
+	uint8_t *rows;
+	png_writer_t *writer;
+	size_t y;
+	int result = 1;
+
+	rows = (uint8_t*) malloc (rowsize * band);
+	if (rows == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
 		return 0;
 	}
 
-	DestroyMagickWand (wand);
-	MagickWandTerminus ();
+	upload_subimage (s);
+	writer = png_writer_open (s->filename, s->width, s->height, depth);
+	for (y = 0; y < s->height && writer != NULL && result; y += band)
+	{
+		size_t count = (s->height - y < band) ? s->height - y : band;
+		if (GLEW_ARB_get_texture_sub_image)
+			glGetTextureSubImage (texture, 0, 0, y, 0, s->width, count, 1, GL_RGBA, type, rowsize * count, rows);
+		else
+			glGetTexImage (GL_TEXTURE_2D, 0, GL_RGBA, type, rows);
+		if (glGetError () != GL_NO_ERROR)
+		{
+			fprintf (stderr, "Cannot decode image data.\n");
+			result = 0;
+			break;
+		}
+		result = png_writer_write (writer, rows, count, rowsize);
+	}
+	if (writer == NULL || !png_writer_close (writer))
+		result = 0;
 
-	return 1;
+	free (rows);
+	return result;
 }
 
-int main (int argc, char *argv[])
+/* unpacks an image on the CPU unless it was read back already, writes it
+ * and releases it */
+void export_subimage (size_t index, void *arg)
 {
-	if (argc != 3)
+	subimage_t *s = &((subimage_t*) arg)[index];
+
+	if (streaming)
 	{
-		fprintf (stderr, "Usage: %s ktxfile outputfile\n", argv[0]);
-		return 1;
+		s->result = stream_subimage (s);
+		return;
 	}
 
-	if (!glfwInit ())
+	if (s->image == NULL)
 	{
-		fprintf (stderr, "Cannot initialize GLFW.\n");
-		return 1;
+		size_t stride = packed_image_size (s->width, 1, header->glFormat, header->glType);
+		size_t y;
+
+		if (s->size < stride * s->height)
+		{
+			fprintf (stderr, "Invalid image size.\n");
+			return;
+		}
+		s->image = create_image (s->width, s->height);
+		if (s->image == NULL)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			return;
+		}
+		for (y = 0; y < s->height; y++)
+			unpack_pixels (s->data + y * stride, s->width, header->glFormat, header->glType,
+					&s->image->data[y * s->width * 4]);
 	}
 
-	f = fopen (argv [1], "rb");
-	if (!f)
+	if (!save_image (s->image, s->filename))
+		fprintf (stderr, "Cannot write %s.\n", s->filename);
+	else
+		s->result = 1;
+
+	free_image (s->image);
+	s->image = NULL;
+}
+
+/* images are exported in batches, so that only a bounded number of
+ * decoded images is kept in memory */
+int export_subimages (void)
+{
+	int cpu = packed_pixel_size (header->glFormat, header->glType) != 0;
+	size_t batch = 2 * task_concurrency ();
+	size_t i, j;
+
+	if (!cpu && !create_context ())
+		return 0;
+
+	if (streaming && !cpu)
 	{
-		fprintf (stderr, "Cannot open input file.\n");
-		cleanup ();
+		for (i = 0; i < subimage_count; i++)
+		{
+			if (!stream_gl_subimage (&subimages[i]))
+				return 0;
+		}
 		return 1;
 	}
 
-	if (!load_ktx_header ()) {
-		cleanup ();
-		return 1;
+	for (i = 0; i < subimage_count; i += batch)
+	{
+		size_t count = (subimage_count - i < batch) ? subimage_count - i : batch;
+
+		for (j = 0; j < count && !cpu; j++)
+		{
+			if (!read_back_subimage (&subimages[i + j]))
+				return 0;
+		}
+
+		parallel_for (count, export_subimage, &subimages[i]);
+
+		for (j = 0; j < count; j++)
+		{
+			if (!subimages[i + j].result)
+				return 0;
+		}
 	}
+	return 1;
+}
 
-	if (!create_window ()) {
-		cleanup ();
-		return 1;
+void cleanup (void)
+{
+	size_t i;
+	for (i = 0; i < subimage_count; i++)
+	{
+		free (subimages[i].filename);
+		if (subimages[i].image != NULL)
+			free_image (subimages[i].image);
 	}
+	free (subimages);
+	if (texture != 0) glDeleteTextures (1, &texture);
+	context_destroy ();
+	if (input_buffer != NULL)
+		free (input_buffer);
+	else
+		ktx_unmap (&input);
+	image_terminate ();
+}
 
-	if (!load_texture ()) {
-		cleanup ();
+int main (int argc, char *argv[])
+{
+	if (!parse_options (argc, argv)) {
+		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
 		return 1;
 	}
 
-	imagedata = (float*) malloc (header.pixelWidth * header.pixelHeight * 4 * sizeof (float));
-	glGetTexImage (GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &imagedata[0]);
+	image_init ();
 
-	if (!image_save (argv[2])) {
+	if (!load_input () || !select_subimages () || !export_subimages ()) {
 		cleanup ();
 		return 1;
 	}
@@ -22,12 +22,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "tables.h"
+#include "image.h"
 #include "ktx.h"
+#include "keyvalue.h"
+#include "ktxfile.h"
+#include "tasks.h"
+#include "context.h"
+#include "readback.h"
 
 ktx_header_t header = { KTX_MAGIC, 0x04030201, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0 };
 ktx_header_t sourceheader;
 FILE *f = NULL;
+int source_reversed = 0;
+ktx_mapping_t source = { NULL, 0 };
+/* streams are read into memory instead of being mapped */
+uint8_t *source_buffer = NULL;
 
 GLuint texture = 0;
 
@@ -44,9 +55,19 @@ int load_ktx_header (void)
 		return 0;
 	}
 
-	if (fseek (f, sourceheader.bytesOfKeyValueData, SEEK_CUR)) {
-		fprintf (stderr, "Could not skip key value data.\n");
-		return 0;
+	if (sourceheader.bytesOfKeyValueData > 0)
+	{
+		keyvaluelist_t list = KEYVALUELIST_INIT;
+		void *data = malloc (sourceheader.bytesOfKeyValueData);
+		if (data == NULL || fread (data, 1, sourceheader.bytesOfKeyValueData, f) != sourceheader.bytesOfKeyValueData) {
+			free (data);
+			fprintf (stderr, "Could not read key value data.\n");
+			return 0;
+		}
+		keyvalue_parse (&list, data, sourceheader.bytesOfKeyValueData);
+		source_reversed = ktx_levels_reversed (&list);
+		keyvalue_free (&list);
+		free (data);
 	}
 
 	return 1;
@@ -57,20 +78,17 @@ int compressed = 0;
 
 int display = 0;
 
+int keep_levels = 1;
+
+uint32_t skip_levels = 0;
+
+int reverse_levels = 0;
+
 const char *source_filename = NULL;
 
 const char *dest_filename = NULL;
 
-float defaultalpha = 1.0f;
-
-typedef struct keyvaluedata
-{
-	struct keyvaluedata *next;
-	uint32_t len;
-	char data[];
-} keyvaluedata_t;
-keyvaluedata_t *first_key_value_entry = NULL;
-keyvaluedata_t *last_key_value_entry = NULL;
+keyvaluelist_t key_value_data = KEYVALUELIST_INIT;
 
 int SetType (const char *type_name)
 {
@@ -125,6 +143,19 @@ int SetLevels (const char *levelstr)
 		fprintf (stderr, "Invalid number of mipmap levels requested.\n");
 		return 0;
 	}
+	keep_levels = 0;
+	return 1;
+}
+
+int SetSkipLevels (const char *levelstr)
+{
+	char *endptr;
+	skip_levels = strtoul (levelstr, &endptr, 10);
+	if (levelstr + strlen (levelstr) != endptr)
+	{
+		fprintf (stderr, "Invalid number of mipmap levels to skip.\n");
+		return 0;
+	}
 	return 1;
 }
 
@@ -142,25 +173,25 @@ int SetDefaultAlpha (const char *alphastr)
 
 int AddKeyValueData (const char *key, const char *value)
 {
-	uint32_t keylen = strlen (key);
-	uint32_t valuelen = strlen (value);
-	uint32_t len = keylen + valuelen + 2;
-	header.bytesOfKeyValueData += sizeof (uint32_t) + len + (3 - ((len + 3) % 4));
-
-	keyvaluedata_t *data = (keyvaluedata_t*) malloc (sizeof (keyvaluedata_t) + len);
-	data->next = NULL;
-	data->len = len;
-	memcpy (&data->data[0], key, keylen + 1);
-	memcpy (&data->data[keylen + 1], value, valuelen + 1);
-	if (first_key_value_entry == NULL)
-		first_key_value_entry = data;
-	if (last_key_value_entry == NULL)
-		last_key_value_entry = data;
-	else
+	if (!keyvalue_add (&key_value_data, key, value, strlen (value) + 1))
 	{
-		last_key_value_entry->next = data;
-		last_key_value_entry = data;
+		fprintf (stderr, "Cannot add key value data.\n");
+		return 0;
 	}
+	header.bytesOfKeyValueData = keyvalue_size (&key_value_data);
+	return 1;
+}
+
+int SetJobs (const char *jobsstr)
+{
+	char *endptr;
+	unsigned long jobs = strtoul (jobsstr, &endptr, 10);
+	if (jobsstr + strlen (jobsstr) != endptr || jobs == 0)
+	{
+		fprintf (stderr, "Invalid number of jobs requested.\n");
+		return 0;
+	}
+	task_set_concurrency (jobs);
 	return 1;
 }
 
@@ -169,6 +200,11 @@ void usage (char *appname)
 	fprintf (stdout, "Usage: %s [options] source dest\n"
 			"Options:\n"
 			"  -h, --help                Display this help message.\n"
+			"  -j, --jobs [count]        Limit the number of threads (default: number\n"
+			"                            of cores).\n"
+			"  -C, --context [backend]   Create the OpenGL context with glfw or egl. By\n"
+			"                            default a hidden GLFW window is used if a\n"
+			"                            display is available and EGL otherwise.\n"
 			"  -t, --type [type]         Specify the component type for\n"
 			"                            storing uncompressed image data.\n"
 			"  -f, --format [format]     Specify the format for storing\n"
@@ -176,17 +212,28 @@ void usage (char *appname)
 			"  -i, --internal [format]   Specify the internal storage format for\n"
 			"                            uncompressed image data or alternatively\n"
 			"                            a compressed storage format.\n"
+			"                            If omitted, the format of the source is kept.\n"
 			"  -l, --levels [levels]     Specify the number of mipmap levels to\n"
 			"                            include in the output file.\n"
+			"  -s, --skip [levels]       Specify the number of leading mipmap levels\n"
+			"                            of the source to drop.\n"
+			"  -r, --reverse-levels      Store the mipmap levels smallest first, so that\n"
+			"                            streaming readers get a usable texture after\n"
+			"                            reading a few kilobytes. The order is recorded\n"
+			"                            as key value data with the key\n"
+			"                            ktxutils.levelorder.\n"
 			"  -a, --alpha [value]       Specify the default alpha value to be used if\n"
 			"                            the input image doesn't have an alpha channel\n"
 			"  -d, --display             Displays the image rather than converting it.\n"
 			"  -k, --key [key]           Specify a key for optional key value data.\n"
 			"  -v, --value [value]       Specify a value for optional key value data.\n"
 			"\n"
+			"If the source already has the requested format and contains all requested\n"
+			"mipmap levels, the image data is copied verbatim without re-encoding.\n"
+			"\n"
 			"Arguments:\n"
-			"  source                    Input image.\n"
-			"  dest                      Output file name.\n", appname);
+			"  source                    Input image, or - for stdin.\n"
+			"  dest                      Output file name, or - for stdout.\n", appname);
 	exit (0);
 }
 
@@ -201,16 +248,20 @@ int parse_options (int argc, char **argv)
 			{ "format", required_argument, 0, 'f' },
 			{ "internal", required_argument, 0, 'i' },
 			{ "levels", required_argument, 0, 'l' },
+			{ "skip", required_argument, 0, 's' },
+			{ "reverse-levels", no_argument, 0, 'r' },
 			{ "alpha", required_argument, 0, 'a' },
 			{ "key", required_argument, 0, 'k' },
 			{ "value", required_argument, 0, 'v' },
+			{ "jobs", required_argument, 0, 'j' },
+			{ "context", required_argument, 0, 'C' },
 			{ 0, 0, 0, 0 }
 	};
 
 	while (1)
 	{
 		int option_index = 0;
-		c = getopt_long (argc, argv, "t:f:l:i:a:k:v:hd", long_options, &option_index);
+		c = getopt_long (argc, argv, "t:f:l:s:i:a:k:v:j:C:hdr", long_options, &option_index);
 
 		if (c== -1) break;
 
@@ -222,6 +273,12 @@ int parse_options (int argc, char **argv)
 		case 'd':
 			display = 1;
 			break;
+		case 'j':
+			if (!SetJobs (optarg)) return 0;
+			break;
+		case 'C':
+			if (!context_set_backend (optarg)) return 0;
+			break;
 		case 'h':
 			usage (argv[0]);
 			break;
@@ -237,6 +294,12 @@ int parse_options (int argc, char **argv)
 		case 'l':
 			if (!SetLevels (optarg)) return 0;
 			break;
+		case 's':
+			if (!SetSkipLevels (optarg)) return 0;
+			break;
+		case 'r':
+			reverse_levels = 1;
+			break;
 		case 'k':
 			if (key != NULL)
 			{
@@ -263,21 +326,28 @@ int parse_options (int argc, char **argv)
 		return 0;
 	}
 
-	if (header.glInternalFormat == 0)
-	{
-		fprintf (stderr, "No internal format was specified.\n");
+	if (reverse_levels && !AddKeyValueData (KTX_LEVEL_ORDER_KEY, "reverse"))
 		return 0;
-	}
 
-	if (compressed && (header.glType != 0 || header.glFormat != 0))
+	if (header.glInternalFormat == 0 && (header.glType != 0 || header.glFormat != 0))
 	{
-		fprintf (stderr, "No type and format can be specified with a compressed internal format.\n");
+		fprintf (stderr, "No internal format was specified.\n");
 		return 0;
 	}
-	if (!compressed && (header.glType == 0 || header.glFormat == 0))
+
+	/* without an internal format the format of the source is kept */
+	if (header.glInternalFormat != 0)
 	{
-		fprintf (stderr, "Type and format must be specified unless the internal format is a compressed format.\n");
-		return 0;
+		if (compressed && (header.glType != 0 || header.glFormat != 0))
+		{
+			fprintf (stderr, "No type and format can be specified with a compressed internal format.\n");
+			return 0;
+		}
+		if (!compressed && (header.glType == 0 || header.glFormat == 0))
+		{
+			fprintf (stderr, "Type and format must be specified unless the internal format is a compressed format.\n");
+			return 0;
+		}
 	}
 
 	if (display)
@@ -312,21 +382,12 @@ GLFWwindow *window = NULL;
 int create_context (void)
 {
 	if (display) {
-		window = glfwCreateWindow (sourceheader.pixelWidth, sourceheader.pixelHeight, "ktx2ktx", NULL, NULL);
-	} else {
-		glfwWindowHint (GLFW_VISIBLE, GL_FALSE);
-		window = glfwCreateWindow (64, 64, "ktx2ktx", NULL, NULL);
-	}
-    if (!window) {
-    	fprintf (stderr, "Cannot open window.\n");
-    	return 0;
-    }
-    glfwMakeContextCurrent (window);
+		window = context_create_window ("ktx2ktx", sourceheader.pixelWidth, sourceheader.pixelHeight);
+		if (!window)
+			return 0;
+	} else if (!context_create ("ktx2ktx"))
+		return 0;
 
-    if (glewInit () != GLEW_OK) {
-    	fprintf (stderr, "Cannot initialize GLEW.\n");
-    	return 0;
-    }
     if (compressed && !GLEW_ARB_texture_compression) {
     	fprintf (stderr, "Texture compression requested, but not supported.\n");
     	return 0;
@@ -337,22 +398,16 @@ int create_context (void)
 
 void cleanup (void)
 {
-	while (first_key_value_entry != NULL)
-	{
-		keyvaluedata_t *data = first_key_value_entry;
-		first_key_value_entry = first_key_value_entry->next;
-		free (data);
-	}
+	keyvalue_free (&key_value_data);
     if (texture)
     	glDeleteTextures (1, &texture);
 
-    if (window != NULL)
-        glfwDestroyWindow (window);
-
 	if (f != NULL)
 		fclose (f);
+	ktx_unmap (&source);
+	free (source_buffer);
 
-	glfwTerminate ();
+	context_destroy ();
 }
 
 unsigned int intlog2 (unsigned int v)
@@ -362,55 +417,69 @@ unsigned int intlog2 (unsigned int v)
 	return r;
 }
 
+/* makes the level data following the key value data available in memory,
+ * so that it can be uploaded without copying it; files are mapped and
+ * streams are read to their end */
+int load_level_data (const uint8_t **data, size_t *size)
+{
+	size_t start = sizeof (ktx_header_t) + sourceheader.bytesOfKeyValueData;
+
+	if (strcmp (source_filename, "-"))
+	{
+		if (!ktx_map (source_filename, &source) || source.size < start)
+			return 0;
+		*data = source.data + start;
+		*size = source.size - start;
+		return 1;
+	}
+
+	source_buffer = ktx_read_stream (f, size);
+	if (source_buffer == NULL)
+		return 0;
+	*data = source_buffer;
+	return 1;
+}
+
 int load_texture (void)
 {
+	size_t offsets[KTX_MAX_LEVELS];
+	const uint8_t *data;
+	size_t size;
+
+	if (sourceheader.numberOfMipmapLevels > KTX_MAX_LEVELS || !load_level_data (&data, &size)
+			|| !ktx_index_level_data (&sourceheader, source_reversed, data, size, offsets)) {
+		fprintf (stderr, "Could not read image data\n");
+		return 0;
+	}
+
 	glGenTextures (1, &texture);
 
 	glBindTexture (GL_TEXTURE_2D, texture);
 
-	int level;
+	uint32_t level, count = ktx_level_count (&sourceheader);
 
-	for (level = 0; level < ((sourceheader.numberOfMipmapLevels == 0) ? 1 : sourceheader.numberOfMipmapLevels); level++)
+	/* the levels are passed to OpenGL straight from the mapping */
+	for (level = 0; level < count; level++)
 	{
-		uint32_t imageSize = 0;
-		if (fread (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
-			fprintf (stderr, "Could not read image size\n");
-			return 0;
-		}
-		void *data = malloc (imageSize);
-
-		if (fread (data, 1, imageSize, f) != imageSize) {
-			fprintf (stderr, "Could not read image data\n");
-			free (data);
-			return 0;
-		}
+		uint32_t imageSize;
+		memcpy (&imageSize, data + offsets[level], sizeof (uint32_t));
 
 		if (sourceheader.glType != 0)
 		{
 			glTexImage2D (GL_TEXTURE_2D, level, sourceheader.glInternalFormat, (sourceheader.pixelWidth >> level), (sourceheader.pixelHeight >> level), 0,
-						  sourceheader.glFormat, sourceheader.glType, data);
+						  sourceheader.glFormat, sourceheader.glType, data + offsets[level] + sizeof (uint32_t));
 		}
 		else
 		{
 			glCompressedTexImage2D (GL_TEXTURE_2D, level, sourceheader.glInternalFormat,
 									(sourceheader.pixelWidth >> level), (sourceheader.pixelHeight >> level), 0,
-									imageSize, data);
-		}
-
-		free (data);
-
-		{
-			int skip = (3 - ((imageSize + 3) % 4));
-			if (skip > 0)
-			{
-				if (fseek (f, skip, SEEK_CUR))
-				{
-					fprintf (stderr, "Could not skip padding bytes\n");
-					return 0;
-				}
-			}
+									imageSize, data + offsets[level] + sizeof (uint32_t));
 		}
 	}
+	/* OpenGL keeps its own copy of the levels */
+	ktx_unmap (&source);
+	free (source_buffer);
+	source_buffer = NULL;
 
 	if (sourceheader.numberOfMipmapLevels == 0) {
 		glGenerateMipmap (GL_TEXTURE_2D);
@@ -425,21 +494,167 @@ int load_texture (void)
 	return texture;
 }
 
+int write_ktx_header (FILE *out)
+{
+	if (fwrite (&header, 1, sizeof (header), out) != sizeof (header)) {
+		fprintf (stderr, "Could not write ktx header.\n");
+		return 0;
+	}
 
-int main (int argc, char *argv[])
+	if (!keyvalue_write (&key_value_data, out)) {
+		fprintf (stderr, "Could not write key value pair.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+int can_repack (void)
 {
-	if (!parse_options (argc, argv)) {
-		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
-		return -1;
+	uint32_t levels = ktx_level_count (&sourceheader);
+
+	if (display)
+		return 0;
+	if (sourceheader.endianness != KTX_ENDIANNESS)
+		return 0;
+	if (header.glInternalFormat != sourceheader.glInternalFormat
+			|| header.glFormat != sourceheader.glFormat
+			|| header.glType != sourceheader.glType)
+		return 0;
+	if (!keep_levels && skip_levels + ktx_level_count (&header) > levels)
+		return 0;
+	/* streams are only copied sequentially */
+	if ((source_reversed || reverse_levels) && (!strcmp (source_filename, "-") || !strcmp (dest_filename, "-")))
+		return 0;
+	return skip_levels < levels;
+}
+
+/* copies the levels sequentially, for pipes and other streams that do not
+ * support positioned reads and writes */
+int repack_stream (void)
+{
+	uint32_t level, imageSize;
+	FILE *out;
+
+	for (level = 0; level < skip_levels; level++)
+	{
+		if (fread (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
+			fprintf (stderr, "Could not read image size.\n");
+			return 0;
+		}
+		if (!ktx_fskip (f, ktx_level_data_size (&sourceheader, imageSize))) {
+			fprintf (stderr, "Could not skip image data.\n");
+			return 0;
+		}
+	}
+
+	out = ktx_fopen (dest_filename, "wb");
+	if (!out) {
+		fprintf (stderr, "Cannot open output file for writing.\n");
+		return 0;
+	}
+
+	if (!write_ktx_header (out)) {
+		fclose (out);
+		return 0;
+	}
+
+	for (level = 0; level < ktx_level_count (&header); level++)
+	{
+		if (fread (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
+			fclose (out);
+			fprintf (stderr, "Could not read image size.\n");
+			return 0;
+		}
+		if (fwrite (&imageSize, 1, sizeof (uint32_t), out) != sizeof (uint32_t)
+				|| !ktx_fcopy (f, out, ktx_level_data_size (&sourceheader, imageSize))) {
+			fclose (out);
+			fprintf (stderr, "Could not copy image data.\n");
+			return 0;
+		}
+	}
+
+	if (fclose (out)) {
+		fprintf (stderr, "Could not write output file.\n");
+		return 0;
+	}
+	return 1;
+}
+
+/* copies the retained mipmap levels of the source verbatim, only the header
+ * and the key value data are rewritten */
+int repack (void)
+{
+	int in_fd = fileno (f);
+	off_t offsets[KTX_MAX_LEVELS];
+	uint32_t image_sizes[KTX_MAX_LEVELS];
+	off_t out_offset;
+	uint32_t i, count;
+
+	header.glTypeSize = sourceheader.glTypeSize;
+	header.glBaseInternalFormat = sourceheader.glBaseInternalFormat;
+	header.numberOfArrayElements = sourceheader.numberOfArrayElements;
+	header.numberOfFaces = sourceheader.numberOfFaces;
+	if (sourceheader.pixelDepth != 0)
+	{
+		header.pixelDepth = sourceheader.pixelDepth >> skip_levels;
+		if (header.pixelDepth == 0) header.pixelDepth = 1;
+	}
+	if (keep_levels)
+	{
+		header.numberOfMipmapLevels = (sourceheader.numberOfMipmapLevels == 0)
+				? 0 : sourceheader.numberOfMipmapLevels - skip_levels;
+	}
+
+	if (!strcmp (source_filename, "-") || !strcmp (dest_filename, "-"))
+		return repack_stream ();
+
+	if (sourceheader.numberOfMipmapLevels > KTX_MAX_LEVELS
+			|| !ktx_index_levels_fd (in_fd, &sourceheader, source_reversed, offsets, image_sizes)) {
+		fprintf (stderr, "Could not read image size.\n");
+		return 0;
+	}
+
+	FILE *out = fopen (dest_filename, "wb");
+	if (!out) {
+		fprintf (stderr, "Cannot open output file for writing.\n");
+		return 0;
+	}
+
+	if (!write_ktx_header (out) || fflush (out)) {
+		fclose (out);
+		return 0;
 	}
+	out_offset = sizeof (ktx_header_t) + header.bytesOfKeyValueData;
 
-	if (!glfwInit ())
+	count = ktx_level_count (&header);
+	for (i = 0; i < count; i++)
 	{
-		fprintf (stderr, "Cannot initialize GLFW.\n");
+		uint32_t level = (reverse_levels ? count - 1 - i : i) + skip_levels;
+		off_t length = sizeof (uint32_t) + ktx_level_data_size (&sourceheader, image_sizes[level]);
+		if (!ktx_copy_data (in_fd, offsets[level], fileno (out), out_offset, length)) {
+			fclose (out);
+			fprintf (stderr, "Could not copy image data.\n");
+			return 0;
+		}
+		out_offset += length;
+	}
+
+	if (fclose (out)) {
+		fprintf (stderr, "Could not write output file.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int main (int argc, char *argv[])
+{
+	if (!parse_options (argc, argv)) {
+		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
 		return -1;
 	}
 
-	f = fopen (source_filename, "rb");
+	f = ktx_fopen (source_filename, "rb");
 	if (!f)
 	{
 		fprintf (stderr, "Cannot open input file.\n");
@@ -452,14 +667,39 @@ int main (int argc, char *argv[])
 		return -1;
 	}
 
-	header.pixelWidth = sourceheader.pixelWidth;
-	header.pixelHeight = sourceheader.pixelHeight;
+	if (header.glInternalFormat == 0)
+	{
+		header.glInternalFormat = sourceheader.glInternalFormat;
+		header.glBaseInternalFormat = sourceheader.glBaseInternalFormat;
+		header.glFormat = sourceheader.glFormat;
+		header.glType = sourceheader.glType;
+		compressed = (sourceheader.glType == 0);
+	}
+
+	if (sourceheader.numberOfMipmapLevels != 0 && skip_levels >= sourceheader.numberOfMipmapLevels)
+	{
+		fprintf (stderr, "Cannot skip all mipmap levels of the source.\n");
+		cleanup ();
+		return -1;
+	}
+
+	header.pixelWidth = sourceheader.pixelWidth >> skip_levels;
+	if (header.pixelWidth == 0) header.pixelWidth = 1;
+	header.pixelHeight = sourceheader.pixelHeight >> skip_levels;
+	if (header.pixelHeight == 0 && sourceheader.pixelHeight != 0) header.pixelHeight = 1;
 
 	if (header.numberOfMipmapLevels > intlog2 (header.pixelWidth) + 1)
 		header.numberOfMipmapLevels = intlog2 (header.pixelWidth) + 1;
 	if (header.numberOfMipmapLevels > intlog2 (header.pixelHeight) + 1)
 		header.numberOfMipmapLevels = intlog2 (header.pixelHeight) + 1;
 
+	if (can_repack ())
+	{
+		int result = repack ();
+		cleanup ();
+		return result ? 0 : -1;
+	}
+
 	if (!create_context ())
 	{
 		cleanup ();
@@ -500,36 +740,19 @@ int main (int argc, char *argv[])
 	}
 	else
 	{
-		FILE *f = fopen (dest_filename, "wb");
+		FILE *f = ktx_fopen (dest_filename, "wb");
 		if (!f) {
 			fprintf (stderr, "Cannot open output file for writing.\n");
 			cleanup ();
 			return -1;
 		}
 
-		if (fwrite (&header, 1, sizeof (header), f) != sizeof (header)) {
+		if (!write_ktx_header (f)) {
 			fclose (f);
-			fprintf (stderr, "Could not write ktx header.\n");
 			cleanup ();
 			return -1;
 		}
 
-		{
-			keyvaluedata_t *data;
-			for (data = first_key_value_entry; data != NULL; data = data->next)
-			{
-				int i;
-				if (fwrite (&data->len, 1, sizeof (uint32_t) + data->len, f) != sizeof (uint32_t) + data->len) {
-					fclose (f);
-					fprintf (stderr, "Could not write key value pair.\n");
-					cleanup ();
-					return -1;
-				}
-				for (i = 0; i < (3 - ((data->len + 3) % 4)); i++)
-					fputc (0, f);
-			}
-		}
-
 		if (compressed)
 		{
 			glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
@@ -541,40 +764,26 @@ int main (int argc, char *argv[])
 			}
 			glGetTexLevelParameteriv (GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &header.glInternalFormat);
 
-			int level;
-			for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
+			uint32_t i, count = ktx_level_count (&header);
+			readback_t *readback = readback_open (f);
+			if (readback == NULL) {
+				fclose (f);
+				cleanup ();
+				return -1;
+			}
+			for (i = 0; i < count; i++)
 			{
-				uint32_t imageSize = 0;
-				glGetTexLevelParameteriv (GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &imageSize);
-
-				if (fwrite (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
-					fclose (f);
-					fprintf (stderr, "Could not write image size.\n");
-					cleanup ();
-					return -1;
-				}
-
-				void *data = malloc (imageSize);
-				glGetCompressedTexImage (GL_TEXTURE_2D, level, data);
-				if (fwrite (data, 1, imageSize, f) != imageSize) {
-					free (data);
-					fclose (f);
-					fprintf (stderr, "Could not write image data.\n");
-					cleanup ();
-					return -1;
-				}
-				free (data);
-
-				{
-					int i;
-					for (i = 0; i < (3 - ((imageSize + 3) % 4)); i++) {
-						fputc (0, f);
-					}
-				}
+				uint32_t level = reverse_levels ? count - 1 - i : i;
+				GLint imageSize = 0;
+				glGetTexLevelParameteriv (GL_TEXTURE_2D, level + skip_levels, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &imageSize);
+				if (!readback_level (readback, level + skip_levels, 0, 0, imageSize))
+					break;
+			}
+			if (!readback_close (readback)) {
+				fclose (f);
+				cleanup ();
+				return -1;
 			}
-
-			fclose (f);
-
 		}
 		else
 		{
@@ -611,6 +820,7 @@ int main (int argc, char *argv[])
 				break;
 			case GL_UNSIGNED_SHORT:
 			case GL_SHORT:
+			case GL_HALF_FLOAT:
 				pixelSize = components * 2;
 				header.glTypeSize = 2;
 				break;
@@ -668,6 +878,17 @@ int main (int argc, char *argv[])
 				pixelSize = 4;
 				header.glTypeSize = 4;
 				break;
+			case GL_UNSIGNED_INT_5_9_9_9_REV:
+			case GL_UNSIGNED_INT_10F_11F_11F_REV:
+				if (components != 3 || header.glFormat != GL_RGB) {
+					fclose (f);
+					fprintf (stderr, "Base internal format conflicts with type.\n");
+					cleanup ();
+					return -1;
+				}
+				pixelSize = 4;
+				header.glTypeSize = 4;
+				break;
 			default:
 				fclose (f);
 				fprintf (stderr, "Invalid type.\n");
@@ -675,36 +896,31 @@ int main (int argc, char *argv[])
 				return -1;
 			}
 
-			int level;
-			void *data = malloc ((header.pixelWidth * header.pixelHeight * pixelSize + 0xFF) & ~0xFF);
-			for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
+			uint32_t i, count = ktx_level_count (&header);
+			readback_t *readback = readback_open (f);
+			if (readback == NULL) {
+				fclose (f);
+				cleanup ();
+				return -1;
+			}
+			for (i = 0; i < count; i++)
 			{
+				uint32_t level = reverse_levels ? count - 1 - i : i;
 				uint32_t imageSize = (header.pixelWidth >> level) * (header.pixelHeight >> level) * pixelSize;
-				if (fwrite (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
-					free (data);
-					fclose (f);
-					fprintf (stderr, "Could not write image size.\n");
-					cleanup ();
-					return -1;
-				}
-
-				glGetTexImage (GL_TEXTURE_2D, level, header.glFormat, header.glType, data);
-				if (fwrite (data, 1, imageSize, f) != imageSize) {
-					free (data);
-					fclose (f);
-					fprintf (stderr, "Could not write image data.\n");
-					cleanup ();
-					return -1;
-				}
-
-				{
-					int i;
-					for (i = 0; i < (3 - ((imageSize + 3) % 4)); i++) {
-						fputc (0, f);
-					}
-				}
+				if (!readback_level (readback, level + skip_levels, header.glFormat, header.glType, imageSize))
+					break;
 			}
-			free (data);
+			if (!readback_close (readback)) {
+				fclose (f);
+				cleanup ();
+				return -1;
+			}
+		}
+
+		if (fclose (f)) {
+			fprintf (stderr, "Could not write output file.\n");
+			cleanup ();
+			return -1;
 		}
 	}
 
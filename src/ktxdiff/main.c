@@ -0,0 +1,528 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <getopt.h>
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ktx.h"
+#include "ktxfile.h"
+#include "image.h"
+#include "pack.h"
+#include "metrics.h"
+#include "context.h"
+
+typedef struct texture {
+	const char *filename;
+	ktx_mapping_t mapping;
+	const ktx_header_t *header;
+	size_t offsets[KTX_MAX_LEVELS];
+	/* the decoded image if the file is not a KTX file */
+	image_t *image;
+} texture_t;
+
+float min_psnr = -INFINITY;
+float min_ssim = -INFINITY;
+float max_error = INFINITY;
+unsigned int channel_mask = 0xF;
+const char *heatmap_filename = NULL;
+float heatmap_scale = 10.0f;
+
+char **pair_filenames = NULL;
+size_t pair_count = 0;
+
+int have_context = 0;
+GLuint texture_name = 0;
+
+int SetThreshold (const char *str, float *value, const char *name)
+{
+	char *endptr;
+	*value = strtof (str, &endptr);
+	if (str + strlen (str) != endptr)
+	{
+		fprintf (stderr, "Invalid %s requested.\n", name);
+		return 0;
+	}
+	return 1;
+}
+
+int SetChannels (const char *str)
+{
+	channel_mask = 0;
+	for (; *str; str++)
+	{
+		const char *c = strchr ("rgba", *str);
+		if (c == NULL)
+		{
+			fprintf (stderr, "Invalid channels requested.\n");
+			return 0;
+		}
+		channel_mask |= 1u << (c - "rgba");
+	}
+	if (channel_mask == 0)
+	{
+		fprintf (stderr, "Invalid channels requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+void usage (char *appname)
+{
+	fprintf (stdout, "Usage: %s [options] test reference [test reference ...]\n"
+			"Options:\n"
+			"  -h, --help                Display this help message.\n"
+			"  -C, --context [backend]   Create the OpenGL context with glfw or egl. By\n"
+			"                            default a hidden GLFW window is used if a\n"
+			"                            display is available and EGL otherwise.\n"
+			"  -p, --psnr [dB]           Fail if the PSNR of a channel is lower.\n"
+			"  -s, --ssim [value]        Fail if the SSIM of a channel is lower.\n"
+			"  -e, --max-error [value]   Fail if the error of a channel exceeds the\n"
+			"                            value at any texel.\n"
+			"  -c, --channels [rgba]     Specify the channels the thresholds and the\n"
+			"                            heatmap apply to (default: rgba).\n"
+			"  -m, --heatmap [file]      Write the largest channel error of the first\n"
+			"                            image of a single pair as a heatmap.\n"
+			"  -S, --scale [factor]      Specify the factor applied to errors in the\n"
+			"                            heatmap (default: 10).\n"
+			"\n"
+			"Every mipmap level, face and array element of a test KTX file is compared\n"
+			"with the same image of a reference KTX file. A reference image in another\n"
+			"format is compared with level 0 and, box filtered, with the other levels.\n"
+			"Values are compared as stored, with a peak value of 1.\n"
+			"\n"
+			"The results are written to stdout as JSON. PSNR is null for identical\n"
+			"channels. The exit status is 1 if a threshold is not met.\n"
+			"\n"
+			"Arguments:\n"
+			"  test                      KTX file to test.\n"
+			"  reference                 Reference KTX file or image.\n", appname);
+	exit (0);
+}
+
+int parse_options (int argc, char **argv)
+{
+	int c = 0;
+	static struct option long_options[] = {
+			{ "help", no_argument, 0, 'h' },
+			{ "psnr", required_argument, 0, 'p' },
+			{ "ssim", required_argument, 0, 's' },
+			{ "max-error", required_argument, 0, 'e' },
+			{ "channels", required_argument, 0, 'c' },
+			{ "heatmap", required_argument, 0, 'm' },
+			{ "scale", required_argument, 0, 'S' },
+			{ "context", required_argument, 0, 'C' },
+			{ 0, 0, 0, 0 }
+	};
+
+	while (1)
+	{
+		int option_index = 0;
+		c = getopt_long (argc, argv, "p:s:e:c:m:S:C:h", long_options, &option_index);
+
+		if (c== -1) break;
+
+		switch (c)
+		{
+		case 'C':
+			if (!context_set_backend (optarg)) return 0;
+			break;
+		case 'h':
+			usage (argv[0]);
+			break;
+		case 'p':
+			if (!SetThreshold (optarg, &min_psnr, "PSNR")) return 0;
+			break;
+		case 's':
+			if (!SetThreshold (optarg, &min_ssim, "SSIM")) return 0;
+			break;
+		case 'e':
+			if (!SetThreshold (optarg, &max_error, "maximum error")) return 0;
+			break;
+		case 'c':
+			if (!SetChannels (optarg)) return 0;
+			break;
+		case 'm':
+			heatmap_filename = optarg;
+			break;
+		case 'S':
+			if (!SetThreshold (optarg, &heatmap_scale, "heatmap scale")) return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	if (optind >= argc || (argc - optind) % 2)
+	{
+		fprintf (stderr, "Invalid number of arguments.\n");
+		return 0;
+	}
+	pair_filenames = &argv[optind];
+	pair_count = (argc - optind) / 2;
+
+	if (heatmap_filename != NULL && pair_count != 1)
+	{
+		fprintf (stderr, "A heatmap can only be written for a single pair of files.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int create_context (void)
+{
+	if (!context_create ("ktxdiff"))
+		return 0;
+	have_context = 1;
+	glGenTextures (1, &texture_name);
+	glPixelStorei (GL_PACK_ALIGNMENT, 4);
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+	return 1;
+}
+
+int open_texture (const char *filename, texture_t *texture)
+{
+	memset (texture, 0, sizeof (texture_t));
+	texture->filename = filename;
+
+	if (ktx_map (filename, &texture->mapping))
+	{
+		texture->header = ktx_mapped_header (&texture->mapping);
+		if (texture->header != NULL)
+		{
+			if (texture->header->endianness != KTX_ENDIANNESS
+					|| texture->header->numberOfMipmapLevels > KTX_MAX_LEVELS
+					|| texture->header->numberOfFaces == 0
+					|| !ktx_index_levels (&texture->mapping, texture->offsets))
+			{
+				fprintf (stderr, "Invalid KTX file: %s\n", filename);
+				return 0;
+			}
+			return 1;
+		}
+		ktx_unmap (&texture->mapping);
+	}
+
+	texture->image = load_image (filename);
+	if (texture->image == NULL)
+	{
+		fprintf (stderr, "Cannot load %s.\n", filename);
+		return 0;
+	}
+	return 1;
+}
+
+void close_texture (texture_t *texture)
+{
+	ktx_unmap (&texture->mapping);
+	if (texture->image != NULL)
+		free_image (texture->image);
+	texture->image = NULL;
+}
+
+/* decodes one image of a KTX file into RGBA floats, on the CPU for packed
+ * formats and through OpenGL otherwise */
+image_t *decode_image (const texture_t *texture, uint32_t level, uint32_t layer, uint32_t face, uint32_t slice)
+{
+	const ktx_header_t *h = texture->header;
+	const uint8_t *data = texture->mapping.data + texture->offsets[level];
+	size_t width = h->pixelWidth >> level, height = h->pixelHeight >> level;
+	uint32_t imageSize, size;
+	image_t *image;
+
+	if (width == 0) width = 1;
+	if (height == 0) height = 1;
+
+	memcpy (&imageSize, data, sizeof (uint32_t));
+	data = ktx_subimage (h, data + sizeof (uint32_t), imageSize, level, layer, face, slice, &size);
+
+	image = create_image (width, height);
+	if (image == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return NULL;
+	}
+
+	if (packed_pixel_size (h->glFormat, h->glType) != 0)
+	{
+		size_t stride = packed_image_size (width, 1, h->glFormat, h->glType);
+		size_t y;
+		if (size < stride * height)
+		{
+			fprintf (stderr, "Invalid image size: %s\n", texture->filename);
+			free_image (image);
+			return NULL;
+		}
+		for (y = 0; y < height; y++)
+			unpack_pixels (data + y * stride, width, h->glFormat, h->glType, &image->data[y * width * 4]);
+		return image;
+	}
+
+	if (!have_context && !create_context ())
+	{
+		free_image (image);
+		return NULL;
+	}
+	glBindTexture (GL_TEXTURE_2D, texture_name);
+	if (h->glType != 0)
+		glTexImage2D (GL_TEXTURE_2D, 0, h->glInternalFormat, width, height, 0, h->glFormat, h->glType, data);
+	else
+		glCompressedTexImage2D (GL_TEXTURE_2D, 0, h->glInternalFormat, width, height, 0, size, data);
+	glGetTexImage (GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, image->data);
+	if (glGetError () != GL_NO_ERROR)
+	{
+		fprintf (stderr, "Cannot decode image data: %s\n", texture->filename);
+		free_image (image);
+		return NULL;
+	}
+	return image;
+}
+
+void print_string (const char *str)
+{
+	putchar ('"');
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\')
+			printf ("\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			printf ("\\u%04x", *str);
+		else
+			putchar (*str);
+	}
+	putchar ('"');
+}
+
+void print_values (const char *name, const double *values)
+{
+	int c;
+	printf ("\"%s\": [", name);
+	for (c = 0; c < 4; c++)
+	{
+		if (isfinite (values[c]))
+			printf ("%s%.9g", c ? ", " : "", values[c]);
+		else
+			printf ("%snull", c ? ", " : "");
+	}
+	printf ("]");
+}
+
+/* checks the thresholds and folds the metrics of an image into the worst
+ * values of a file */
+int check_metrics (const metrics_t *m, metrics_t *worst)
+{
+	int c, pass = 1;
+	for (c = 0; c < 4; c++)
+	{
+		if (m->psnr[c] < worst->psnr[c]) worst->psnr[c] = m->psnr[c];
+		if (m->ssim[c] < worst->ssim[c]) worst->ssim[c] = m->ssim[c];
+		if (m->max_error[c] > worst->max_error[c]) worst->max_error[c] = m->max_error[c];
+		if (m->mse[c] > worst->mse[c]) worst->mse[c] = m->mse[c];
+		if (channel_mask & (1u << c))
+		{
+			if (m->psnr[c] < min_psnr || m->ssim[c] < min_ssim || m->max_error[c] > max_error)
+				pass = 0;
+		}
+	}
+	return pass;
+}
+
+/* compares all images of a pair and prints them as a JSON object; returns
+ * 1 if all thresholds are met, 0 if not and -1 on error */
+int compare_pair (const char *test_filename, const char *reference_filename, int first)
+{
+	texture_t test, reference;
+	const ktx_header_t *h;
+	metrics_t worst;
+	image_t *scaled = NULL;
+	uint32_t level, layer, face, slice;
+	int c, pass = 1, images = 0;
+
+	if (!open_texture (test_filename, &test))
+	{
+		close_texture (&test);
+		return -1;
+	}
+	if (test.header == NULL)
+	{
+		fprintf (stderr, "Not a KTX file: %s\n", test_filename);
+		close_texture (&test);
+		return -1;
+	}
+	if (!open_texture (reference_filename, &reference))
+	{
+		close_texture (&test);
+		close_texture (&reference);
+		return -1;
+	}
+
+	h = test.header;
+	if (reference.header != NULL
+			? (reference.header->pixelWidth != h->pixelWidth || reference.header->pixelHeight != h->pixelHeight
+			   || reference.header->pixelDepth != h->pixelDepth || reference.header->numberOfFaces != h->numberOfFaces
+			   || ktx_layer_count (reference.header) != ktx_layer_count (h))
+			: (reference.image->width != h->pixelWidth || reference.image->height != (h->pixelHeight ? h->pixelHeight : 1)
+			   || h->numberOfFaces != 1 || h->numberOfArrayElements != 0 || h->pixelDepth != 0))
+	{
+		fprintf (stderr, "%s and %s do not match in size.\n", test_filename, reference_filename);
+		close_texture (&test);
+		close_texture (&reference);
+		return -1;
+	}
+
+	for (c = 0; c < 4; c++)
+	{
+		worst.mse[c] = 0.0;
+		worst.psnr[c] = INFINITY;
+		worst.ssim[c] = 1.0;
+		worst.max_error[c] = 0.0;
+	}
+
+	printf ("%s\n    {\n      \"test\": ", first ? "" : ",");
+	print_string (test_filename);
+	printf (",\n      \"reference\": ");
+	print_string (reference_filename);
+	printf (",\n      \"images\": [");
+
+	for (level = 0; level < ktx_level_count (h) && pass >= 0; level++)
+	{
+		/* a reference KTX file may have fewer levels */
+		if (reference.header != NULL && level >= ktx_level_count (reference.header))
+			break;
+		if (reference.image != NULL && level > 0)
+		{
+			image_t *next = downsample_image (scaled ? scaled : reference.image);
+			if (scaled != NULL)
+				free_image (scaled);
+			scaled = next;
+			if (scaled == NULL)
+			{
+				fprintf (stderr, "Out of memory.\n");
+				pass = -1;
+				break;
+			}
+		}
+
+		for (layer = 0; layer < ktx_layer_count (h) && pass >= 0; layer++)
+		for (face = 0; face < h->numberOfFaces && pass >= 0; face++)
+		for (slice = 0; slice < ktx_slice_count (h, level) && pass >= 0; slice++)
+		{
+			image_t *a = decode_image (&test, level, layer, face, slice);
+			image_t *b = (reference.header != NULL) ? decode_image (&reference, level, layer, face, slice) : NULL;
+			image_t *heatmap = NULL;
+			const image_t *ref = (reference.header != NULL) ? b : (scaled ? scaled : reference.image);
+			metrics_t m;
+
+			if (a != NULL && heatmap_filename != NULL && images == 0)
+			{
+				heatmap = create_image (a->width, a->height);
+				if (heatmap == NULL)
+					fprintf (stderr, "Out of memory.\n");
+			}
+			if (a == NULL || ref == NULL || (heatmap_filename != NULL && images == 0 && heatmap == NULL)
+					|| !compare_images (a, ref, &m, heatmap, channel_mask, heatmap_scale))
+			{
+				if (a != NULL && ref != NULL)
+					fprintf (stderr, "Cannot compare %s and %s.\n", test_filename, reference_filename);
+				pass = -1;
+			}
+			else
+			{
+				if (!check_metrics (&m, &worst))
+					pass = 0;
+				printf ("%s\n        { \"level\": %u, \"layer\": %u, \"face\": %u, \"slice\": %u, "
+						"\"width\": %zu, \"height\": %zu,\n          ",
+						images ? "," : "", level, layer, face, slice, a->width, a->height);
+				print_values ("mse", m.mse);
+				printf (",\n          ");
+				print_values ("psnr", m.psnr);
+				printf (",\n          ");
+				print_values ("ssim", m.ssim);
+				printf (",\n          ");
+				print_values ("max_error", m.max_error);
+				printf (" }");
+				images++;
+			}
+
+			if (heatmap != NULL)
+			{
+				if (pass >= 0 && !save_image (heatmap, heatmap_filename))
+				{
+					fprintf (stderr, "Cannot write heatmap.\n");
+					pass = -1;
+				}
+				free_image (heatmap);
+			}
+			if (a != NULL) free_image (a);
+			if (b != NULL) free_image (b);
+		}
+	}
+
+	printf ("\n      ],\n      \"worst\": { ");
+	print_values ("mse", worst.mse);
+	printf (", ");
+	print_values ("psnr", worst.psnr);
+	printf (", ");
+	print_values ("ssim", worst.ssim);
+	printf (", ");
+	print_values ("max_error", worst.max_error);
+	printf (" },\n      \"pass\": %s\n    }", (pass > 0) ? "true" : "false");
+
+	if (scaled != NULL)
+		free_image (scaled);
+	close_texture (&test);
+	close_texture (&reference);
+	return pass;
+}
+
+void cleanup (void)
+{
+	if (texture_name)
+		glDeleteTextures (1, &texture_name);
+	context_destroy ();
+	image_terminate ();
+}
+
+int main (int argc, char *argv[])
+{
+	size_t i;
+	int result = 1;
+
+	if (!parse_options (argc, argv)) {
+		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
+		return -1;
+	}
+
+	image_init ();
+
+	printf ("{\n  \"files\": [");
+	for (i = 0; i < pair_count && result >= 0; i++)
+	{
+		int pass = compare_pair (pair_filenames[2 * i], pair_filenames[2 * i + 1], i == 0);
+		if (pass < result)
+			result = pass;
+	}
+	printf ("\n  ],\n  \"pass\": %s\n}\n", (result > 0) ? "true" : "false");
+
+	cleanup ();
+	if (result < 0)
+		return -1;
+	return result ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "metrics.h"
+#include "tasks.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define METRICS_BAND_HEIGHT 32
+#define SSIM_WINDOW 8
+#define SSIM_STRIDE 4
+#define SSIM_C1 (0.01 * 0.01)
+#define SSIM_C2 (0.03 * 0.03)
+
+typedef struct band_sums {
+	double squared_error[4];
+	double ssim[4];
+	size_t windows;
+	float max_error[4];
+} band_sums_t;
+
+typedef struct compare_state {
+	const image_t *test;
+	const image_t *reference;
+	image_t *heatmap;
+	unsigned int mask;
+	float scale;
+	unsigned int window;
+	size_t windows_x;
+	size_t windows_y;
+	band_sums_t *bands;
+} compare_state_t;
+
+/* black, red, yellow, white */
+static void heat_color (float value, float *rgba)
+{
+	value = (value < 0.0f) ? 0.0f : ((value > 1.0f) ? 1.0f : value) * 3.0f;
+	rgba[0] = (value > 1.0f) ? 1.0f : value;
+	rgba[1] = (value < 1.0f) ? 0.0f : ((value > 2.0f) ? 1.0f : value - 1.0f);
+	rgba[2] = (value < 2.0f) ? 0.0f : value - 2.0f;
+	rgba[3] = 1.0f;
+}
+
+static void error_row (const compare_state_t *state, size_t y, band_sums_t *sums)
+{
+	const float *t = &state->test->data[y * state->test->width * 4];
+	const float *r = &state->reference->data[y * state->test->width * 4];
+	double squared[4] = { 0, 0, 0, 0 };
+	float maximum[4] = { 0, 0, 0, 0 };
+	size_t x;
+	int c;
+
+	/* the channels of a pixel are processed side by side, which the
+	 * compiler turns into vector instructions */
+	for (x = 0; x < state->test->width; x++)
+	{
+		float diff[4];
+		for (c = 0; c < 4; c++)
+		{
+			diff[c] = fabsf (t[x * 4 + c] - r[x * 4 + c]);
+			squared[c] += diff[c] * diff[c];
+			maximum[c] = (diff[c] > maximum[c]) ? diff[c] : maximum[c];
+		}
+		if (state->heatmap != NULL)
+		{
+			float value = 0.0f;
+			for (c = 0; c < 4; c++)
+			{
+				if ((state->mask & (1u << c)) && diff[c] > value)
+					value = diff[c];
+			}
+			heat_color (value * state->scale, &state->heatmap->data[(y * state->test->width + x) * 4]);
+		}
+	}
+
+	for (c = 0; c < 4; c++)
+	{
+		sums->squared_error[c] += squared[c];
+		if (maximum[c] > sums->max_error[c])
+			sums->max_error[c] = maximum[c];
+	}
+}
+
+static void ssim_window (const compare_state_t *state, size_t x0, size_t y0, band_sums_t *sums)
+{
+	const size_t width = state->test->width;
+	const unsigned int n = state->window * state->window;
+	/* the variances are differences of large sums, which float cannot
+	 * represent precisely enough */
+	double st[4] = { 0 }, sr[4] = { 0 }, stt[4] = { 0 }, srr[4] = { 0 }, str[4] = { 0 };
+	size_t x, y;
+	int c;
+
+	for (y = y0; y < y0 + state->window; y++)
+	{
+		const float *t = &state->test->data[(y * width + x0) * 4];
+		const float *r = &state->reference->data[(y * width + x0) * 4];
+		for (x = 0; x < state->window * 4; x += 4)
+		{
+			for (c = 0; c < 4; c++)
+			{
+				st[c] += t[x + c];
+				sr[c] += r[x + c];
+				stt[c] += (double) t[x + c] * t[x + c];
+				srr[c] += (double) r[x + c] * r[x + c];
+				str[c] += (double) t[x + c] * r[x + c];
+			}
+		}
+	}
+
+	for (c = 0; c < 4; c++)
+	{
+		double mt = st[c] / n, mr = sr[c] / n;
+		double vt = stt[c] / n - mt * mt, vr = srr[c] / n - mr * mr;
+		double cov = str[c] / n - mt * mr;
+		sums->ssim[c] += ((2.0 * mt * mr + SSIM_C1) * (2.0 * cov + SSIM_C2))
+				/ ((mt * mt + mr * mr + SSIM_C1) * (vt + vr + SSIM_C2));
+	}
+	sums->windows++;
+}
+
+static void compare_band (size_t band, void *arg)
+{
+	const compare_state_t *state = (const compare_state_t*) arg;
+	band_sums_t *sums = &state->bands[band];
+	size_t y, wx, wy;
+	size_t y_end = (band + 1) * METRICS_BAND_HEIGHT;
+
+	if (y_end > state->test->height)
+		y_end = state->test->height;
+	for (y = band * METRICS_BAND_HEIGHT; y < y_end; y++)
+		error_row (state, y, sums);
+
+	/* each band owns the windows that start within its rows */
+	for (wy = 0; wy < state->windows_y; wy++)
+	{
+		size_t y0 = wy * SSIM_STRIDE;
+		if (y0 < band * METRICS_BAND_HEIGHT || y0 >= y_end)
+			continue;
+		for (wx = 0; wx < state->windows_x; wx++)
+			ssim_window (state, wx * SSIM_STRIDE, y0, sums);
+	}
+}
+
+int compare_images (const image_t *test, const image_t *reference, metrics_t *metrics,
+					image_t *heatmap, unsigned int mask, float scale)
+{
+	compare_state_t state;
+	size_t band_count, i, pixels;
+	size_t smaller = (test->width < test->height) ? test->width : test->height;
+	int c;
+
+	if (test->width != reference->width || test->height != reference->height
+			|| (heatmap != NULL && (heatmap->width != test->width || heatmap->height != test->height)))
+		return 0;
+
+	state.test = test;
+	state.reference = reference;
+	state.heatmap = heatmap;
+	state.mask = mask;
+	state.scale = scale;
+	/* small mipmap levels are treated as a single window */
+	state.window = (smaller < SSIM_WINDOW) ? smaller : SSIM_WINDOW;
+	state.windows_x = (smaller < SSIM_WINDOW) ? 1 : (test->width - SSIM_WINDOW) / SSIM_STRIDE + 1;
+	state.windows_y = (smaller < SSIM_WINDOW) ? 1 : (test->height - SSIM_WINDOW) / SSIM_STRIDE + 1;
+
+	band_count = (test->height + METRICS_BAND_HEIGHT - 1) / METRICS_BAND_HEIGHT;
+	state.bands = (band_sums_t*) calloc (band_count, sizeof (band_sums_t));
+	if (state.bands == NULL)
+		return 0;
+
+	parallel_for (band_count, compare_band, &state);
+
+	/* the bands are summed in a fixed order, so the results do not depend
+	 * on the number of threads */
+	for (c = 0; c < 4; c++)
+	{
+		double squared = 0.0, ssim = 0.0;
+		size_t windows = 0;
+		metrics->max_error[c] = 0.0;
+		for (i = 0; i < band_count; i++)
+		{
+			squared += state.bands[i].squared_error[c];
+			ssim += state.bands[i].ssim[c];
+			windows += state.bands[i].windows;
+			if (state.bands[i].max_error[c] > metrics->max_error[c])
+				metrics->max_error[c] = state.bands[i].max_error[c];
+		}
+		pixels = test->width * test->height;
+		metrics->mse[c] = pixels ? squared / pixels : 0.0;
+		metrics->psnr[c] = (metrics->mse[c] > 0.0) ? -10.0 * log10 (metrics->mse[c]) : INFINITY;
+		metrics->ssim[c] = windows ? ssim / windows : 1.0;
+	}
+
+	free (state.bands);
+	return 1;
+}
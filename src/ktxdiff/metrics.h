@@ -0,0 +1,39 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "image.h"
+
+typedef struct metrics {
+	double mse[4];
+	/* infinite for identical channels */
+	double psnr[4];
+	double ssim[4];
+	double max_error[4];
+} metrics_t;
+
+/* compares two images of the same size channel by channel with a peak value
+ * of 1; SSIM is averaged over 8x8 windows placed every 4 pixels; the
+ * heatmap, if given, receives the largest error of the channels selected by
+ * mask at each pixel multiplied by scale as a color ramp */
+int compare_images (const image_t *test, const image_t *reference, metrics_t *metrics,
+					image_t *heatmap, unsigned int mask, float scale);
+
+#endif /* METRICS_H */
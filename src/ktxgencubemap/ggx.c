@@ -0,0 +1,243 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ggx.h"
+#include "cubemap.h"
+#include "tasks.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GGX_BAND_HEIGHT 4
+
+typedef struct ggx_sample {
+	float dir[3];
+	float weight;
+	float lod;
+} ggx_sample_t;
+
+typedef struct ggx_state {
+	image_t *(*source)[6];
+	image_t *(*dest)[6];
+	uint32_t levels;
+	uint32_t level;
+	size_t bands;
+	ggx_sample_t *samples;
+	unsigned int count;
+} ggx_state_t;
+
+static float radical_inverse (unsigned int bits)
+{
+	bits = (bits << 16) | (bits >> 16);
+	bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+	bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+	bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+	bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+	return bits * 2.3283064365386963e-10f;
+}
+
+/* importance samples the GGX distribution around the tangent space normal
+ * assuming view = normal, and selects the source level whose texels match
+ * the solid angle covered by each sample */
+static unsigned int generate_samples (float roughness, unsigned int count, size_t size, ggx_sample_t *samples)
+{
+	float a = roughness * roughness;
+	float texel_solid_angle = 4.0f * (float) M_PI / (6.0f * size * size);
+	unsigned int i, n = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		float u1 = (float) i / count, u2 = radical_inverse (i);
+		float phi = 2.0f * (float) M_PI * u1;
+		float costheta = sqrtf ((1.0f - u2) / (1.0f + (a * a - 1.0f) * u2));
+		float sintheta = sqrtf (1.0f - costheta * costheta);
+		float h[3] = { sintheta * cosf (phi), sintheta * sinf (phi), costheta };
+		float ndotl = 2.0f * costheta * costheta - 1.0f;
+		float d, pdf, sample_solid_angle;
+
+		if (ndotl <= 0.0f)
+			continue;
+
+		d = (costheta * costheta * (a * a - 1.0f) + 1.0f);
+		d = a * a / ((float) M_PI * d * d);
+		pdf = d * 0.25f;
+		sample_solid_angle = 1.0f / (count * pdf + 1e-6f);
+
+		samples[n].dir[0] = 2.0f * costheta * h[0];
+		samples[n].dir[1] = 2.0f * costheta * h[1];
+		samples[n].dir[2] = ndotl;
+		samples[n].weight = ndotl;
+		samples[n].lod = (roughness == 0.0f) ? 0.0f : 0.5f * log2f (sample_solid_angle / texel_solid_angle) + 1.0f;
+		if (samples[n].lod < 0.0f)
+			samples[n].lod = 0.0f;
+		n++;
+	}
+	return n;
+}
+
+static void sample_face (const image_t *image, float s, float t, float weight, float *out)
+{
+	float x = (s + 1.0f) * 0.5f * image->width - 0.5f;
+	float y = (t + 1.0f) * 0.5f * image->height - 0.5f;
+	long x0, y0, x1, y1;
+	float fx, fy;
+	const float *t00, *t10, *t01, *t11;
+	int c;
+
+	if (x < 0.0f) x = 0.0f;
+	if (y < 0.0f) y = 0.0f;
+	if (x > image->width - 1) x = image->width - 1;
+	if (y > image->height - 1) y = image->height - 1;
+	x0 = (long) x; y0 = (long) y;
+	x1 = (x0 + 1 < (long) image->width) ? x0 + 1 : x0;
+	y1 = (y0 + 1 < (long) image->height) ? y0 + 1 : y0;
+	fx = x - x0; fy = y - y0;
+
+	t00 = &image->data[(y0 * image->width + x0) * 4];
+	t10 = &image->data[(y0 * image->width + x1) * 4];
+	t01 = &image->data[(y1 * image->width + x0) * 4];
+	t11 = &image->data[(y1 * image->width + x1) * 4];
+	for (c = 0; c < 4; c++)
+	{
+		float top = t00[c] + (t10[c] - t00[c]) * fx;
+		float bottom = t01[c] + (t11[c] - t01[c]) * fx;
+		out[c] += weight * (top + (bottom - top) * fy);
+	}
+}
+
+/* trilinear lookup in the source chain */
+static void sample_cube (const ggx_state_t *state, const float *dir, float lod, float weight, float *out)
+{
+	float s, t;
+	int face = cubemap_face (dir, &s, &t);
+	uint32_t level = (uint32_t) lod;
+	float f = lod - level;
+
+	if (level >= state->levels - 1)
+	{
+		sample_face (state->source[state->levels - 1][face], s, t, weight, out);
+		return;
+	}
+	sample_face (state->source[level][face], s, t, weight * (1.0f - f), out);
+	if (f > 0.0f)
+		sample_face (state->source[level + 1][face], s, t, weight * f, out);
+}
+
+static void prefilter_band (size_t index, void *arg)
+{
+	const ggx_state_t *state = (const ggx_state_t*) arg;
+	int face = index / state->bands;
+	image_t *image = state->dest[state->level][face];
+	size_t band = index % state->bands;
+	size_t x, y, yend = (band + 1) * GGX_BAND_HEIGHT;
+	unsigned int i;
+
+	if (yend > image->height)
+		yend = image->height;
+
+	for (y = band * GGX_BAND_HEIGHT; y < yend; y++)
+	{
+		float t = 2.0f * (y + 0.5f) / image->height - 1.0f;
+		for (x = 0; x < image->width; x++)
+		{
+			float n[3], tangent[3], bitangent[3], len;
+			float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, weight = 0.0f;
+			float *out = &image->data[(y * image->width + x) * 4];
+			int c;
+
+			cubemap_direction (face, 2.0f * (x + 0.5f) / image->width - 1.0f, t, n);
+			len = sqrtf (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			n[0] /= len; n[1] /= len; n[2] /= len;
+
+			/* tangent frame around the normal */
+			if (fabsf (n[2]) < 0.999f)
+			{
+				tangent[0] = -n[1]; tangent[1] = n[0]; tangent[2] = 0.0f;
+			}
+			else
+			{
+				tangent[0] = 0.0f; tangent[1] = -n[2]; tangent[2] = n[1];
+			}
+			len = sqrtf (tangent[0] * tangent[0] + tangent[1] * tangent[1] + tangent[2] * tangent[2]);
+			tangent[0] /= len; tangent[1] /= len; tangent[2] /= len;
+			bitangent[0] = n[1] * tangent[2] - n[2] * tangent[1];
+			bitangent[1] = n[2] * tangent[0] - n[0] * tangent[2];
+			bitangent[2] = n[0] * tangent[1] - n[1] * tangent[0];
+
+			for (i = 0; i < state->count; i++)
+			{
+				const ggx_sample_t *sample = &state->samples[i];
+				float dir[3];
+				for (c = 0; c < 3; c++)
+					dir[c] = tangent[c] * sample->dir[0] + bitangent[c] * sample->dir[1] + n[c] * sample->dir[2];
+				sample_cube (state, dir, sample->lod, sample->weight, sum);
+				weight += sample->weight;
+			}
+
+			for (c = 0; c < 4; c++)
+				out[c] = (weight > 0.0f) ? sum[c] / weight : 0.0f;
+		}
+	}
+}
+
+int prefilter_ggx (image_t *(*source)[6], image_t *(*dest)[6], uint32_t levels, unsigned int samples)
+{
+	ggx_state_t state;
+	uint32_t level;
+	int face;
+
+	state.source = source;
+	state.dest = dest;
+	state.levels = levels;
+	state.samples = (ggx_sample_t*) malloc (samples * sizeof (ggx_sample_t));
+	if (state.samples == NULL)
+		return 0;
+
+	for (face = 0; face < 6; face++)
+	{
+		dest[0][face] = create_image (source[0][face]->width, source[0][face]->height);
+		if (dest[0][face] == NULL)
+		{
+			free (state.samples);
+			return 0;
+		}
+		memcpy (dest[0][face]->data, source[0][face]->data, source[0][face]->width * source[0][face]->height * 4 * sizeof (float));
+	}
+
+	for (level = 1; level < levels; level++)
+	{
+		float roughness = (float) level / (levels - 1);
+		for (face = 0; face < 6; face++)
+		{
+			dest[level][face] = create_image (source[level][face]->width, source[level][face]->height);
+			if (dest[level][face] == NULL)
+			{
+				free (state.samples);
+				return 0;
+			}
+		}
+		state.level = level;
+		state.count = generate_samples (roughness, samples, source[0][0]->width, state.samples);
+		state.bands = (dest[level][0]->height + GGX_BAND_HEIGHT - 1) / GGX_BAND_HEIGHT;
+		parallel_for (6 * state.bands, prefilter_band, &state);
+	}
+
+	free (state.samples);
+	return 1;
+}
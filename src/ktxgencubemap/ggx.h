@@ -0,0 +1,31 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GGX_H
+#define GGX_H
+
+#include <stdint.h>
+#include "image.h"
+
+/* replaces levels 1 and up of a cube map mipmap chain by the level 0 faces
+ * convolved with a GGX lobe whose roughness increases linearly up to 1 at
+ * the last level; source holds box filtered levels which are sampled
+ * depending on the sample density to keep the sample count low */
+int prefilter_ggx (image_t *(*source)[6], image_t *(*dest)[6], uint32_t levels, unsigned int samples);
+
+#endif /* GGX_H */
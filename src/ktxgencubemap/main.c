@@ -16,117 +16,678 @@
  * You should have received a copy of the GNU General Public License
  * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "ktx.h"
+#include "ktxfile.h"
+#include "tasks.h"
+#include "tables.h"
+#include "image.h"
+#include "pack.h"
+#include "panorama.h"
+#include "ggx.h"
+
+#define MODE_CUBEMAP 0
+#define MODE_ARRAY 1
+#define MODE_CUBEMAP_ARRAY 2
+#define MODE_PANORAMA 3
+
+int mode = MODE_CUBEMAP;
+
+typedef struct input {
+	const char *filename;
+	ktx_mapping_t mapping;
+	size_t *offsets;
+	int valid;
+} input_t;
+
+input_t *inputs = NULL;
+size_t input_count = 0;
+
+const char *dest_filename = NULL;
+
+ktx_header_t header;
+
+FILE *output = NULL;
+uint8_t *leveldata = NULL;
+
+const char *panorama_filename = NULL;
+image_t *panorama = NULL;
+image_t *faces[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+image_t *mipmaps[32][6];
+image_t *prefiltered[32][6];
+int ggx = 0;
+unsigned int ggx_samples = 0;
+size_t face_size = 0;
+int filter = FILTER_BILINEAR;
+uint32_t levels = 0;
+GLenum type = 0;
+GLenum format = 0;
+GLenum internalformat = 0;
+GLenum baseinternalformat = 0;
+
+int SetSamples (const char *samplestr)
+{
+	char *endptr;
+	ggx_samples = strtoul (samplestr, &endptr, 10);
+	if (samplestr + strlen (samplestr) != endptr || ggx_samples == 0)
+	{
+		fprintf (stderr, "Invalid sample count.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int SetMode (int m)
+{
+	if (mode != MODE_CUBEMAP)
+	{
+		fprintf (stderr, "Only one mode can be specified.\n");
+		return 0;
+	}
+	mode = m;
+	return 1;
+}
+
+int SetType (const char *type_name)
+{
+	if (type != 0)
+	{
+		fprintf (stderr, "Only one type can be specified.\n");
+		return 0;
+	}
+	type = table_lookup (type_table, type_name);
+	if (type != 0) return 1;
+	fprintf (stderr, "Invalid type.\n");
+	return 0;
+}
+
+int SetFormat (const char *format_name)
+{
+	if (format != 0)
+	{
+		fprintf (stderr, "Only one format can be specified.\n");
+		return 0;
+	}
+	format = table_lookup (format_table, format_name);
+	if (format != 0) return 1;
+	fprintf (stderr, "Invalid format.\n");
+	return 0;
+}
+
+int SetInternalFormat (const char *format_name)
+{
+	if (internalformat != 0)
+	{
+		fprintf (stderr, "Only one internal format can be specified.\n");
+		return 0;
+	}
+	internalformat = base_format_table_lookup (internal_format_table, format_name, &baseinternalformat);
+	if (internalformat != 0) return 1;
+	fprintf (stderr, "Invalid or compressed internal format.\n");
+	return 0;
+}
+
+int SetLevels (const char *levelstr)
+{
+	char *endptr;
+	levels = strtoul (levelstr, &endptr, 10);
+	if (levelstr + strlen (levelstr) != endptr)
+	{
+		fprintf (stderr, "Invalid number of mipmap levels requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int SetFaceSize (const char *sizestr)
+{
+	char *endptr;
+	face_size = strtoul (sizestr, &endptr, 10);
+	if (sizestr + strlen (sizestr) != endptr || face_size == 0)
+	{
+		fprintf (stderr, "Invalid face size requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int SetJobs (const char *jobsstr)
+{
+	char *endptr;
+	unsigned long jobs = strtoul (jobsstr, &endptr, 10);
+	if (jobsstr + strlen (jobsstr) != endptr || jobs == 0)
+	{
+		fprintf (stderr, "Invalid number of jobs requested.\n");
+		return 0;
+	}
+	task_set_concurrency (jobs);
+	return 1;
+}
 
 void usage (char *appname)
 {
 	fprintf (stdout, "Usage: %s [options] sourcefiles dest\n"
 			"Options:\n"
 			"  -h, --help                Display this help message.\n"
+			"  -j, --jobs [count]        Limit the number of threads (default: number\n"
+			"                            of cores).\n"
+			"  -a, --array               Build an array texture with one element per\n"
+			"                            input file. Cube map inputs result in a cube\n"
+			"                            map array.\n"
+			"  -c, --cube-array          Build a cube map array from six input images\n"
+			"                            per array element.\n"
+			"  -p, --panorama            Build a cube map from a single equirectangular\n"
+			"                            panorama image in any image format.\n"
+			"\n"
+			"Panorama options:\n"
+			"  -s, --size [pixels]       Specify the size of the cube map faces.\n"
+			"                            Defaults to a quarter of the panorama width.\n"
+			"  -b, --bicubic             Use bicubic instead of bilinear filtering.\n"
+			"  -l, --levels [levels]     Specify the number of mipmap levels to\n"
+			"                            include in the output file.\n"
+			"  -g, --ggx                 Prefilter the mipmap levels with a GGX lobe\n"
+			"                            of increasing roughness for specular image\n"
+			"                            based lighting. Level 0 stays unfiltered,\n"
+			"                            the last level has roughness 1. Defaults\n"
+			"                            to a complete mipmap chain.\n"
+			"  -n, --samples [count]     Specify the number of GGX samples per texel\n"
+			"                            (default: 64).\n"
+			"  -t, --type [type]         Specify the component type for storing the\n"
+			"                            image data (default: GL_FLOAT).\n"
+			"  -f, --format [format]     Specify the format for storing the image data\n"
+			"                            (default: GL_RGBA).\n"
+			"  -i, --internal [format]   Specify the uncompressed internal format\n"
+			"                            (default: GL_RGBA32F).\n"
 			"\n"
 			"Arguments:\n"
-			"  sourcefiles               Six input images.\n"
+			"  sourcefiles               Six input images, or the input images of the\n"
+			"                            array in order, or a single panorama.\n"
 			"  dest                      Output file name.\n", appname);
 	exit (0);
 }
 
-int load_ktx_header (FILE *f, ktx_header_t *header)
+int parse_options (int argc, char **argv)
 {
-	if (fread (header, 1, sizeof (ktx_header_t), f) != sizeof (ktx_header_t)) {
-		fprintf (stderr, "Cannot read KTX header.\n");
+	int c = 0;
+	size_t count;
+	static struct option long_options[] = {
+			{ "help", no_argument, 0, 'h' },
+			{ "array", no_argument, 0, 'a' },
+			{ "cube-array", no_argument, 0, 'c' },
+			{ "panorama", no_argument, 0, 'p' },
+			{ "size", required_argument, 0, 's' },
+			{ "bicubic", no_argument, 0, 'b' },
+			{ "levels", required_argument, 0, 'l' },
+			{ "ggx", no_argument, 0, 'g' },
+			{ "samples", required_argument, 0, 'n' },
+			{ "type", required_argument, 0, 't' },
+			{ "format", required_argument, 0, 'f' },
+			{ "internal", required_argument, 0, 'i' },
+			{ "jobs", required_argument, 0, 'j' },
+			{ 0, 0, 0, 0 }
+	};
+
+	while (1)
+	{
+		int option_index = 0;
+		c = getopt_long (argc, argv, "s:l:n:t:f:i:j:hacpbg", long_options, &option_index);
+
+		if (c== -1) break;
+
+		switch (c)
+		{
+		case 'j':
+			if (!SetJobs (optarg)) return 0;
+			break;
+		case 'h':
+			usage (argv[0]);
+			break;
+		case 'a':
+			if (!SetMode (MODE_ARRAY)) return 0;
+			break;
+		case 'c':
+			if (!SetMode (MODE_CUBEMAP_ARRAY)) return 0;
+			break;
+		case 'p':
+			if (!SetMode (MODE_PANORAMA)) return 0;
+			break;
+		case 's':
+			if (!SetFaceSize (optarg)) return 0;
+			break;
+		case 'b':
+			filter = FILTER_BICUBIC;
+			break;
+		case 'l':
+			if (!SetLevels (optarg)) return 0;
+			break;
+		case 'g':
+			ggx = 1;
+			break;
+		case 'n':
+			if (!SetSamples (optarg)) return 0;
+			break;
+		case 't':
+			if (!SetType (optarg)) return 0;
+			break;
+		case 'f':
+			if (!SetFormat (optarg)) return 0;
+			break;
+		case 'i':
+			if (!SetInternalFormat (optarg)) return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	if (mode != MODE_PANORAMA && (face_size != 0 || filter != FILTER_BILINEAR || levels != 0 || ggx || ggx_samples != 0
+			|| type != 0 || format != 0 || internalformat != 0))
+	{
+		fprintf (stderr, "Panorama options can only be specified when converting a panorama.\n");
 		return 0;
 	}
 
-	const uint8_t ktx_magic[] = KTX_MAGIC;
-	if (memcmp (&header->identifier[0], &ktx_magic[0], sizeof (ktx_magic))) {
-		fprintf (stderr, "Not a KTX file.\n");
+	if (mode == MODE_PANORAMA)
+	{
+		if (optind + 2 != argc)
+		{
+			fprintf (stderr, "Invalid number of arguments.\n");
+			return 0;
+		}
+		if (ggx_samples != 0 && !ggx)
+		{
+			fprintf (stderr, "A sample count can only be specified for GGX prefiltering.\n");
+			return 0;
+		}
+		if (ggx_samples == 0) ggx_samples = 64;
+		if (type == 0) type = GL_FLOAT;
+		if (format == 0) format = GL_RGBA;
+		if (internalformat == 0)
+		{
+			internalformat = GL_RGBA32F;
+			baseinternalformat = GL_RGBA;
+		}
+		if (packed_pixel_size (format, type) == 0)
+		{
+			fprintf (stderr, "Unsupported combination of type and format.\n");
+			return 0;
+		}
+		panorama_filename = argv[optind];
+		dest_filename = argv[optind + 1];
+		return 1;
+	}
+
+	if (optind + 2 > argc)
+	{
+		fprintf (stderr, "Invalid number of arguments.\n");
 		return 0;
 	}
 
-	if (fseek (f, header->bytesOfKeyValueData, SEEK_CUR)) {
-		fprintf (stderr, "Could not skip key value data.\n");
+	count = argc - optind - 1;
+	if ((mode == MODE_CUBEMAP && count != 6)
+			|| (mode == MODE_CUBEMAP_ARRAY && count % 6 != 0))
+	{
+		fprintf (stderr, "Invalid number of input files.\n");
 		return 0;
 	}
 
+	inputs = (input_t*) calloc (count, sizeof (input_t));
+	if (inputs == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return 0;
+	}
+	for (input_count = 0; input_count < count; input_count++)
+		inputs[input_count].filename = argv[optind + input_count];
+	dest_filename = argv[argc - 1];
 	return 1;
 }
 
-ktx_header_t header;
+void load_input (size_t i, void *arg)
+{
+	input_t *input = &inputs[i];
+	const ktx_header_t *h;
+	(void) arg;
 
-FILE *faces[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
-FILE *output = NULL;
+	if (!ktx_map (input->filename, &input->mapping))
+	{
+		fprintf (stderr, "Cannot open input file: %s\n", input->filename);
+		return;
+	}
+
+	h = ktx_mapped_header (&input->mapping);
+	if (h == NULL)
+	{
+		fprintf (stderr, "Not a KTX file: %s\n", input->filename);
+		return;
+	}
+
+	if (h->numberOfArrayElements > 1 || h->pixelDepth != 0
+			|| (h->numberOfFaces != 1 && (mode != MODE_ARRAY || h->numberOfFaces != 6)))
+	{
+		fprintf (stderr, "Invalid input format: %s\n", input->filename);
+		return;
+	}
 
-int load_headers (int i, const char *filename)
+	input->offsets = (size_t*) malloc (ktx_level_count (h) * sizeof (size_t));
+	if (input->offsets == NULL || !ktx_index_levels (&input->mapping, input->offsets))
+	{
+		fprintf (stderr, "Premature End Of File: %s\n", input->filename);
+		return;
+	}
+
+	input->valid = 1;
+}
+
+int load_headers (void)
 {
-	ktx_header_t h;
-	faces[i] = fopen (filename, "rb");
-	if (!faces[i]) {
-		fprintf (stderr, "Cannot open input file: %s\n", filename);
+	size_t i;
+
+	parallel_for (input_count, load_input, NULL);
+
+	for (i = 0; i < input_count; i++)
+	{
+		ktx_header_t h;
+		if (!inputs[i].valid)
+			return 0;
+
+		memcpy (&h, ktx_mapped_header (&inputs[i].mapping), sizeof (ktx_header_t));
+		h.bytesOfKeyValueData = 0;
+		if (i == 0)
+		{
+			memcpy (&header, &h, sizeof (ktx_header_t));
+		}
+		else if (memcmp (&h, &header, sizeof (ktx_header_t)))
+		{
+			fprintf (stderr, "Incompatible input format: %s\n", inputs[i].filename);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+typedef struct level_state {
+	uint32_t level;
+	uint32_t imageSize;
+	size_t slicestride;
+} level_state_t;
+
+/* copies all faces of one input into their slices of the output level */
+void copy_input_level (size_t i, void *arg)
+{
+	const level_state_t *state = (const level_state_t*) arg;
+	const input_t *input = &inputs[i];
+	const uint8_t *src = input->mapping.data + input->offsets[state->level] + sizeof (uint32_t);
+	uint32_t faces = ktx_mapped_header (&input->mapping)->numberOfFaces;
+	uint32_t face;
+
+	for (face = 0; face < faces; face++)
+	{
+		memcpy (&leveldata[(i * faces + face) * state->slicestride], src, state->imageSize);
+		src += state->imageSize + KTX_PADDING (state->imageSize);
+	}
+}
+
+unsigned int intlog2 (unsigned int v)
+{
+	unsigned int r = 0;
+	while (v >>= 1) r++;
+	return r;
+}
+
+typedef struct pack_state {
+	image_t **images;
+	size_t size;
+	uint8_t *data;
+} pack_state_t;
+
+void pack_face (size_t face, void *arg)
+{
+	const pack_state_t *state = (const pack_state_t*) arg;
+	pack_image (state->images[face], format, type, state->data + face * state->size);
+}
+
+void downsample_face (size_t face, void *arg)
+{
+	image_t *next = downsample_image (faces[face]);
+	(void) arg;
+	free_image (faces[face]);
+	faces[face] = next;
+}
+
+void downsample_mipmap (size_t index, void *arg)
+{
+	uint32_t level = *(const uint32_t*) arg;
+	mipmaps[level + 1][index] = downsample_image (mipmaps[level][index]);
+}
+
+/* builds the box filtered source chain, replaces it by the GGX prefiltered
+ * chain and releases the source levels */
+int prefilter_faces (uint32_t count)
+{
+	uint32_t level;
+	int face;
+
+	for (face = 0; face < 6; face++)
+	{
+		mipmaps[0][face] = faces[face];
+		faces[face] = NULL;
+	}
+	for (level = 0; level + 1 < count; level++)
+	{
+		parallel_for (6, downsample_mipmap, &level);
+		for (face = 0; face < 6; face++)
+		{
+			if (mipmaps[level + 1][face] == NULL)
+				return 0;
+		}
+	}
+
+	if (!prefilter_ggx (mipmaps, prefiltered, count, ggx_samples))
 		return 0;
+
+	for (level = 0; level < count; level++)
+	{
+		for (face = 0; face < 6; face++)
+		{
+			free_image (mipmaps[level][face]);
+			mipmaps[level][face] = NULL;
+		}
 	}
+	return 1;
+}
+
+/* resamples the panorama, generates mipmaps on the CPU and writes the
+ * packed levels without any intermediate files */
+int convert_panorama (void)
+{
+	uint32_t level;
+	int face;
 
-	if (!load_ktx_header (faces[i], &h)) {
+	image_init ();
+	panorama = load_image (panorama_filename);
+	if (panorama == NULL)
+	{
+		fprintf (stderr, "Cannot load panorama: %s\n", panorama_filename);
+		return 0;
+	}
+
+	if (face_size == 0)
+		face_size = (panorama->width >= 4) ? panorama->width / 4 : 1;
+
+	if (!panorama_to_cubemap (panorama, face_size, filter, faces))
+	{
+		fprintf (stderr, "Out of memory.\n");
 		return 0;
 	}
+	free_image (panorama);
+	panorama = NULL;
+
+	memset (&header, 0, sizeof (header));
+	{
+		const uint8_t ktx_magic[] = KTX_MAGIC;
+		memcpy (&header.identifier[0], &ktx_magic[0], sizeof (ktx_magic));
+	}
+	header.endianness = KTX_ENDIANNESS;
+	header.glType = type;
+	header.glTypeSize = (type == GL_UNSIGNED_BYTE) ? 1 : ((type == GL_UNSIGNED_SHORT || type == GL_HALF_FLOAT) ? 2 : 4);
+	header.glFormat = format;
+	header.glInternalFormat = internalformat;
+	header.glBaseInternalFormat = baseinternalformat;
+	header.pixelWidth = face_size;
+	header.pixelHeight = face_size;
+	header.numberOfFaces = 6;
+	header.numberOfMipmapLevels = levels;
+	/* a prefiltered chain cannot be generated by the loader */
+	if (ggx && header.numberOfMipmapLevels == 0)
+		header.numberOfMipmapLevels = intlog2 (face_size) + 1;
+	if (header.numberOfMipmapLevels > intlog2 (face_size) + 1)
+		header.numberOfMipmapLevels = intlog2 (face_size) + 1;
 
-	if (h.numberOfArrayElements > 1 || h.numberOfFaces > 1) {
-		fprintf (stderr, "Invalid input format: %s\n", filename);
+	if (ggx && !prefilter_faces (ktx_level_count (&header)))
+	{
+		fprintf (stderr, "Out of memory.\n");
 		return 0;
 	}
 
-	h.bytesOfKeyValueData = 0;
-	if (i == 0)
+	output = fopen (dest_filename, "wb");
+	if (output == NULL)
 	{
-		memcpy (&header, &h, sizeof (ktx_header_t));
+		fprintf (stderr, "Could not open output file: %s\n", dest_filename);
+		return 0;
 	}
-	else if (memcmp (&h, &header, sizeof (ktx_header_t)))
+
+	if (fwrite (&header, 1, sizeof (ktx_header_t), output) != sizeof (ktx_header_t))
 	{
-		fprintf (stderr, "Incompatible input format: %s\n", filename);
+		fprintf (stderr, "Could not write ktx header.\n");
 		return 0;
 	}
 
+	leveldata = (uint8_t*) malloc (6 * packed_image_size (face_size, face_size, format, type));
+	if (leveldata == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return 0;
+	}
+
+	for (level = 0; level < ktx_level_count (&header); level++)
+	{
+		pack_state_t state;
+		uint32_t imageSize;
+
+		state.images = ggx ? prefiltered[level] : faces;
+		imageSize = packed_image_size (state.images[0]->width, state.images[0]->height, format, type);
+		state.size = imageSize;
+		state.data = leveldata;
+		parallel_for (6, pack_face, &state);
+
+		/* packed rows are aligned to four bytes, so no padding is needed */
+		if (fwrite (&imageSize, 1, sizeof (uint32_t), output) != sizeof (uint32_t)
+				|| fwrite (leveldata, 1, 6 * imageSize, output) != 6 * imageSize)
+		{
+			fprintf (stderr, "Write error.\n");
+			return 0;
+		}
+
+		if (!ggx && level + 1 < ktx_level_count (&header))
+		{
+			parallel_for (6, downsample_face, NULL);
+			for (face = 0; face < 6; face++)
+			{
+				if (faces[face] == NULL)
+				{
+					fprintf (stderr, "Out of memory.\n");
+					return 0;
+				}
+			}
+		}
+	}
+
+	if (fclose (output))
+	{
+		output = NULL;
+		fprintf (stderr, "Write error.\n");
+		return 0;
+	}
+	output = NULL;
 	return 1;
 }
 
 void cleanup (void)
 {
-	int i;
+	size_t i, j;
+	for (i = 0; i < input_count; i++)
+	{
+		ktx_unmap (&inputs[i].mapping);
+		free (inputs[i].offsets);
+	}
+	free (inputs);
+	free (leveldata);
 	for (i = 0; i < 6; i++)
+		free_image (faces[i]);
+	for (i = 0; i < 32; i++)
 	{
-		if (faces[i] != NULL)
-			fclose (faces[i]);
+		for (j = 0; j < 6; j++)
+		{
+			free_image (mipmaps[i][j]);
+			free_image (prefiltered[i][j]);
+		}
 	}
+	free_image (panorama);
 	if (output != NULL)
 		fclose (output);
+	if (mode == MODE_PANORAMA)
+		image_terminate ();
 }
 
 int main (int argc, char *argv[])
 {
-	int i;
-	if (argc != 8) {
-		fprintf (stderr, "Usage: %s [input files] [output file]\n", argv[0]);
+	uint32_t level;
+	size_t slices, capacity = 0;
+
+	if (!parse_options (argc, argv)) {
+		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
+		cleanup ();
 		return -1;
 	}
 
-	for (i = 0; i < 6; i++)
+	if (mode == MODE_PANORAMA)
 	{
-		if (!load_headers (i, argv[i + 1]))
-		{
-			cleanup ();
-			return -1;
-		}
+		int result = convert_panorama ();
+		cleanup ();
+		return result ? 0 : -1;
 	}
 
-	header.numberOfFaces = 6;
+	if (!load_headers ())
+	{
+		cleanup ();
+		return -1;
+	}
 
-	FILE *output = fopen (argv[7], "wb");
+	slices = input_count * header.numberOfFaces;
+	switch (mode)
+	{
+	case MODE_CUBEMAP:
+		header.numberOfFaces = 6;
+		break;
+	case MODE_ARRAY:
+		header.numberOfArrayElements = input_count;
+		break;
+	case MODE_CUBEMAP_ARRAY:
+		header.numberOfFaces = 6;
+		header.numberOfArrayElements = input_count / 6;
+		break;
+	}
+
+	output = fopen (dest_filename, "wb");
 	if (output == NULL)
 	{
+		fprintf (stderr, "Could not open output file: %s\n", dest_filename);
 		cleanup ();
-		fprintf (stderr, "Could not open output file: %s\n", argv[7]);
 		return -1;
 	}
 
@@ -137,68 +698,73 @@ int main (int argc, char *argv[])
 		return -1;
 	}
 
-	int level;
-	for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
+	for (level = 0; level < ktx_level_count (&header); level++)
 	{
-		uint32_t imageSize;
-		for (i = 0; i < 6; i++)
+		level_state_t state;
+		size_t i, size;
+		uint32_t outputImageSize;
+
+		state.level = level;
+		for (i = 0; i < input_count; i++)
 		{
 			uint32_t s;
-			if (fread (&s, 1, sizeof (uint32_t), faces[i]) != sizeof (uint32_t))
-			{
-				cleanup ();
-				fprintf (stderr, "Could not read image size.\n");
-				return -1;
-			}
-			if (i == 0) { imageSize = s; }
-			else if (s != imageSize) {
+			memcpy (&s, inputs[i].mapping.data + inputs[i].offsets[level], sizeof (uint32_t));
+			if (i == 0) { state.imageSize = s; }
+			else if (s != state.imageSize) {
 				cleanup ();
 				fprintf (stderr, "Conflicting image sizes.\n");
 				return -1;
 			}
 		}
-		if (fwrite (&imageSize, 1, sizeof (uint32_t), output) != sizeof (uint32_t))
+
+		/* faces of non-array cube maps are padded individually, the slices of
+		 * arrays are stored contiguously and only the level is padded */
+		if (header.numberOfArrayElements == 0)
 		{
-			cleanup ();
-			fprintf (stderr, "Could not write image size.\n");
-			return -1;
+			state.slicestride = state.imageSize + KTX_PADDING (state.imageSize);
+			outputImageSize = state.imageSize;
+			size = slices * state.slicestride;
 		}
-		for (i = 0; i < 6; i++)
+		else
 		{
-			int n;
-			for (n = 0; n < imageSize; n++)
-			{
-				int c = fgetc (faces[i]);
-				if (c == EOF)
-				{
-					cleanup ();
-					fprintf (stderr, "Premature End Of File.\n");
-					return -1;
-				}
-				if (fputc (c, output) == EOF)
-				{
-					cleanup ();
-					fprintf (stderr, "Write error.\n");
-					return -1;
-				}
-			}
-			for (n = 0; n < 3 - ((imageSize + 3) % 4); n++)
+			state.slicestride = state.imageSize;
+			outputImageSize = slices * state.imageSize;
+			size = outputImageSize + KTX_PADDING (outputImageSize);
+		}
+
+		if (size > capacity)
+		{
+			uint8_t *data = (uint8_t*) realloc (leveldata, size);
+			if (data == NULL)
 			{
-				if (fgetc (faces[i]) == EOF)
-				{
-					cleanup ();
-					fprintf (stderr, "Premature End Of File.\n");
-					return -1;
-				}
-				if (fputc (0, output) == EOF)
-				{
-					cleanup ();
-					fprintf (stderr, "Write error.\n");
-					return -1;
-				}
+				cleanup ();
+				fprintf (stderr, "Out of memory.\n");
+				return -1;
 			}
+			leveldata = data;
+			capacity = size;
 		}
+		memset (leveldata, 0, size);
+
+		parallel_for (input_count, copy_input_level, &state);
+
+		if (fwrite (&outputImageSize, 1, sizeof (uint32_t), output) != sizeof (uint32_t)
+				|| fwrite (leveldata, 1, size, output) != size)
+		{
+			cleanup ();
+			fprintf (stderr, "Write error.\n");
+			return -1;
+		}
+	}
+
+	if (fclose (output))
+	{
+		output = NULL;
+		cleanup ();
+		fprintf (stderr, "Write error.\n");
+		return -1;
 	}
+	output = NULL;
 
 	cleanup ();
 	return 0;
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "panorama.h"
+#include "cubemap.h"
+#include "tasks.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PANORAMA_BAND_HEIGHT 8
+
+typedef struct panorama_state {
+	const image_t *panorama;
+	image_t **faces;
+	size_t size;
+	size_t bands;
+	int filter;
+	/* set by a band that could not be resampled */
+	int failed;
+} panorama_state_t;
+
+static const float *panorama_texel (const image_t *panorama, long x, long y)
+{
+	x %= (long) panorama->width;
+	if (x < 0) x += panorama->width;
+	if (y < 0) y = 0;
+	if (y >= (long) panorama->height) y = panorama->height - 1;
+	return &panorama->data[(y * panorama->width + x) * 4];
+}
+
+static void sample_bilinear (const image_t *panorama, float u, float v, float *out)
+{
+	float x = u * panorama->width - 0.5f, y = v * panorama->height - 0.5f;
+	float fx = floorf (x), fy = floorf (y);
+	long x0 = (long) fx, y0 = (long) fy;
+	const float *t00 = panorama_texel (panorama, x0, y0);
+	const float *t10 = panorama_texel (panorama, x0 + 1, y0);
+	const float *t01 = panorama_texel (panorama, x0, y0 + 1);
+	const float *t11 = panorama_texel (panorama, x0 + 1, y0 + 1);
+	float wx = x - fx, wy = y - fy;
+	int c;
+
+	for (c = 0; c < 4; c++)
+	{
+		float top = t00[c] + (t10[c] - t00[c]) * wx;
+		float bottom = t01[c] + (t11[c] - t01[c]) * wx;
+		out[c] = top + (bottom - top) * wy;
+	}
+}
+
+static void catmull_rom_weights (float t, float *w)
+{
+	float t2 = t * t, t3 = t2 * t;
+	w[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+	w[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+	w[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+	w[3] = 0.5f * (t3 - t2);
+}
+
+static void sample_bicubic (const image_t *panorama, float u, float v, float *out)
+{
+	float x = u * panorama->width - 0.5f, y = v * panorama->height - 0.5f;
+	float fx = floorf (x), fy = floorf (y);
+	long x0 = (long) fx, y0 = (long) fy;
+	float wx[4], wy[4];
+	int i, j, c;
+
+	catmull_rom_weights (x - fx, wx);
+	catmull_rom_weights (y - fy, wy);
+	memset (out, 0, 4 * sizeof (float));
+	for (j = 0; j < 4; j++)
+	{
+		for (i = 0; i < 4; i++)
+		{
+			const float *texel = panorama_texel (panorama, x0 + i - 1, y0 + j - 1);
+			float w = wx[i] * wy[j];
+			for (c = 0; c < 4; c++)
+				out[c] += w * texel[c];
+		}
+	}
+}
+
+static void resample_band (size_t index, void *arg)
+{
+	panorama_state_t *state = (panorama_state_t*) arg;
+	int face = index / state->bands;
+	size_t band = index % state->bands;
+	size_t x, y, yend = (band + 1) * PANORAMA_BAND_HEIGHT;
+	float *u, *v;
+
+	if (yend > state->size)
+		yend = state->size;
+
+	u = (float*) malloc (2 * state->size * sizeof (float));
+	if (u == NULL)
+	{
+		__sync_fetch_and_or (&state->failed, 1);
+		return;
+	}
+	v = u + state->size;
+
+	for (y = band * PANORAMA_BAND_HEIGHT; y < yend; y++)
+	{
+		float t = 2.0f * (y + 0.5f) / state->size - 1.0f;
+		float *out = &state->faces[face]->data[y * state->size * 4];
+
+		/* compute the panorama coordinates of the whole row first, so that
+		 * the trigonometry runs in a tight loop */
+		for (x = 0; x < state->size; x++)
+		{
+			float dir[3];
+			float s = 2.0f * (x + 0.5f) / state->size - 1.0f;
+			cubemap_direction (face, s, t, dir);
+			u[x] = 0.5f + atan2f (dir[0], -dir[2]) * (float) (0.5 / M_PI);
+			v[x] = acosf (dir[1] / sqrtf (dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2])) * (float) (1.0 / M_PI);
+		}
+
+		if (state->filter == FILTER_BICUBIC)
+		{
+			for (x = 0; x < state->size; x++)
+				sample_bicubic (state->panorama, u[x], v[x], &out[x * 4]);
+		}
+		else
+		{
+			for (x = 0; x < state->size; x++)
+				sample_bilinear (state->panorama, u[x], v[x], &out[x * 4]);
+		}
+	}
+
+	free (u);
+}
+
+int panorama_to_cubemap (const image_t *panorama, size_t size, int filter, image_t **faces)
+{
+	panorama_state_t state;
+	int face;
+
+	memset (faces, 0, 6 * sizeof (image_t*));
+	for (face = 0; face < 6; face++)
+	{
+		faces[face] = create_image (size, size);
+		if (faces[face] == NULL)
+		{
+			for (face = 0; face < 6; face++)
+				free_image (faces[face]);
+			return 0;
+		}
+	}
+
+	state.panorama = panorama;
+	state.faces = faces;
+	state.size = size;
+	state.bands = (size + PANORAMA_BAND_HEIGHT - 1) / PANORAMA_BAND_HEIGHT;
+	state.filter = filter;
+	state.failed = 0;
+
+	/* faces and row bands are resampled independently */
+	parallel_for (6 * state.bands, resample_band, &state);
+	if (state.failed)
+	{
+		for (face = 0; face < 6; face++)
+		{
+			free_image (faces[face]);
+			faces[face] = NULL;
+		}
+		return 0;
+	}
+	return 1;
+}
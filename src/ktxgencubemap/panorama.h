@@ -16,21 +16,16 @@
  * You should have received a copy of the GNU General Public License
  * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
  */
+#ifndef PANORAMA_H
+#define PANORAMA_H
 
-#ifndef IMAGE_H
-#define IMAGE_H
+#include "image.h"
 
-#include <stdint.h>
-#include <stddef.h>
+#define FILTER_BILINEAR 0
+#define FILTER_BICUBIC 1
 
-typedef struct image {
-	size_t width;
-	size_t height;
-	float *data;
-} image_t;
+/* resamples an equirectangular panorama into the six faces of a cube map;
+ * the center of the panorama faces towards -Z */
+int panorama_to_cubemap (const image_t *panorama, size_t size, int filter, image_t **faces);
 
-image_t *load_image (const char *filename);
-void free_image (image_t *image);
-
-
-#endif /* IMAGE_H */
+#endif /* PANORAMA_H */
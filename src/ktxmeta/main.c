@@ -0,0 +1,290 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ktx.h"
+#include "ktxfile.h"
+#include "keyvalue.h"
+
+typedef struct operation
+{
+	struct operation *next;
+	const char *key;
+	const char *value;
+} operation_t;
+operation_t *first_operation = NULL;
+operation_t *last_operation = NULL;
+
+int list = 0;
+
+int AddOperation (const char *key, const char *value)
+{
+	operation_t *op;
+
+	/* the key tells how the image data is laid out, so changing it would
+	 * make the levels unreadable */
+	if (!strcmp (key, KTX_LEVEL_ORDER_KEY))
+	{
+		fprintf (stderr, "The key %s cannot be changed.\n", KTX_LEVEL_ORDER_KEY);
+		return 0;
+	}
+
+	op = (operation_t*) malloc (sizeof (operation_t));
+	if (op == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return 0;
+	}
+	op->next = NULL;
+	op->key = key;
+	op->value = value;
+	if (first_operation == NULL)
+		first_operation = op;
+	else
+		last_operation->next = op;
+	last_operation = op;
+	return 1;
+}
+
+void usage (char *appname)
+{
+	fprintf (stdout, "Usage: %s [options] files\n"
+			"Options:\n"
+			"  -h, --help                Display this help message.\n"
+			"  -l, --list                List the key value data of each file.\n"
+			"  -k, --key [key]           Specify a key to add or update.\n"
+			"  -v, --value [value]       Specify the value for the preceding key.\n"
+			"  -d, --delete [key]        Delete the given key.\n"
+			"\n"
+			"Modifications are applied in the given order. Files are updated in place\n"
+			"if the new key value data has the same size as the old, otherwise the\n"
+			"image data is moved. The key " KTX_LEVEL_ORDER_KEY " describes the order\n"
+			"of the image data and cannot be changed.\n"
+			"\n"
+			"Arguments:\n"
+			"  files                     KTX files to process.\n", appname);
+	exit (0);
+}
+
+int parse_options (int argc, char **argv)
+{
+	int c = 0;
+	char *key = NULL;
+	static struct option long_options[] = {
+			{ "help", no_argument, 0, 'h' },
+			{ "list", no_argument, 0, 'l' },
+			{ "key", required_argument, 0, 'k' },
+			{ "value", required_argument, 0, 'v' },
+			{ "delete", required_argument, 0, 'd' },
+			{ 0, 0, 0, 0 }
+	};
+
+	while (1)
+	{
+		int option_index = 0;
+		c = getopt_long (argc, argv, "k:v:d:hl", long_options, &option_index);
+
+		if (c== -1) break;
+
+		switch (c)
+		{
+		case 'h':
+			usage (argv[0]);
+			break;
+		case 'l':
+			list = 1;
+			break;
+		case 'k':
+			if (key != NULL)
+			{
+				fprintf (stderr, "A key without a value was specified.\n");
+				return 0;
+			}
+			key = optarg;
+			break;
+		case 'v':
+			if (key == NULL)
+			{
+				fprintf (stderr, "A value without a key was specified.\n");
+				return 0;
+			}
+			if (!AddOperation (key, optarg)) return 0;
+			key = NULL;
+			break;
+		case 'd':
+			if (!AddOperation (optarg, NULL)) return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	if (key != NULL)
+	{
+		fprintf (stderr, "A key without a value was specified.\n");
+		return 0;
+	}
+
+	if (!list && first_operation == NULL)
+	{
+		fprintf (stderr, "Nothing to do.\n");
+		return 0;
+	}
+
+	if (optind >= argc)
+	{
+		fprintf (stderr, "No input files were specified.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+int read_keyvalue (const char *filename, keyvaluelist_t *keyvalue)
+{
+	ktx_header_t header;
+	const uint8_t ktx_magic[] = KTX_MAGIC;
+	int fd = open (filename, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf (stderr, "Cannot open input file: %s\n", filename);
+		return 0;
+	}
+
+	if (read (fd, &header, sizeof (ktx_header_t)) != sizeof (ktx_header_t)
+			|| memcmp (&header.identifier[0], &ktx_magic[0], sizeof (ktx_magic)))
+	{
+		fprintf (stderr, "Not a KTX file: %s\n", filename);
+		close (fd);
+		return 0;
+	}
+
+	/* the key value data of files in the other byte order would be misread */
+	if (header.endianness != KTX_ENDIANNESS)
+	{
+		fprintf (stderr, "Unsupported byte order: %s\n", filename);
+		close (fd);
+		return 0;
+	}
+
+	if (!ktx_read_keyvalue (fd, &header, keyvalue))
+	{
+		fprintf (stderr, "Invalid key value data: %s\n", filename);
+		close (fd);
+		return 0;
+	}
+
+	close (fd);
+	return 1;
+}
+
+void print_keyvalue (const char *filename, const keyvaluelist_t *keyvalue)
+{
+	keyvaluedata_t *data;
+	printf ("%s:\n", filename);
+	for (data = keyvalue->first; data != NULL; data = data->next)
+	{
+		uint32_t len, i;
+		const char *value = keyvalue_value (data, &len);
+		/* values are usually zero terminated strings, possibly zero padded */
+		while (len > 0 && value[len - 1] == 0)
+			len--;
+		for (i = 0; i < len; i++)
+		{
+			if ((unsigned char) value[i] < 0x20 && value[i] != '\t' && value[i] != '\n')
+				break;
+		}
+		if (i == len)
+			printf ("  %s = %.*s\n", data->data, (int) len, value);
+		else
+			printf ("  %s = <%u bytes of binary data>\n", data->data, data->len - (uint32_t) strlen (data->data) - 1);
+	}
+}
+
+int process_file (const char *filename)
+{
+	keyvaluelist_t keyvalue = KEYVALUELIST_INIT;
+	operation_t *op;
+
+	if (!read_keyvalue (filename, &keyvalue))
+		return 0;
+
+	if (first_operation != NULL)
+	{
+		for (op = first_operation; op != NULL; op = op->next)
+		{
+			if (op->value == NULL)
+				keyvalue_remove (&keyvalue, op->key);
+			else if (!keyvalue_set (&keyvalue, op->key, op->value, strlen (op->value) + 1))
+			{
+				fprintf (stderr, "Out of memory.\n");
+				keyvalue_free (&keyvalue);
+				return 0;
+			}
+		}
+
+		if (!ktx_replace_keyvalue (filename, &keyvalue))
+		{
+			fprintf (stderr, "Could not update key value data: %s: %s\n", filename, strerror (errno));
+			keyvalue_free (&keyvalue);
+			return 0;
+		}
+	}
+
+	if (list)
+		print_keyvalue (filename, &keyvalue);
+
+	keyvalue_free (&keyvalue);
+	return 1;
+}
+
+void cleanup (void)
+{
+	while (first_operation != NULL)
+	{
+		operation_t *op = first_operation;
+		first_operation = first_operation->next;
+		free (op);
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	int i, result = 0;
+
+	if (!parse_options (argc, argv)) {
+		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
+		cleanup ();
+		return -1;
+	}
+
+	for (i = optind; i < argc; i++)
+	{
+		if (!process_file (argv[i]))
+			result = -1;
+	}
+
+	cleanup ();
+	return result;
+}
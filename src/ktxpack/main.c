@@ -0,0 +1,560 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tables.h"
+#include "ktx.h"
+#include "ktxfile.h"
+#include "ktxpack.h"
+#include "tasks.h"
+
+/* number of seeds tried per bucket before giving up */
+#define MAX_SEED (1u << 24)
+
+typedef struct input {
+	const char *name;
+	size_t length;
+	char *path;
+	uint64_t hash;
+	ktxpack_entry_t entry;
+	int valid;
+} input_t;
+
+int list = 0;
+const char *extract_name = NULL;
+const char *directory = NULL;
+const char *archive_filename = NULL;
+char **input_names = NULL;
+size_t input_count = 0;
+
+input_t *inputs = NULL;
+ktxpack_header_t header;
+uint32_t *seeds = NULL;
+ktxpack_entry_t *slots = NULL;
+uint8_t *directory_data = NULL;
+int out_fd = -1;
+int archive_created = 0;
+
+void usage (char *appname)
+{
+	fprintf (stdout, "Usage: %s [options] archive [files]\n"
+			"Options:\n"
+			"  -h, --help                Display this help message.\n"
+			"  -C, --directory [dir]     Read the input files relative to the given\n"
+			"                            directory. Files are stored under the names\n"
+			"                            given on the command line.\n"
+			"  -l, --list                List the contents of an existing archive.\n"
+			"  -x, --extract [name]      Write a stored file to stdout.\n"
+			"\n"
+			"The stored files are ordered by name and aligned to %d bytes. Building\n"
+			"an archive from the same files always produces the same bytes.\n"
+			"\n"
+			"Arguments:\n"
+			"  archive                   Archive file name.\n"
+			"  files                     KTX files to store.\n", appname, KTXPACK_ALIGNMENT);
+	exit (0);
+}
+
+int parse_options (int argc, char **argv)
+{
+	int c = 0;
+	static struct option long_options[] = {
+			{ "help", no_argument, 0, 'h' },
+			{ "directory", required_argument, 0, 'C' },
+			{ "list", no_argument, 0, 'l' },
+			{ "extract", required_argument, 0, 'x' },
+			{ 0, 0, 0, 0 }
+	};
+
+	while (1)
+	{
+		int option_index = 0;
+		c = getopt_long (argc, argv, "C:x:hl", long_options, &option_index);
+
+		if (c== -1) break;
+
+		switch (c)
+		{
+		case 'h':
+			usage (argv[0]);
+			break;
+		case 'C':
+			directory = optarg;
+			break;
+		case 'l':
+			list = 1;
+			break;
+		case 'x':
+			extract_name = optarg;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		fprintf (stderr, "No archive was specified.\n");
+		return 0;
+	}
+	archive_filename = argv[optind];
+
+	if (list || extract_name != NULL)
+	{
+		if (list && extract_name != NULL)
+		{
+			fprintf (stderr, "Only one of listing and extracting can be requested.\n");
+			return 0;
+		}
+		if (optind + 1 != argc || directory != NULL)
+		{
+			fprintf (stderr, "Input files can only be specified when building an archive.\n");
+			return 0;
+		}
+		return 1;
+	}
+
+	input_names = &argv[optind + 1];
+	input_count = argc - optind - 1;
+	if (input_count >= KTXPACK_EMPTY_SLOT / 2)
+	{
+		fprintf (stderr, "Too many input files.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int compare_inputs (const void *a, const void *b)
+{
+	return strcmp (((const input_t*) a)->name, ((const input_t*) b)->name);
+}
+
+/* reads the header of an input file, called in parallel */
+void inspect_input (size_t index, void *arg)
+{
+	input_t *input = &inputs[index];
+	const uint8_t ktx_magic[] = KTX_MAGIC;
+	ktx_header_t h;
+	struct stat st;
+	int fd = open (input->path, O_RDONLY);
+	(void) arg;
+
+	if (fd < 0)
+	{
+		fprintf (stderr, "Cannot open input file: %s\n", input->path);
+		return;
+	}
+	if (fstat (fd, &st) || pread (fd, &h, sizeof (h), 0) != sizeof (h)
+			|| memcmp (&h.identifier[0], &ktx_magic[0], sizeof (ktx_magic)))
+	{
+		fprintf (stderr, "Not a KTX file: %s\n", input->path);
+		close (fd);
+		return;
+	}
+	if (h.endianness != KTX_ENDIANNESS)
+	{
+		fprintf (stderr, "Unsupported byte order: %s\n", input->path);
+		close (fd);
+		return;
+	}
+	close (fd);
+
+	input->entry.size = st.st_size;
+	input->entry.glInternalFormat = h.glInternalFormat;
+	input->entry.glFormat = h.glFormat;
+	input->entry.glType = h.glType;
+	input->entry.pixelWidth = h.pixelWidth;
+	input->entry.pixelHeight = h.pixelHeight;
+	input->entry.pixelDepth = h.pixelDepth;
+	input->entry.numberOfArrayElements = h.numberOfArrayElements;
+	input->entry.numberOfFaces = h.numberOfFaces;
+	input->entry.numberOfMipmapLevels = h.numberOfMipmapLevels;
+	input->hash = ktxpack_hash (input->name, input->length);
+	input->valid = 1;
+}
+
+/* copies an input file to its place in the archive, called in parallel */
+void store_input (size_t index, void *arg)
+{
+	input_t *input = &inputs[index];
+	struct stat st;
+	int fd = open (input->path, O_RDONLY);
+	(void) arg;
+
+	input->valid = 0;
+	if (fd < 0)
+	{
+		fprintf (stderr, "Cannot open input file: %s\n", input->path);
+		return;
+	}
+	if (fstat (fd, &st) || (uint64_t) st.st_size != input->entry.size)
+	{
+		fprintf (stderr, "Input file changed while building the archive: %s\n", input->path);
+		close (fd);
+		return;
+	}
+	if (!ktx_copy_data (fd, 0, out_fd, input->entry.offset, input->entry.size))
+	{
+		fprintf (stderr, "Could not copy %s: %s\n", input->path, strerror (errno));
+		close (fd);
+		return;
+	}
+	close (fd);
+	input->valid = 1;
+}
+
+typedef struct bucket {
+	uint32_t index;
+	uint32_t count;
+	uint32_t *members;
+} bucket_t;
+
+int compare_buckets (const void *a, const void *b)
+{
+	const bucket_t *x = (const bucket_t*) a, *y = (const bucket_t*) b;
+	/* larger buckets are placed first, ties are broken by index so the
+	 * result does not depend on the sort algorithm */
+	if (x->count != y->count)
+		return (x->count > y->count) ? -1 : 1;
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+/* finds a seed for every bucket such that each input gets its own slot */
+int build_hash (void)
+{
+	bucket_t *buckets = (bucket_t*) calloc (header.bucket_count, sizeof (bucket_t));
+	uint32_t *members = (uint32_t*) malloc ((input_count + 1) * sizeof (uint32_t));
+	uint32_t *placed = (uint32_t*) malloc ((input_count + 1) * sizeof (uint32_t));
+	uint8_t *used = (uint8_t*) calloc (header.slot_count, 1);
+	uint32_t i, b, next = 0;
+	int result = 1;
+
+	if (buckets == NULL || members == NULL || placed == NULL || used == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		free (buckets);
+		free (members);
+		free (placed);
+		free (used);
+		return 0;
+	}
+
+	for (i = 0; i < input_count; i++)
+		buckets[ktxpack_bucket (&header, inputs[i].hash)].count++;
+	for (b = 0; b < header.bucket_count; b++)
+	{
+		buckets[b].index = b;
+		buckets[b].members = &members[next];
+		next += buckets[b].count;
+		buckets[b].count = 0;
+	}
+	for (i = 0; i < input_count; i++)
+	{
+		bucket_t *bucket = &buckets[ktxpack_bucket (&header, inputs[i].hash)];
+		bucket->members[bucket->count++] = i;
+	}
+	qsort (buckets, header.bucket_count, sizeof (bucket_t), compare_buckets);
+
+	for (b = 0; b < header.bucket_count && result; b++)
+	{
+		bucket_t *bucket = &buckets[b];
+		uint32_t seed;
+		if (bucket->count == 0)
+			break;
+		for (seed = 0; seed < MAX_SEED; seed++)
+		{
+			uint32_t n;
+			for (n = 0; n < bucket->count; n++)
+			{
+				placed[n] = ktxpack_slot (&header, inputs[bucket->members[n]].hash, seed);
+				if (used[placed[n]])
+					break;
+				used[placed[n]] = 1;
+			}
+			if (n == bucket->count)
+				break;
+			/* undo the partial placement */
+			while (n-- > 0)
+				used[placed[n]] = 0;
+		}
+		if (seed == MAX_SEED)
+		{
+			fprintf (stderr, "Cannot build the name index.\n");
+			result = 0;
+			break;
+		}
+		seeds[bucket->index] = seed;
+		for (i = 0; i < bucket->count; i++)
+			slots[placed[i]] = inputs[bucket->members[i]].entry;
+	}
+
+	free (buckets);
+	free (members);
+	free (placed);
+	free (used);
+	return result;
+}
+
+int prepare_inputs (void)
+{
+	size_t i;
+
+	inputs = (input_t*) calloc (input_count + 1, sizeof (input_t));
+	if (inputs == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return 0;
+	}
+	for (i = 0; i < input_count; i++)
+	{
+		inputs[i].name = input_names[i];
+		inputs[i].length = strlen (input_names[i]);
+		if (directory != NULL)
+		{
+			inputs[i].path = (char*) malloc (strlen (directory) + inputs[i].length + 2);
+			if (inputs[i].path != NULL)
+				sprintf (inputs[i].path, "%s/%s", directory, input_names[i]);
+		}
+		else
+			inputs[i].path = strdup (input_names[i]);
+		if (inputs[i].path == NULL)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			return 0;
+		}
+	}
+
+	/* the order of the command line must not affect the archive */
+	qsort (inputs, input_count, sizeof (input_t), compare_inputs);
+	for (i = 1; i < input_count; i++)
+	{
+		if (!strcmp (inputs[i - 1].name, inputs[i].name))
+		{
+			fprintf (stderr, "Duplicate file name: %s\n", inputs[i].name);
+			return 0;
+		}
+	}
+
+	parallel_for (input_count, inspect_input, NULL);
+	for (i = 0; i < input_count; i++)
+	{
+		if (!inputs[i].valid)
+			return 0;
+	}
+	return 1;
+}
+
+/* lays out the directory and assigns the offsets of all files */
+int layout_archive (uint64_t *archive_size)
+{
+	const uint8_t magic[] = KTXPACK_MAGIC;
+	uint64_t names_size = 0, offset;
+	size_t i;
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.identifier, magic, sizeof (magic));
+	header.endianness = KTX_ENDIANNESS;
+	header.version = KTXPACK_VERSION;
+	header.entry_count = input_count;
+	/* about four names per bucket and a fifth of the slots left empty
+	 * keep the seed search short */
+	header.bucket_count = (input_count + 3) / 4 + 1;
+	header.slot_count = input_count + input_count / 4 + 1;
+
+	for (i = 0; i < input_count; i++)
+	{
+		inputs[i].entry.name_offset = names_size;
+		inputs[i].entry.name_length = inputs[i].length;
+		names_size += inputs[i].length + 1;
+	}
+	if (names_size >= KTXPACK_EMPTY_SLOT)
+	{
+		fprintf (stderr, "The file names are too long.\n");
+		return 0;
+	}
+	header.names_size = names_size;
+
+	header.seeds_offset = sizeof (ktxpack_header_t);
+	header.slots_offset = (header.seeds_offset + header.bucket_count * sizeof (uint32_t) + 7) & ~7ULL;
+	header.names_offset = header.slots_offset + header.slot_count * (uint64_t) sizeof (ktxpack_entry_t);
+	header.directory_size = header.names_offset + header.names_size;
+
+	offset = (header.directory_size + KTXPACK_ALIGNMENT - 1) & ~(uint64_t) (KTXPACK_ALIGNMENT - 1);
+	for (i = 0; i < input_count; i++)
+	{
+		inputs[i].entry.offset = offset;
+		offset += (inputs[i].entry.size + KTXPACK_ALIGNMENT - 1) & ~(uint64_t) (KTXPACK_ALIGNMENT - 1);
+	}
+	/* the last file is not padded */
+	*archive_size = input_count ? inputs[input_count - 1].entry.offset + inputs[input_count - 1].entry.size
+			: header.directory_size;
+
+	directory_data = (uint8_t*) calloc (header.directory_size, 1);
+	if (directory_data == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return 0;
+	}
+	seeds = (uint32_t*) (directory_data + header.seeds_offset);
+	slots = (ktxpack_entry_t*) (directory_data + header.slots_offset);
+	for (i = 0; i < header.slot_count; i++)
+		slots[i].name_offset = KTXPACK_EMPTY_SLOT;
+	for (i = 0; i < input_count; i++)
+		memcpy (directory_data + header.names_offset + inputs[i].entry.name_offset, inputs[i].name, inputs[i].length);
+	return 1;
+}
+
+int build_archive (void)
+{
+	uint64_t archive_size;
+	size_t i;
+
+	if (!prepare_inputs () || !layout_archive (&archive_size) || !build_hash ())
+		return 0;
+	memcpy (directory_data, &header, sizeof (header));
+
+	out_fd = open (archive_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out_fd < 0)
+	{
+		fprintf (stderr, "Cannot open output file for writing.\n");
+		return 0;
+	}
+	archive_created = 1;
+	/* the gaps between the files read as zeros */
+	if (ftruncate (out_fd, archive_size) || pwrite (out_fd, directory_data, header.directory_size, 0) != (ssize_t) header.directory_size)
+	{
+		fprintf (stderr, "Could not write archive directory.\n");
+		return 0;
+	}
+
+	parallel_for (input_count, store_input, NULL);
+	for (i = 0; i < input_count; i++)
+	{
+		if (!inputs[i].valid)
+			return 0;
+	}
+
+	if (close (out_fd))
+	{
+		out_fd = -1;
+		fprintf (stderr, "Could not write output file.\n");
+		return 0;
+	}
+	out_fd = -1;
+	return 1;
+}
+
+const char *internal_format_name (GLenum internalformat)
+{
+	const char *name = base_format_table_reverse_lookup (internal_format_table, internalformat, 0);
+	if (name == NULL)
+		name = base_format_table_reverse_lookup (compressed_internal_format_table, internalformat, 0);
+	return (name != NULL) ? name : "unknown";
+}
+
+int read_archive (void)
+{
+	ktxpack_t pack;
+	uint32_t i;
+	int result = 1;
+
+	if (!ktxpack_open (archive_filename, &pack))
+	{
+		fprintf (stderr, "Not a valid archive: %s\n", archive_filename);
+		return 0;
+	}
+
+	if (list)
+	{
+		for (i = 0; i < pack.header->slot_count; i++)
+		{
+			const ktxpack_entry_t *e = &pack.slots[i];
+			if (e->name_offset == KTXPACK_EMPTY_SLOT)
+				continue;
+			printf ("%s: %u x %u, %u levels, %s, %llu bytes\n", ktxpack_name (&pack, e),
+					e->pixelWidth, e->pixelHeight, e->numberOfMipmapLevels,
+					internal_format_name (e->glInternalFormat), (unsigned long long) e->size);
+		}
+	}
+	else
+	{
+		const ktxpack_entry_t *e = ktxpack_find (&pack, extract_name);
+		ktx_mapping_t view;
+		if (e == NULL)
+		{
+			fprintf (stderr, "No file named %s in the archive.\n", extract_name);
+			result = 0;
+		}
+		else
+		{
+			ktxpack_view (&pack, e, &view);
+			if (fwrite (view.data, 1, view.size, stdout) != view.size || fflush (stdout))
+			{
+				fprintf (stderr, "Could not write output.\n");
+				result = 0;
+			}
+		}
+	}
+
+	ktxpack_close (&pack);
+	return result;
+}
+
+void cleanup (void)
+{
+	size_t i;
+	if (inputs != NULL)
+	{
+		for (i = 0; i < input_count; i++)
+			free (inputs[i].path);
+		free (inputs);
+	}
+	free (directory_data);
+	if (out_fd >= 0)
+		close (out_fd);
+}
+
+int main (int argc, char *argv[])
+{
+	int result;
+
+	if (!parse_options (argc, argv)) {
+		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
+		return -1;
+	}
+
+	if (list || extract_name != NULL)
+		result = read_archive ();
+	else
+	{
+		result = build_archive ();
+		/* an incomplete archive must not be mistaken for a valid one */
+		if (!result && archive_created)
+			unlink (archive_filename);
+	}
+
+	cleanup ();
+	return result ? 0 : -1;
+}
@@ -0,0 +1,603 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ktx.h"
+#include "ktxfile.h"
+#include "keyvalue.h"
+#include "image.h"
+#include "pack.h"
+#include "cubemap.h"
+#include "tasks.h"
+#include "sh.h"
+#include "context.h"
+
+/* the highest band is sampled sufficiently by 64x64 faces, so larger levels
+ * are skipped unless the base level is requested */
+#define SH_MAX_FACE_SIZE 64
+
+/* basis functions weighted by the texel solid angles, shared by all probes
+ * with the same face size */
+typedef struct sh_table {
+	struct sh_table *next;
+	unsigned int size;
+	float *weights;
+	double total[6];
+} sh_table_t;
+
+sh_table_t *tables = NULL;
+
+typedef struct probe {
+	const char *filename;
+	ktx_mapping_t mapping;
+	size_t *offsets;
+	uint32_t level;
+	unsigned int size;
+	const sh_table_t *table;
+	/* faces read back through OpenGL if the data cannot be unpacked on the CPU */
+	image_t *faces[6];
+	float partial[6][SH_COEFFICIENTS * 3];
+	float coefficients[SH_COEFFICIENTS * 3];
+	int valid;
+	/* set by a face that could not be projected */
+	int failed;
+} probe_t;
+
+probe_t *probes = NULL;
+size_t probe_count = 0;
+
+int irradiance = 0;
+int base_level = 0;
+int store = 0;
+const char *key = "ktxutils.sh";
+const char *sidecar_filename = NULL;
+
+int have_context = 0;
+GLuint texture = 0;
+
+void usage (char *appname)
+{
+	fprintf (stdout, "Usage: %s [options] files\n"
+			"Options:\n"
+			"  -h, --help                Display this help message.\n"
+			"  -C, --context [backend]   Create the OpenGL context with glfw or egl. By\n"
+			"                            default a hidden GLFW window is used if a\n"
+			"                            display is available and EGL otherwise.\n"
+			"  -i, --irradiance          Convolve the coefficients with the cosine\n"
+			"                            lobe to obtain diffuse irradiance.\n"
+			"  -b, --base-level          Integrate the base level instead of the\n"
+			"                            first level of at most 64x64 pixels.\n"
+			"  -s, --store               Store the coefficients as key value data\n"
+			"                            in each input file.\n"
+			"  -k, --key [key]           Specify the key used for storing the\n"
+			"                            coefficients (default: ktxutils.sh).\n"
+			"  -o, --output [file]       Write the coefficients of all files to a\n"
+			"                            sidecar file, one line per input file.\n"
+			"\n"
+			"The nine RGB coefficients of the real spherical harmonics up to band 2\n"
+			"are stored as 27 numbers separated by spaces, ordered by coefficient.\n"
+			"Without -s or -o they are printed to standard output.\n"
+			"\n"
+			"Arguments:\n"
+			"  files                     KTX cube map files.\n", appname);
+	exit (0);
+}
+
+int parse_options (int argc, char **argv)
+{
+	int c = 0;
+	size_t i;
+	static struct option long_options[] = {
+			{ "help", no_argument, 0, 'h' },
+			{ "irradiance", no_argument, 0, 'i' },
+			{ "base-level", no_argument, 0, 'b' },
+			{ "store", no_argument, 0, 's' },
+			{ "key", required_argument, 0, 'k' },
+			{ "output", required_argument, 0, 'o' },
+			{ "context", required_argument, 0, 'C' },
+			{ 0, 0, 0, 0 }
+	};
+
+	while (1)
+	{
+		int option_index = 0;
+		c = getopt_long (argc, argv, "k:o:C:hibs", long_options, &option_index);
+
+		if (c== -1) break;
+
+		switch (c)
+		{
+		case 'C':
+			if (!context_set_backend (optarg)) return 0;
+			break;
+		case 'h':
+			usage (argv[0]);
+			break;
+		case 'i':
+			irradiance = 1;
+			break;
+		case 'b':
+			base_level = 1;
+			break;
+		case 's':
+			store = 1;
+			break;
+		case 'k':
+			key = optarg;
+			break;
+		case 'o':
+			sidecar_filename = optarg;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		fprintf (stderr, "No input files were specified.\n");
+		return 0;
+	}
+
+	probes = (probe_t*) calloc (argc - optind, sizeof (probe_t));
+	if (probes == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return 0;
+	}
+	probe_count = argc - optind;
+	for (i = 0; i < probe_count; i++)
+		probes[i].filename = argv[optind + i];
+	return 1;
+}
+
+void load_probe (size_t i, void *arg)
+{
+	probe_t *probe = &probes[i];
+	const ktx_header_t *h;
+	uint32_t levels;
+	(void) arg;
+
+	if (!ktx_map (probe->filename, &probe->mapping))
+	{
+		fprintf (stderr, "Cannot open input file: %s\n", probe->filename);
+		return;
+	}
+
+	h = ktx_mapped_header (&probe->mapping);
+	if (h == NULL || h->endianness != KTX_ENDIANNESS)
+	{
+		fprintf (stderr, "Not a KTX file: %s\n", probe->filename);
+		return;
+	}
+
+	if (h->numberOfFaces != 6 || h->numberOfArrayElements != 0 || h->pixelDepth != 0
+			|| h->pixelWidth != h->pixelHeight)
+	{
+		fprintf (stderr, "Not a cube map: %s\n", probe->filename);
+		return;
+	}
+
+	levels = ktx_level_count (h);
+	probe->offsets = (size_t*) malloc (levels * sizeof (size_t));
+	if (probe->offsets == NULL || !ktx_index_levels (&probe->mapping, probe->offsets))
+	{
+		fprintf (stderr, "Premature End Of File: %s\n", probe->filename);
+		return;
+	}
+
+	probe->level = 0;
+	probe->size = h->pixelWidth;
+	while (!base_level && probe->level + 1 < levels && probe->size > SH_MAX_FACE_SIZE)
+	{
+		probe->level++;
+		probe->size >>= 1;
+	}
+
+	if (packed_pixel_size (h->glFormat, h->glType) != 0)
+	{
+		uint32_t imageSize;
+		memcpy (&imageSize, probe->mapping.data + probe->offsets[probe->level], sizeof (uint32_t));
+		if (imageSize != packed_image_size (probe->size, probe->size, h->glFormat, h->glType))
+		{
+			fprintf (stderr, "Invalid image size: %s\n", probe->filename);
+			return;
+		}
+	}
+
+	probe->valid = 1;
+}
+
+int create_context (void)
+{
+	if (!context_create ("ktxsh"))
+		return 0;
+	have_context = 1;
+	glGenTextures (1, &texture);
+	glPixelStorei (GL_PACK_ALIGNMENT, 4);
+	glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+	return 1;
+}
+
+/* decodes the faces of the integrated level through OpenGL, which is used
+ * for compressed and packed formats */
+int read_back_faces (probe_t *probe)
+{
+	const ktx_header_t *h = ktx_mapped_header (&probe->mapping);
+	const uint8_t *data = probe->mapping.data + probe->offsets[probe->level];
+	uint32_t imageSize;
+	int face;
+
+	if (!have_context && !create_context ())
+		return 0;
+
+	memcpy (&imageSize, data, sizeof (uint32_t));
+	data += sizeof (uint32_t);
+
+	glBindTexture (GL_TEXTURE_CUBE_MAP, texture);
+	for (face = 0; face < 6; face++)
+	{
+		const uint8_t *facedata = data + face * (imageSize + KTX_PADDING (imageSize));
+		GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+
+		if (h->glType != 0)
+			glTexImage2D (target, 0, h->glInternalFormat, probe->size, probe->size, 0,
+						  h->glFormat, h->glType, facedata);
+		else
+			glCompressedTexImage2D (target, 0, h->glInternalFormat, probe->size, probe->size, 0,
+									imageSize, facedata);
+
+		probe->faces[face] = create_image (probe->size, probe->size);
+		if (probe->faces[face] == NULL)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			return 0;
+		}
+		glGetTexImage (target, 0, GL_RGBA, GL_FLOAT, probe->faces[face]->data);
+	}
+
+	if (glGetError () != GL_NO_ERROR)
+	{
+		fprintf (stderr, "Cannot decode image data: %s\n", probe->filename);
+		return 0;
+	}
+	return 1;
+}
+
+void build_table_face (size_t face, void *arg)
+{
+	sh_table_t *table = (sh_table_t*) arg;
+	float *weights = table->weights + face * table->size * table->size * SH_COEFFICIENTS;
+	unsigned int x, y;
+	double total = 0.0;
+
+	for (y = 0; y < table->size; y++)
+	{
+		float t = 2.0f * (y + 0.5f) / table->size - 1.0f;
+		for (x = 0; x < table->size; x++)
+		{
+			float dir[3], len, w;
+			int i;
+
+			cubemap_direction (face, 2.0f * (x + 0.5f) / table->size - 1.0f, t, dir);
+			len = sqrtf (dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+			dir[0] /= len; dir[1] /= len; dir[2] /= len;
+			sh_basis (dir, weights);
+
+			w = cubemap_texel_solid_angle (table->size, x, y);
+			total += w;
+			for (i = 0; i < SH_COEFFICIENTS; i++)
+				weights[i] *= w;
+			weights += SH_COEFFICIENTS;
+		}
+	}
+	table->total[face] = total;
+}
+
+const sh_table_t *get_table (unsigned int size)
+{
+	sh_table_t *table;
+
+	for (table = tables; table != NULL; table = table->next)
+	{
+		if (table->size == size)
+			return table;
+	}
+
+	table = (sh_table_t*) malloc (sizeof (sh_table_t));
+	if (table == NULL)
+		return NULL;
+	table->size = size;
+	table->weights = (float*) malloc ((size_t) 6 * size * size * SH_COEFFICIENTS * sizeof (float));
+	if (table->weights == NULL)
+	{
+		free (table);
+		return NULL;
+	}
+	table->next = tables;
+	tables = table;
+
+	parallel_for (6, build_table_face, table);
+	return table;
+}
+
+/* accumulates the solid angle weighted projection of one face */
+void project_face (size_t index, void *arg)
+{
+	probe_t *probe = &probes[index / 6];
+	int face = index % 6;
+	const ktx_header_t *h = ktx_mapped_header (&probe->mapping);
+	const float *weights = probe->table->weights + face * probe->size * probe->size * SH_COEFFICIENTS;
+	float *sum = probe->partial[face];
+	float *row = NULL;
+	const uint8_t *data = NULL;
+	size_t stride = 0;
+	unsigned int x, y;
+	(void) arg;
+
+	memset (sum, 0, sizeof (probe->partial[face]));
+
+	if (probe->faces[face] == NULL)
+	{
+		uint32_t imageSize;
+		data = probe->mapping.data + probe->offsets[probe->level];
+		memcpy (&imageSize, data, sizeof (uint32_t));
+		data += sizeof (uint32_t) + face * (imageSize + KTX_PADDING (imageSize));
+		stride = imageSize / probe->size;
+		row = (float*) malloc (probe->size * 4 * sizeof (float));
+		if (row == NULL)
+		{
+			__sync_fetch_and_or (&probe->failed, 1);
+			return;
+		}
+	}
+
+	for (y = 0; y < probe->size; y++)
+	{
+		const float *texels;
+
+		if (row != NULL)
+		{
+			unpack_pixels (data + y * stride, probe->size, h->glFormat, h->glType, row);
+			texels = row;
+		}
+		else
+			texels = &probe->faces[face]->data[y * probe->size * 4];
+
+		for (x = 0; x < probe->size; x++)
+		{
+			const float *texel = &texels[x * 4];
+			int i;
+
+			for (i = 0; i < SH_COEFFICIENTS; i++)
+			{
+				sum[i * 3 + 0] += texel[0] * weights[i];
+				sum[i * 3 + 1] += texel[1] * weights[i];
+				sum[i * 3 + 2] += texel[2] * weights[i];
+			}
+			weights += SH_COEFFICIENTS;
+		}
+	}
+
+	free (row);
+}
+
+/* sums up the faces in a fixed order, so the result does not depend on
+ * the scheduling, and normalizes the total solid angle to 4 pi */
+void reduce_probe (probe_t *probe)
+{
+	double weight = 0.0;
+	int face, i;
+
+	memset (probe->coefficients, 0, sizeof (probe->coefficients));
+	for (face = 0; face < 6; face++)
+	{
+		weight += probe->table->total[face];
+		for (i = 0; i < SH_COEFFICIENTS * 3; i++)
+			probe->coefficients[i] += probe->partial[face][i];
+	}
+	for (i = 0; i < SH_COEFFICIENTS * 3; i++)
+		probe->coefficients[i] *= 4.0f * (float) M_PI / weight;
+	if (irradiance)
+		sh_irradiance (probe->coefficients);
+}
+
+void format_coefficients (const probe_t *probe, char *buffer, size_t size)
+{
+	size_t len = 0;
+	int i;
+	for (i = 0; i < SH_COEFFICIENTS * 3 && len < size; i++)
+		len += snprintf (buffer + len, size - len, (i == 0) ? "%.9g" : " %.9g", probe->coefficients[i]);
+}
+
+int store_coefficients (const probe_t *probe, const char *value)
+{
+	keyvaluelist_t keyvalue = KEYVALUELIST_INIT;
+	ktx_header_t header;
+	int fd = open (probe->filename, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf (stderr, "Cannot open input file: %s\n", probe->filename);
+		return 0;
+	}
+
+	if (read (fd, &header, sizeof (ktx_header_t)) != sizeof (ktx_header_t)
+			|| !ktx_read_keyvalue (fd, &header, &keyvalue))
+	{
+		fprintf (stderr, "Invalid key value data: %s\n", probe->filename);
+		close (fd);
+		keyvalue_free (&keyvalue);
+		return 0;
+	}
+	close (fd);
+
+	if (!keyvalue_set (&keyvalue, key, value, strlen (value) + 1)
+			|| !ktx_replace_keyvalue (probe->filename, &keyvalue))
+	{
+		fprintf (stderr, "Cannot update key value data: %s\n", probe->filename);
+		keyvalue_free (&keyvalue);
+		return 0;
+	}
+	keyvalue_free (&keyvalue);
+	return 1;
+}
+
+void print_coefficients (const probe_t *probe)
+{
+	static const char *names[SH_COEFFICIENTS] = {
+			"0  0", "1 -1", "1  0", "1  1", "2 -2", "2 -1", "2  0", "2  1", "2  2"
+	};
+	int i;
+	printf ("%s:\n", probe->filename);
+	for (i = 0; i < SH_COEFFICIENTS; i++)
+		printf ("  %s: %.9g %.9g %.9g\n", names[i], probe->coefficients[i * 3],
+				probe->coefficients[i * 3 + 1], probe->coefficients[i * 3 + 2]);
+}
+
+void release_probe (probe_t *probe)
+{
+	int face;
+	ktx_unmap (&probe->mapping);
+	free (probe->offsets);
+	probe->offsets = NULL;
+	for (face = 0; face < 6; face++)
+	{
+		free_image (probe->faces[face]);
+		probe->faces[face] = NULL;
+	}
+}
+
+void cleanup (void)
+{
+	size_t i;
+	for (i = 0; i < probe_count; i++)
+		release_probe (&probes[i]);
+	free (probes);
+	while (tables != NULL)
+	{
+		sh_table_t *next = tables->next;
+		free (tables->weights);
+		free (tables);
+		tables = next;
+	}
+	if (texture)
+		glDeleteTextures (1, &texture);
+	context_destroy ();
+}
+
+int main (int argc, char *argv[])
+{
+	FILE *sidecar = NULL;
+	size_t i;
+
+	if (!parse_options (argc, argv)) {
+		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
+		cleanup ();
+		return -1;
+	}
+
+	parallel_for (probe_count, load_probe, NULL);
+
+	for (i = 0; i < probe_count; i++)
+	{
+		const ktx_header_t *h;
+		if (!probes[i].valid)
+		{
+			cleanup ();
+			return -1;
+		}
+		h = ktx_mapped_header (&probes[i].mapping);
+		if (packed_pixel_size (h->glFormat, h->glType) == 0 && !read_back_faces (&probes[i]))
+		{
+			cleanup ();
+			return -1;
+		}
+	}
+
+	for (i = 0; i < probe_count; i++)
+	{
+		probes[i].table = get_table (probes[i].size);
+		if (probes[i].table == NULL)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			cleanup ();
+			return -1;
+		}
+	}
+
+	/* faces of all files are projected in one parallel pass, which keeps
+	 * all cores busy for both single large and many small probes */
+	parallel_for (probe_count * 6, project_face, NULL);
+	for (i = 0; i < probe_count; i++)
+	{
+		if (probes[i].failed)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			cleanup ();
+			return -1;
+		}
+	}
+
+	if (sidecar_filename != NULL)
+	{
+		sidecar = fopen (sidecar_filename, "w");
+		if (sidecar == NULL)
+		{
+			fprintf (stderr, "Cannot open output file: %s\n", sidecar_filename);
+			cleanup ();
+			return -1;
+		}
+	}
+
+	for (i = 0; i < probe_count; i++)
+	{
+		char value[SH_COEFFICIENTS * 3 * 17];
+
+		reduce_probe (&probes[i]);
+		release_probe (&probes[i]);
+		format_coefficients (&probes[i], value, sizeof (value));
+
+		if (store && !store_coefficients (&probes[i], value))
+		{
+			if (sidecar != NULL) fclose (sidecar);
+			cleanup ();
+			return -1;
+		}
+		if (sidecar != NULL)
+			fprintf (sidecar, "%s %s\n", probes[i].filename, value);
+		if (!store && sidecar == NULL)
+			print_coefficients (&probes[i]);
+	}
+
+	if (sidecar != NULL && fclose (sidecar))
+	{
+		fprintf (stderr, "Write error.\n");
+		cleanup ();
+		return -1;
+	}
+
+	cleanup ();
+	return 0;
+}
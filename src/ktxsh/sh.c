@@ -0,0 +1,47 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "sh.h"
+#include <math.h>
+
+void sh_basis (const float *dir, float *y)
+{
+	float x = dir[0], yy = dir[1], z = dir[2];
+	y[0] = 0.282095f;
+	y[1] = 0.488603f * yy;
+	y[2] = 0.488603f * z;
+	y[3] = 0.488603f * x;
+	y[4] = 1.092548f * x * yy;
+	y[5] = 1.092548f * yy * z;
+	y[6] = 0.315392f * (3.0f * z * z - 1.0f);
+	y[7] = 1.092548f * x * z;
+	y[8] = 0.546274f * (x * x - yy * yy);
+}
+
+void sh_irradiance (float *coefficients)
+{
+	static const float band[SH_COEFFICIENTS] = {
+			(float) M_PI,
+			2.0f * (float) M_PI / 3.0f, 2.0f * (float) M_PI / 3.0f, 2.0f * (float) M_PI / 3.0f,
+			(float) M_PI / 4.0f, (float) M_PI / 4.0f, (float) M_PI / 4.0f, (float) M_PI / 4.0f, (float) M_PI / 4.0f
+	};
+	int i, c;
+	for (i = 0; i < SH_COEFFICIENTS; i++)
+		for (c = 0; c < 3; c++)
+			coefficients[i * 3 + c] *= band[i];
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef SH_H
+#define SH_H
+
+/* number of real spherical harmonics up to band 2 */
+#define SH_COEFFICIENTS 9
+
+/* evaluates the basis functions for a normalized direction, in the order
+ * (0,0), (1,-1), (1,0), (1,1), (2,-2), (2,-1), (2,0), (2,1), (2,2) */
+void sh_basis (const float *dir, float *y);
+
+/* convolves RGB radiance coefficients with the clamped cosine lobe, which
+ * yields the coefficients of the irradiance */
+void sh_irradiance (float *coefficients);
+
+#endif /* SH_H */
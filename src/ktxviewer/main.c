@@ -21,95 +21,70 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include "ktx.h"
+#include "ktxfile.h"
 #include <string.h>
 
 GLFWwindow *window = NULL;
-FILE *f = NULL;
+ktx_reader_t reader = { .fd = -1 };
 ktx_header_t header;
 GLuint texture = 0;
+/* smallest mipmap level that is not loaded yet, levels are loaded from
+ * the smallest to the largest one per frame */
+uint32_t pending_levels = 0;
 
-int load_texture (void)
+int load_level (uint32_t level)
 {
-	glGenTextures (1, &texture);
+	GLsizei width = header.pixelWidth >> level, height = header.pixelHeight >> level;
+	/* the level is passed to OpenGL straight from the mapping */
+	const uint8_t *data = ktx_reader_level_data (&reader, level);
 
-	glBindTexture (GL_TEXTURE_2D, texture);
+	if (width == 0) width = 1;
+	if (height == 0) height = 1;
 
-	int level;
-
-	for (level = 0; level < ((header.numberOfMipmapLevels == 0) ? 1 : header.numberOfMipmapLevels); level++)
+	if (header.glType != 0)
 	{
-		uint32_t imageSize = 0;
-		if (fread (&imageSize, 1, sizeof (uint32_t), f) != sizeof (uint32_t)) {
-			fprintf (stderr, "Could not read image size\n");
-			return 0;
-		}
-		void *data = malloc (imageSize);
-
-		if (fread (data, 1, imageSize, f) != imageSize) {
-			fprintf (stderr, "Could not read image data\n");
-			free (data);
-			return 0;
-		}
-
-		if (header.glType != 0)
-		{
-			glTexImage2D (GL_TEXTURE_2D, level, header.glInternalFormat, (header.pixelWidth >> level), (header.pixelHeight >> level), 0,
-					header.glFormat, header.glType, data);
-		}
-		else
-		{
-			glCompressedTexImage2D (GL_TEXTURE_2D, level, header.glInternalFormat,
-					(header.pixelWidth >> level), (header.pixelHeight >> level), 0,
-					imageSize, data);
-		}
-
-		free (data);
-
-		{
-			int skip = (3 - ((imageSize + 3) % 4));
-			if (skip > 0)
-			{
-				if (fseek (f, skip, SEEK_CUR))
-				{
-					fprintf (stderr, "Could not skip padding bytes\n");
-					return 0;
-				}
-			}
-		}
+		glTexImage2D (GL_TEXTURE_2D, level, header.glInternalFormat, width, height, 0,
+				header.glFormat, header.glType, data);
 	}
-
-	if (header.numberOfMipmapLevels == 0) {
-		glGenerateMipmap (GL_TEXTURE_2D);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	} else if (header.numberOfMipmapLevels == 1) {
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	} else {
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.numberOfMipmapLevels);
+	else
+	{
+		glCompressedTexImage2D (GL_TEXTURE_2D, level, header.glInternalFormat,
+				width, height, 0, reader.image_sizes[level], data);
 	}
 
+	/* only the loaded levels are sampled */
+	glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
 	return 1;
 }
 
-int load_ktx_header (void)
+int load_texture (void)
 {
-	if (fread (&header, 1, sizeof (ktx_header_t), f) != sizeof (ktx_header_t)) {
-		fprintf (stderr, "Cannot read KTX header.\n");
-		return 0;
-	}
+	uint32_t count = ktx_level_count (&header);
 
-	const uint8_t ktx_magic[] = KTX_MAGIC;
-	if (memcmp (&header.identifier[0], &ktx_magic[0], sizeof (ktx_magic))) {
-		fprintf (stderr, "Not a KTX file.\n");
-		return 0;
+	glGenTextures (1, &texture);
+
+	glBindTexture (GL_TEXTURE_2D, texture);
+
+	if (header.numberOfMipmapLevels == 0) {
+		if (!load_level (0))
+			return 0;
+		glGenerateMipmap (GL_TEXTURE_2D);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		return 1;
 	}
 
-	if (fseek (f, header.bytesOfKeyValueData, SEEK_CUR)) {
-		fprintf (stderr, "Could not skip key value data.\n");
-		return 0;
+	if (header.numberOfMipmapLevels == 1) {
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	} else {
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, count - 1);
 	}
 
-	return 1;
+	/* the smallest level is shown right away, the others are read ahead
+	 * while it is displayed */
+	ktx_reader_prefetch (&reader, 0, count - 1);
+	pending_levels = count - 1;
+	return load_level (count - 1);
 }
 
 int create_window (void)
@@ -134,7 +109,7 @@ void cleanup (void)
 {
 	if (texture != 0) glDeleteTextures (1, &texture);
     if (window != NULL) glfwDestroyWindow (window);
-	if (f != NULL) fclose (f);
+	ktx_reader_close (&reader);
 	glfwTerminate ();
 }
 
@@ -152,18 +127,13 @@ int main (int argc, char *argv[])
 		return -1;
 	}
 
-	f = fopen (argv [1], "rb");
-	if (!f)
+	if (!ktx_reader_open (argv [1], &reader))
 	{
-		fprintf (stderr, "Cannot open input file.\n");
-		cleanup ();
-		return -1;
-	}
-
-	if (!load_ktx_header ()) {
+		fprintf (stderr, "Cannot open input file or not a KTX file.\n");
 		cleanup ();
 		return -1;
 	}
+	header = reader.header;
 
 	if (!create_window ()) {
 		cleanup ();
@@ -197,6 +167,9 @@ int main (int argc, char *argv[])
 
 		glfwSwapBuffers (window);
         glfwPollEvents ();
+
+		if (pending_levels > 0 && !load_level (--pending_levels))
+			break;
 	}
 
 	cleanup ();
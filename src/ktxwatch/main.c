@@ -0,0 +1,912 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "tasks.h"
+
+typedef struct watch
+{
+	int wd;
+	/* directory relative to the source directory, empty for the root */
+	char *path;
+} watch_t;
+
+/* a conversion of one output file; a job is pending until its deadline
+ * passes, then running until its process is reaped */
+typedef struct job
+{
+	struct job *next;
+	char *dest;
+	char *sources[6];
+	int cubemap;
+	int64_t deadline;
+	pid_t pid;
+	/* a source changed while the job was running */
+	int stale;
+} job_t;
+
+const char *face_suffixes[6] = { "posx", "negx", "posy", "negy", "posz", "negz" };
+
+const char *source_dir = NULL;
+const char *dest_dir = NULL;
+
+int recursive = 0;
+int initial = 0;
+unsigned int delay = 100;
+unsigned int max_jobs = 0;
+
+char **any2ktx_args = NULL;
+size_t any2ktx_argc = 0;
+char **cubemap_args = NULL;
+size_t cubemap_argc = 0;
+char **extensions = NULL;
+size_t extension_count = 0;
+
+int inotify_fd = -1;
+int signal_fd = -1;
+watch_t *watches = NULL;
+size_t watch_count = 0;
+
+job_t *jobs = NULL;
+unsigned int running = 0;
+
+/* splits a string at the given separators; the pointers refer to a copy
+ * of the string, which is owned by the first element */
+int split_list (const char *str, const char *separators, char ***list, size_t *count)
+{
+	char *copy = strdup (str);
+	char *token, *saveptr = NULL;
+	if (copy == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return 0;
+	}
+	*count = 0;
+	*list = NULL;
+	for (token = strtok_r (copy, separators, &saveptr); token != NULL; token = strtok_r (NULL, separators, &saveptr))
+	{
+		char **l = (char**) realloc (*list, (*count + 1) * sizeof (char*));
+		if (l == NULL)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			free (*list);
+			free (copy);
+			*list = NULL;
+			*count = 0;
+			return 0;
+		}
+		*list = l;
+		(*list)[(*count)++] = token;
+	}
+	if (*count == 0)
+	{
+		fprintf (stderr, "Empty list specified: %s\n", str);
+		free (copy);
+		return 0;
+	}
+	return 1;
+}
+
+int SetDelay (const char *delaystr)
+{
+	char *endptr;
+	delay = strtoul (delaystr, &endptr, 10);
+	if (delaystr + strlen (delaystr) != endptr)
+	{
+		fprintf (stderr, "Invalid delay requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+int SetJobs (const char *jobsstr)
+{
+	char *endptr;
+	max_jobs = strtoul (jobsstr, &endptr, 10);
+	if (jobsstr + strlen (jobsstr) != endptr || max_jobs == 0)
+	{
+		fprintf (stderr, "Invalid number of jobs requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+void usage (char *appname)
+{
+	fprintf (stdout, "Usage: %s [options] sourcedir destdir\n"
+			"Options:\n"
+			"  -h, --help                Display this help message.\n"
+			"  -r, --recursive           Watch the subdirectories of the source directory\n"
+			"                            as well.\n"
+			"  -i, --initial             Convert all images whose output is missing or\n"
+			"                            older than the image on startup.\n"
+			"  -a, --any2ktx [options]   Specify the options passed to any2ktx (default:\n"
+			"                            \"-i GL_RGBA8 -f GL_RGBA -t GL_UNSIGNED_BYTE\").\n"
+			"  -c, --cubemap [options]   Specify the options passed to ktxgencubemap\n"
+			"                            (default: none).\n"
+			"  -d, --delay [ms]          Specify how long a file must remain unchanged\n"
+			"                            before it is converted (default: 100).\n"
+			"  -j, --jobs [count]        Specify the number of concurrent conversions\n"
+			"                            (default: number of cores).\n"
+			"  -x, --extensions [list]   Specify the comma separated file extensions of\n"
+			"                            source images (default:\n"
+			"                            png,jpg,jpeg,tga,bmp,tif,tiff,exr,hdr).\n"
+			"\n"
+			"Each changed image is converted with any2ktx to a file of the same name\n"
+			"with the extension .ktx in the corresponding subdirectory of destdir.\n"
+			"Six images named <name>_posx, _negx, _posy, _negy, _posz and _negz form a\n"
+			"face set. Each face is converted with any2ktx, and the results are\n"
+			"combined with ktxgencubemap to <name>.ktx. A conversion that is still\n"
+			"running when one of its sources changes again is cancelled and restarted.\n"
+			"\n"
+			"The options of -a and -c are split at whitespace, so they cannot contain\n"
+			"arguments with spaces.\n"
+			"\n"
+			"Arguments:\n"
+			"  sourcedir                 Directory to watch.\n"
+			"  destdir                   Directory for the output files.\n", appname);
+	exit (0);
+}
+
+int parse_options (int argc, char **argv)
+{
+	int c = 0;
+	static struct option long_options[] = {
+			{ "help", no_argument, 0, 'h' },
+			{ "recursive", no_argument, 0, 'r' },
+			{ "initial", no_argument, 0, 'i' },
+			{ "any2ktx", required_argument, 0, 'a' },
+			{ "cubemap", required_argument, 0, 'c' },
+			{ "delay", required_argument, 0, 'd' },
+			{ "jobs", required_argument, 0, 'j' },
+			{ "extensions", required_argument, 0, 'x' },
+			{ 0, 0, 0, 0 }
+	};
+
+	while (1)
+	{
+		int option_index = 0;
+		c = getopt_long (argc, argv, "a:c:d:j:x:hri", long_options, &option_index);
+
+		if (c== -1) break;
+
+		switch (c)
+		{
+		case 'h':
+			usage (argv[0]);
+			break;
+		case 'r':
+			recursive = 1;
+			break;
+		case 'i':
+			initial = 1;
+			break;
+		case 'a':
+			free (any2ktx_args ? any2ktx_args[0] : NULL);
+			free (any2ktx_args);
+			if (!split_list (optarg, " \t\n", &any2ktx_args, &any2ktx_argc)) return 0;
+			break;
+		case 'c':
+			free (cubemap_args ? cubemap_args[0] : NULL);
+			free (cubemap_args);
+			if (!split_list (optarg, " \t\n", &cubemap_args, &cubemap_argc)) return 0;
+			break;
+		case 'd':
+			if (!SetDelay (optarg)) return 0;
+			break;
+		case 'j':
+			if (!SetJobs (optarg)) return 0;
+			break;
+		case 'x':
+			free (extensions ? extensions[0] : NULL);
+			free (extensions);
+			if (!split_list (optarg, ",", &extensions, &extension_count)) return 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	if (any2ktx_args == NULL && !split_list ("-i GL_RGBA8 -f GL_RGBA -t GL_UNSIGNED_BYTE", " ", &any2ktx_args, &any2ktx_argc))
+		return 0;
+	if (extensions == NULL && !split_list ("png,jpg,jpeg,tga,bmp,tif,tiff,exr,hdr", ",", &extensions, &extension_count))
+		return 0;
+	if (max_jobs == 0)
+		max_jobs = task_concurrency ();
+
+	if (optind + 2 != argc)
+	{
+		fprintf (stderr, "Invalid number of arguments.\n");
+		return 0;
+	}
+	source_dir = argv[optind];
+	dest_dir = argv[optind + 1];
+	return 1;
+}
+
+int64_t now_ms (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* joins up to three path components, skipping empty ones */
+char *join_path (const char *a, const char *b, const char *c)
+{
+	char *path = NULL;
+	if (asprintf (&path, "%s%s%s%s%s", a, (*a && *b) ? "/" : "", b, ((*a || *b) && *c) ? "/" : "", c) < 0)
+		return NULL;
+	return path;
+}
+
+int is_source_image (const char *name)
+{
+	const char *ext = strrchr (name, '.');
+	size_t i;
+	if (ext == NULL || name[0] == '.')
+		return 0;
+	for (i = 0; i < extension_count; i++)
+	{
+		if (!strcasecmp (ext + 1, extensions[i]))
+			return 1;
+	}
+	return 0;
+}
+
+/* creates all missing parent directories of a file */
+int make_parent_directories (const char *filename)
+{
+	char *path = strdup (filename);
+	char *p;
+	if (path == NULL)
+		return 0;
+	for (p = strchr (path + 1, '/'); p != NULL; p = strchr (p + 1, '/'))
+	{
+		*p = 0;
+		if (mkdir (path, 0777) && errno != EEXIST)
+		{
+			fprintf (stderr, "Cannot create directory %s.\n", path);
+			free (path);
+			return 0;
+		}
+		*p = '/';
+	}
+	free (path);
+	return 1;
+}
+
+void free_job (job_t *job)
+{
+	int i;
+	free (job->dest);
+	for (i = 0; i < 6; i++)
+		free (job->sources[i]);
+	free (job);
+}
+
+/* determines the job for a source image given relative to the source
+ * directory; images of a face set all map to the same output */
+job_t *describe_job (const char *relpath)
+{
+	job_t *job = (job_t*) calloc (1, sizeof (job_t));
+	const char *ext = strrchr (relpath, '.');
+	size_t stemlen = ext - relpath;
+	char *base = NULL;
+	int face, i;
+
+	if (job == NULL)
+		return NULL;
+
+	for (face = 0; face < 6; face++)
+	{
+		size_t len = strlen (face_suffixes[face]);
+		if (stemlen > len + 1 && relpath[stemlen - len - 1] == '_'
+			&& !strncmp (&relpath[stemlen - len], face_suffixes[face], len))
+		{
+			stemlen -= len + 1;
+			job->cubemap = 1;
+			break;
+		}
+	}
+
+	if (asprintf (&base, "%.*s.ktx", (int) stemlen, relpath) < 0)
+	{
+		free (job);
+		return NULL;
+	}
+	job->dest = join_path (dest_dir, base, "");
+	free (base);
+
+	if (job->cubemap)
+	{
+		for (i = 0; i < 6; i++)
+		{
+			if (asprintf (&base, "%.*s_%s%s", (int) stemlen, relpath, face_suffixes[i], ext) < 0)
+				base = NULL;
+			job->sources[i] = base ? join_path (source_dir, base, "") : NULL;
+			free (base);
+		}
+	}
+	else
+		job->sources[0] = join_path (source_dir, relpath, "");
+
+	for (i = 0; i < (job->cubemap ? 6 : 1); i++)
+	{
+		if (job->sources[i] == NULL)
+			break;
+	}
+	if (job->dest == NULL || i < (job->cubemap ? 6 : 1))
+	{
+		free_job (job);
+		return NULL;
+	}
+	return job;
+}
+
+/* schedules the conversion of a changed source image; a running
+ * conversion of the same output is cancelled */
+void schedule (const char *relpath, int64_t deadline)
+{
+	job_t *job = describe_job (relpath);
+	job_t *j;
+	if (job == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return;
+	}
+
+	for (j = jobs; j != NULL; j = j->next)
+	{
+		if (!strcmp (j->dest, job->dest))
+		{
+			if (j->pid > 0 && !j->stale)
+			{
+				kill (-j->pid, SIGTERM);
+				j->stale = 1;
+			}
+			j->deadline = deadline;
+			free_job (job);
+			return;
+		}
+	}
+	job->deadline = deadline;
+	job->next = jobs;
+	jobs = job;
+}
+
+/* schedules a source image if its output is missing or out of date */
+void schedule_outdated (const char *relpath)
+{
+	job_t *job = describe_job (relpath);
+	struct stat src, dst;
+	int i, outdated = 0;
+	if (job == NULL)
+		return;
+	if (stat (job->dest, &dst))
+		outdated = 1;
+	for (i = 0; i < (job->cubemap ? 6 : 1) && !outdated; i++)
+	{
+		if (!stat (job->sources[i], &src) && src.st_mtime >= dst.st_mtime)
+			outdated = 1;
+	}
+	free_job (job);
+	if (outdated)
+		schedule (relpath, now_ms ());
+}
+
+int add_watch (const char *relpath);
+
+/* watches a directory and, in recursive mode, its subdirectories;
+ * outdated images are scheduled if requested */
+int scan_directory (const char *relpath, int add, int outdated)
+{
+	char *path = join_path (source_dir, relpath, "");
+	DIR *dir;
+	struct dirent *entry;
+
+	if (path == NULL)
+		return 0;
+	if (add && !add_watch (relpath))
+	{
+		free (path);
+		return 0;
+	}
+	dir = opendir (path);
+	free (path);
+	if (dir == NULL)
+		return !add;
+
+	while ((entry = readdir (dir)) != NULL)
+	{
+		char *child;
+		struct stat st;
+		if (entry->d_name[0] == '.')
+			continue;
+		child = join_path (relpath, entry->d_name, "");
+		path = join_path (source_dir, child, "");
+		if (child != NULL && path != NULL && !stat (path, &st))
+		{
+			if (S_ISDIR (st.st_mode) && recursive)
+				scan_directory (child, add, outdated);
+			else if (S_ISREG (st.st_mode) && outdated && is_source_image (entry->d_name))
+				schedule_outdated (child);
+		}
+		free (path);
+		free (child);
+	}
+	closedir (dir);
+	return 1;
+}
+
+int add_watch (const char *relpath)
+{
+	char *path = join_path (source_dir, relpath, "");
+	watch_t *w;
+	int wd;
+	size_t i;
+
+	if (path == NULL)
+		return 0;
+	wd = inotify_add_watch (inotify_fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | (recursive ? IN_CREATE : 0) | IN_ONLYDIR);
+	free (path);
+	if (wd < 0)
+	{
+		fprintf (stderr, "Cannot watch directory %s: %s\n", *relpath ? relpath : source_dir, strerror (errno));
+		return 0;
+	}
+
+	/* a directory that is watched already keeps its descriptor */
+	for (i = 0; i < watch_count; i++)
+	{
+		if (watches[i].wd == wd)
+			return 1;
+	}
+	w = (watch_t*) realloc (watches, (watch_count + 1) * sizeof (watch_t));
+	if (w == NULL)
+		return 0;
+	watches = w;
+	watches[watch_count].wd = wd;
+	watches[watch_count].path = strdup (relpath);
+	if (watches[watch_count].path == NULL)
+		return 0;
+	watch_count++;
+	return 1;
+}
+
+void remove_watch (int wd)
+{
+	size_t i;
+	for (i = 0; i < watch_count; i++)
+	{
+		if (watches[i].wd == wd)
+		{
+			free (watches[i].path);
+			watches[i] = watches[--watch_count];
+			return;
+		}
+	}
+}
+
+const char *watch_path (int wd)
+{
+	size_t i;
+	for (i = 0; i < watch_count; i++)
+	{
+		if (watches[i].wd == wd)
+			return watches[i].path;
+	}
+	return NULL;
+}
+
+int handle_events (void)
+{
+	char buffer[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	ssize_t len = read (inotify_fd, buffer, sizeof (buffer));
+	char *p;
+
+	if (len < 0)
+		return errno == EINTR || errno == EAGAIN;
+
+	for (p = buffer; p < buffer + len; p += sizeof (struct inotify_event) + ((struct inotify_event*) p)->len)
+	{
+		const struct inotify_event *event = (const struct inotify_event*) p;
+		const char *dir = watch_path (event->wd);
+		char *relpath;
+
+		if (event->mask & IN_Q_OVERFLOW)
+		{
+			/* events were lost, so everything has to be checked */
+			scan_directory ("", 0, 1);
+			continue;
+		}
+		if (event->mask & IN_IGNORED)
+		{
+			remove_watch (event->wd);
+			continue;
+		}
+		if (dir == NULL || event->len == 0 || event->name[0] == '.')
+			continue;
+
+		relpath = join_path (dir, event->name, "");
+		if (relpath == NULL)
+			continue;
+		if (event->mask & IN_ISDIR)
+		{
+			/* files may have been created before the watch was added */
+			if (recursive)
+				scan_directory (relpath, 1, 1);
+		}
+		else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && is_source_image (event->name))
+			schedule (relpath, now_ms () + delay);
+		free (relpath);
+	}
+	return 1;
+}
+
+/* name of the temporary output of a running job */
+char *part_filename (const job_t *job)
+{
+	char *part = NULL;
+	if (asprintf (&part, "%s.part", job->dest) < 0)
+		return NULL;
+	return part;
+}
+
+/* name of the temporary KTX file of one face of a face set */
+char *face_filename (const job_t *job, int face)
+{
+	char *part = NULL;
+	if (asprintf (&part, "%s.%s.part", job->dest, face_suffixes[face]) < 0)
+		return NULL;
+	return part;
+}
+
+/* removes the temporary files of a job */
+void remove_parts (const job_t *job)
+{
+	char *part = part_filename (job);
+	int face;
+	if (part != NULL)
+		unlink (part);
+	free (part);
+	for (face = 0; face < (job->cubemap ? 6 : 0); face++)
+	{
+		part = face_filename (job, face);
+		if (part != NULL)
+			unlink (part);
+		free (part);
+	}
+}
+
+/* builds the command line of a tool with the given options followed by
+ * the input and output files */
+char **build_command (const char *tool, char **options, size_t option_count, char **inputs, size_t input_count, char *output)
+{
+	char **argv = (char**) malloc ((option_count + input_count + 3) * sizeof (char*));
+	size_t argc = 0, i;
+	if (argv == NULL)
+		return NULL;
+	argv[argc++] = (char*) tool;
+	for (i = 0; i < option_count; i++)
+		argv[argc++] = options[i];
+	for (i = 0; i < input_count; i++)
+		argv[argc++] = inputs[i];
+	argv[argc++] = output;
+	argv[argc] = NULL;
+	return argv;
+}
+
+pid_t spawn (char **argv)
+{
+	pid_t pid = fork ();
+	if (pid == 0)
+	{
+		signal (SIGTERM, SIG_DFL);
+		execvp (argv[0], argv);
+		fprintf (stderr, "Cannot run %s: %s\n", argv[0], strerror (errno));
+		_exit (127);
+	}
+	return pid;
+}
+
+/* converts a face set in the child process of a job: ktxgencubemap only
+ * reads KTX files, so the faces are first converted with any2ktx into
+ * temporary files, all six at once; a cancelled job only stops the tools,
+ * so that the temporary files are still removed */
+int convert_face_set (job_t *job, char *part)
+{
+	char *faces[6] = { NULL };
+	pid_t pids[6];
+	char **argv;
+	int face, status, result = 1;
+	pid_t pid;
+
+	for (face = 0; face < 6; face++)
+	{
+		pids[face] = -1;
+		faces[face] = face_filename (job, face);
+		argv = faces[face] ? build_command ("any2ktx", any2ktx_args, any2ktx_argc, &job->sources[face], 1, faces[face]) : NULL;
+		if (argv != NULL)
+			pids[face] = spawn (argv);
+		free (argv);
+		if (pids[face] < 0)
+			result = 0;
+	}
+	for (face = 0; face < 6; face++)
+	{
+		if (pids[face] > 0 && (waitpid (pids[face], &status, 0) != pids[face]
+				|| !WIFEXITED (status) || WEXITSTATUS (status) != 0))
+			result = 0;
+	}
+
+	if (result)
+	{
+		argv = build_command ("ktxgencubemap", cubemap_args, cubemap_argc, faces, 6, part);
+		pid = argv ? spawn (argv) : -1;
+		free (argv);
+		result = (pid > 0 && waitpid (pid, &status, 0) == pid && WIFEXITED (status) && WEXITSTATUS (status) == 0);
+	}
+
+	for (face = 0; face < 6; face++)
+	{
+		if (faces[face] != NULL)
+			unlink (faces[face]);
+		free (faces[face]);
+	}
+	return result;
+}
+
+/* starts the conversion of a job; the output is written to a temporary
+ * file that replaces the destination once the conversion succeeded */
+int start_job (job_t *job)
+{
+	char **argv = NULL;
+	size_t i;
+	char *part;
+	pid_t pid;
+
+	for (i = 0; i < (job->cubemap ? 6 : 1); i++)
+	{
+		/* face sets are converted once they are complete */
+		if (access (job->sources[i], R_OK))
+			return 0;
+	}
+	if (!make_parent_directories (job->dest) || (part = part_filename (job)) == NULL)
+		return 0;
+
+	if (!job->cubemap)
+	{
+		argv = build_command ("any2ktx", any2ktx_args, any2ktx_argc, job->sources, 1, part);
+		if (argv == NULL)
+		{
+			free (part);
+			return 0;
+		}
+	}
+
+	pid = fork ();
+	if (pid == 0)
+	{
+		sigset_t mask;
+		sigemptyset (&mask);
+		sigprocmask (SIG_SETMASK, &mask, NULL);
+		/* the conversion gets its own process group, so that cancelling
+		 * it also stops the conversions of the faces of a face set */
+		setpgid (0, 0);
+		if (job->cubemap)
+		{
+			signal (SIGTERM, SIG_IGN);
+			_exit (convert_face_set (job, part) ? 0 : 1);
+		}
+		execvp (argv[0], argv);
+		fprintf (stderr, "Cannot run %s: %s\n", argv[0], strerror (errno));
+		_exit (127);
+	}
+	free (argv);
+	free (part);
+	if (pid < 0)
+	{
+		fprintf (stderr, "Cannot start conversion: %s\n", strerror (errno));
+		return 0;
+	}
+	setpgid (pid, pid);
+	job->pid = pid;
+	job->stale = 0;
+	running++;
+	return 1;
+}
+
+/* reaps finished conversions and moves their output into place */
+void finish_jobs (void)
+{
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+	{
+		job_t **prev, *job;
+		char *part;
+		int success;
+
+		for (prev = &jobs; *prev != NULL && (*prev)->pid != pid; prev = &(*prev)->next);
+		job = *prev;
+		if (job == NULL)
+			continue;
+		running--;
+		job->pid = 0;
+
+		if (job->stale)
+		{
+			/* the job stays pending and is restarted after its deadline */
+			remove_parts (job);
+			job->stale = 0;
+			continue;
+		}
+
+		part = part_filename (job);
+		success = (WIFEXITED (status) && WEXITSTATUS (status) == 0 && part != NULL && !rename (part, job->dest));
+		free (part);
+		remove_parts (job);
+		if (success)
+			fprintf (stdout, "%s\n", job->dest);
+		else
+			fprintf (stderr, "Conversion of %s failed.\n", job->dest);
+		fflush (stdout);
+		*prev = job->next;
+		free_job (job);
+	}
+}
+
+/* starts all jobs whose deadline has passed as long as there are free
+ * slots and returns the time until the next deadline, or -1 */
+int start_jobs (void)
+{
+	int64_t now = now_ms ();
+	int timeout = -1;
+	job_t **prev = &jobs;
+
+	while (*prev != NULL)
+	{
+		job_t *job = *prev;
+		if (job->pid > 0)
+		{
+			prev = &job->next;
+			continue;
+		}
+		if (job->deadline > now)
+		{
+			if (timeout < 0 || job->deadline - now < timeout)
+				timeout = (int) (job->deadline - now);
+			prev = &job->next;
+			continue;
+		}
+		if (running >= max_jobs)
+			return timeout;
+		if (!start_job (job))
+		{
+			*prev = job->next;
+			free_job (job);
+			continue;
+		}
+		prev = &job->next;
+	}
+	return timeout;
+}
+
+void cleanup (void)
+{
+	job_t *job;
+	size_t i;
+
+	while (jobs != NULL)
+	{
+		job = jobs;
+		jobs = job->next;
+		if (job->pid > 0)
+		{
+			kill (-job->pid, SIGTERM);
+			waitpid (job->pid, NULL, 0);
+			remove_parts (job);
+		}
+		free_job (job);
+	}
+	for (i = 0; i < watch_count; i++)
+		free (watches[i].path);
+	free (watches);
+	if (inotify_fd >= 0)
+		close (inotify_fd);
+	if (signal_fd >= 0)
+		close (signal_fd);
+}
+
+int main (int argc, char *argv[])
+{
+	sigset_t mask;
+
+	if (!parse_options (argc, argv)) {
+		fprintf (stderr, "Invalid arguments. For help type %s -h.\n", argv[0]);
+		return -1;
+	}
+
+	/* children and termination requests are handled in the event loop */
+	sigemptyset (&mask);
+	sigaddset (&mask, SIGCHLD);
+	sigaddset (&mask, SIGINT);
+	sigaddset (&mask, SIGTERM);
+	sigprocmask (SIG_BLOCK, &mask, NULL);
+	signal_fd = signalfd (-1, &mask, SFD_CLOEXEC);
+	inotify_fd = inotify_init1 (IN_CLOEXEC | IN_NONBLOCK);
+	if (signal_fd < 0 || inotify_fd < 0)
+	{
+		fprintf (stderr, "Cannot initialize inotify.\n");
+		cleanup ();
+		return -1;
+	}
+
+	if (!scan_directory ("", 1, initial))
+	{
+		cleanup ();
+		return -1;
+	}
+
+	while (1)
+	{
+		struct pollfd fds[2] = { { inotify_fd, POLLIN, 0 }, { signal_fd, POLLIN, 0 } };
+		int timeout = start_jobs ();
+
+		if (poll (fds, 2, timeout) < 0 && errno != EINTR)
+		{
+			fprintf (stderr, "Cannot wait for events: %s\n", strerror (errno));
+			break;
+		}
+		if (fds[1].revents & POLLIN)
+		{
+			struct signalfd_siginfo info;
+			if (read (signal_fd, &info, sizeof (info)) == sizeof (info) && info.ssi_signo != SIGCHLD)
+				break;
+			finish_jobs ();
+		}
+		if ((fds[0].revents & POLLIN) && !handle_events ())
+		{
+			fprintf (stderr, "Cannot read inotify events.\n");
+			break;
+		}
+	}
+
+	cleanup ();
+	return 0;
+}
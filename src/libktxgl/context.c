@@ -0,0 +1,239 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "context.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static int backend = CONTEXT_AUTO;
+static GLFWwindow *window = NULL;
+static int glfw_initialized = 0;
+
+#ifdef HAVE_EGL
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+#endif
+
+int context_set_backend (const char *name)
+{
+	if (!strcmp (name, "auto"))
+		backend = CONTEXT_AUTO;
+	else if (!strcmp (name, "glfw"))
+		backend = CONTEXT_GLFW;
+	else if (!strcmp (name, "egl"))
+	{
+#ifdef HAVE_EGL
+		backend = CONTEXT_EGL;
+#else
+		fprintf (stderr, "EGL support is not available.\n");
+		return 0;
+#endif
+	}
+	else
+	{
+		fprintf (stderr, "Invalid context backend requested.\n");
+		return 0;
+	}
+	return 1;
+}
+
+static int init_glfw (void)
+{
+	if (!glfw_initialized)
+		glfw_initialized = glfwInit ();
+	return glfw_initialized;
+}
+
+static int create_glfw_context (const char *title)
+{
+	if (!init_glfw ())
+		return 0;
+	glfwWindowHint (GLFW_VISIBLE, GL_FALSE);
+	window = glfwCreateWindow (64, 64, title, NULL, NULL);
+	if (window == NULL)
+		return 0;
+	glfwMakeContextCurrent (window);
+	return 1;
+}
+
+#ifdef HAVE_EGL
+static int has_extension (const char *extensions, const char *name)
+{
+	size_t length = strlen (name);
+	const char *p = extensions;
+
+	while (p != NULL && (p = strstr (p, name)) != NULL)
+	{
+		if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+			return 1;
+		p += length;
+	}
+	return 0;
+}
+
+/* Mesa can create contexts on the surfaceless platform, which needs neither
+ * a display server nor a window; llvmpipe is used if there is no GPU */
+static int create_egl_context (void)
+{
+	static const EGLint config_attributes[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_NONE
+	};
+	const char *extensions = eglQueryString (EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+	EGLConfig config;
+	EGLint count;
+
+	if (!has_extension (extensions, "EGL_EXT_platform_base")
+			|| !has_extension (extensions, "EGL_MESA_platform_surfaceless"))
+		return 0;
+
+	get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress ("eglGetPlatformDisplayEXT");
+	if (get_platform_display == NULL)
+		return 0;
+	egl_display = get_platform_display (EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (egl_display == EGL_NO_DISPLAY)
+		return 0;
+	if (!eglInitialize (egl_display, NULL, NULL))
+	{
+		egl_display = EGL_NO_DISPLAY;
+		return 0;
+	}
+
+	if (!eglBindAPI (EGL_OPENGL_API)
+			|| !eglChooseConfig (egl_display, config_attributes, &config, 1, &count) || count == 0)
+		return 0;
+	egl_context = eglCreateContext (egl_display, config, EGL_NO_CONTEXT, NULL);
+	if (egl_context == EGL_NO_CONTEXT)
+		return 0;
+	return eglMakeCurrent (egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context) == EGL_TRUE;
+}
+#endif
+
+static int init_glew (void)
+{
+	GLenum result = glewInit ();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	/* GLEW also looks for GLX extensions, which fails without an X display
+	 * after the GL functions were already loaded */
+	if (result == GLEW_ERROR_NO_GLX_DISPLAY && window == NULL)
+		result = GLEW_OK;
+#endif
+	if (result != GLEW_OK)
+	{
+		fprintf (stderr, "Cannot initialize GLEW.\n");
+		return 0;
+	}
+	return 1;
+}
+
+static int have_display (void)
+{
+	return getenv ("DISPLAY") != NULL || getenv ("WAYLAND_DISPLAY") != NULL;
+}
+
+int context_create (const char *title)
+{
+	int result = 0;
+
+	switch (backend)
+	{
+	case CONTEXT_AUTO:
+		if (have_display ())
+			result = create_glfw_context (title);
+#ifdef HAVE_EGL
+		if (!result)
+		{
+			context_destroy ();
+			result = create_egl_context ();
+		}
+#endif
+		break;
+	case CONTEXT_GLFW:
+		result = create_glfw_context (title);
+		break;
+#ifdef HAVE_EGL
+	case CONTEXT_EGL:
+		result = create_egl_context ();
+		break;
+#endif
+	}
+
+	if (!result)
+	{
+		fprintf (stderr, "Cannot create an OpenGL context.\n");
+		return 0;
+	}
+	return init_glew ();
+}
+
+GLFWwindow *context_create_window (const char *title, int width, int height)
+{
+	if (backend != CONTEXT_AUTO && backend != CONTEXT_GLFW)
+	{
+		fprintf (stderr, "Displaying images requires a GLFW window.\n");
+		return NULL;
+	}
+	if (!init_glfw ())
+	{
+		fprintf (stderr, "Cannot initialize GLFW.\n");
+		return NULL;
+	}
+	window = glfwCreateWindow (width, height, title, NULL, NULL);
+	if (window == NULL)
+	{
+		fprintf (stderr, "Cannot open window.\n");
+		return NULL;
+	}
+	glfwMakeContextCurrent (window);
+	if (!init_glew ())
+		return NULL;
+	return window;
+}
+
+void context_destroy (void)
+{
+#ifdef HAVE_EGL
+	if (egl_display != EGL_NO_DISPLAY)
+	{
+		eglMakeCurrent (egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (egl_context != EGL_NO_CONTEXT)
+			eglDestroyContext (egl_display, egl_context);
+		eglTerminate (egl_display);
+		egl_context = EGL_NO_CONTEXT;
+		egl_display = EGL_NO_DISPLAY;
+	}
+#endif
+	if (window != NULL)
+		glfwDestroyWindow (window);
+	window = NULL;
+	if (glfw_initialized)
+		glfwTerminate ();
+	glfw_initialized = 0;
+}
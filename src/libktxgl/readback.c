@@ -0,0 +1,328 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "readback.h"
+#include "ktxfile.h"
+#include "image.h"
+#include "pack.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct readback_slot {
+	/* pixel buffer object or client memory the level is read back into */
+	GLuint buffer;
+	uint8_t *memory;
+	size_t size;
+	size_t length;
+	/* packed float levels are encoded into this by the I/O thread */
+	uint8_t *staging;
+	size_t staging_size;
+	/* mapped buffer or memory while the level is being written */
+	const uint8_t *data;
+	/* read back, but not yet handed to the I/O thread */
+	int queued;
+	GLint width, height;
+	GLenum format, type;
+	uint32_t imageSize;
+} readback_slot_t;
+
+struct readback {
+	FILE *f;
+	int pbo;
+	readback_slot_t slots[2];
+	unsigned int next;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* level handed to the I/O thread, NULL once it is written */
+	readback_slot_t *pending;
+	int quit;
+	int failed;
+};
+
+static int write_slot (readback_t *readback, readback_slot_t *slot)
+{
+	static const uint8_t padding[3] = { 0, 0, 0 };
+	const uint8_t *data = slot->data;
+	size_t size = KTX_PADDING (slot->imageSize);
+
+	if (packed_float_type (slot->type))
+	{
+		image_t image;
+		image.width = slot->width;
+		image.height = slot->height;
+		image.data = (float*) data;
+		pack_image (&image, slot->format, slot->type, slot->staging);
+		data = slot->staging;
+	}
+	return fwrite (&slot->imageSize, 1, sizeof (uint32_t), readback->f) == sizeof (uint32_t)
+			&& fwrite (data, 1, slot->imageSize, readback->f) == slot->imageSize
+			&& fwrite (padding, 1, size, readback->f) == size;
+}
+
+static void *writer (void *arg)
+{
+	readback_t *readback = (readback_t*) arg;
+	readback_slot_t *slot;
+	int failed;
+
+	pthread_mutex_lock (&readback->lock);
+	while (1)
+	{
+		while (readback->pending == NULL && !readback->quit)
+			pthread_cond_wait (&readback->cond, &readback->lock);
+		if (readback->pending == NULL)
+			break;
+		slot = readback->pending;
+		failed = readback->failed;
+		pthread_mutex_unlock (&readback->lock);
+
+		/* once a write failed, the remaining levels are discarded */
+		if (!failed && !write_slot (readback, slot))
+		{
+			fprintf (stderr, "Could not write image data.\n");
+			failed = 1;
+		}
+
+		pthread_mutex_lock (&readback->lock);
+		if (failed)
+			readback->failed = 1;
+		readback->pending = NULL;
+		pthread_cond_broadcast (&readback->cond);
+	}
+	pthread_mutex_unlock (&readback->lock);
+	return NULL;
+}
+
+/* waits until the I/O thread has written the pending level */
+static int wait_idle (readback_t *readback)
+{
+	int failed;
+	pthread_mutex_lock (&readback->lock);
+	while (readback->pending != NULL)
+		pthread_cond_wait (&readback->cond, &readback->lock);
+	failed = readback->failed;
+	pthread_mutex_unlock (&readback->lock);
+	return !failed;
+}
+
+/* makes the remaining levels and readback_close fail once a level is lost */
+static void mark_failed (readback_t *readback)
+{
+	pthread_mutex_lock (&readback->lock);
+	readback->failed = 1;
+	pthread_mutex_unlock (&readback->lock);
+}
+
+/* maps a level that was read back and hands it to the idle I/O thread */
+static int submit_slot (readback_t *readback, readback_slot_t *slot)
+{
+	if (readback->pbo)
+	{
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->buffer);
+		slot->data = (const uint8_t*) glMapBufferRange (GL_PIXEL_PACK_BUFFER, 0, slot->length, GL_MAP_READ_BIT);
+		if (slot->data == NULL)
+		{
+			fprintf (stderr, "Cannot map pixel buffer.\n");
+			return 0;
+		}
+	}
+	else
+		slot->data = slot->memory;
+	slot->queued = 0;
+
+	pthread_mutex_lock (&readback->lock);
+	readback->pending = slot;
+	pthread_cond_broadcast (&readback->cond);
+	pthread_mutex_unlock (&readback->lock);
+	return 1;
+}
+
+static void release_slot (readback_t *readback, readback_slot_t *slot)
+{
+	if (readback->pbo && slot->data != NULL)
+	{
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->buffer);
+		glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+	}
+	slot->data = NULL;
+}
+
+static int reserve_slot (readback_t *readback, readback_slot_t *slot, size_t length, size_t staging_size)
+{
+	if (length > slot->size)
+	{
+		if (readback->pbo)
+		{
+			glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->buffer);
+			glBufferData (GL_PIXEL_PACK_BUFFER, length, NULL, GL_STREAM_READ);
+		}
+		else
+		{
+			uint8_t *memory = (uint8_t*) realloc (slot->memory, length);
+			if (memory == NULL)
+			{
+				fprintf (stderr, "Out of memory.\n");
+				return 0;
+			}
+			slot->memory = memory;
+		}
+		slot->size = length;
+	}
+	if (staging_size > slot->staging_size)
+	{
+		uint8_t *staging = (uint8_t*) realloc (slot->staging, staging_size);
+		if (staging == NULL)
+		{
+			fprintf (stderr, "Out of memory.\n");
+			return 0;
+		}
+		slot->staging = staging;
+		slot->staging_size = staging_size;
+	}
+	return 1;
+}
+
+static void destroy_readback (readback_t *readback)
+{
+	unsigned int i;
+	for (i = 0; i < 2; i++)
+	{
+		release_slot (readback, &readback->slots[i]);
+		if (readback->slots[i].buffer != 0)
+			glDeleteBuffers (1, &readback->slots[i].buffer);
+		free (readback->slots[i].memory);
+		free (readback->slots[i].staging);
+	}
+	if (readback->pbo)
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+	pthread_cond_destroy (&readback->cond);
+	pthread_mutex_destroy (&readback->lock);
+	free (readback);
+}
+
+readback_t *readback_open (FILE *f)
+{
+	readback_t *readback = (readback_t*) calloc (1, sizeof (readback_t));
+	unsigned int i;
+
+	if (readback == NULL)
+	{
+		fprintf (stderr, "Out of memory.\n");
+		return NULL;
+	}
+	readback->f = f;
+	/* without pixel buffer objects levels are read into client memory,
+	 * which still overlaps the transfers with the writes */
+	readback->pbo = GLEW_ARB_pixel_buffer_object && GLEW_ARB_map_buffer_range;
+	for (i = 0; i < 2 && readback->pbo; i++)
+		glGenBuffers (1, &readback->slots[i].buffer);
+	pthread_mutex_init (&readback->lock, NULL);
+	pthread_cond_init (&readback->cond, NULL);
+
+	if (pthread_create (&readback->thread, NULL, writer, readback))
+	{
+		fprintf (stderr, "Cannot start I/O thread.\n");
+		destroy_readback (readback);
+		return NULL;
+	}
+	return readback;
+}
+
+/* starts reading back a level into a slot whose buffer is not in use */
+static int read_slot (readback_t *readback, readback_slot_t *slot, GLint level, GLenum format, GLenum type, uint32_t imageSize)
+{
+	int packed = (format != 0 && packed_float_type (type));
+	size_t length;
+	void *target;
+
+	glGetTexLevelParameteriv (GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &slot->width);
+	glGetTexLevelParameteriv (GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &slot->height);
+	if (format == 0)
+		length = imageSize;
+	else if (packed)
+		length = (size_t) slot->width * slot->height * 4 * sizeof (float);
+	else /* rows are padded to four bytes */
+		length = imageSize + 3 * (size_t) slot->height;
+	if (!reserve_slot (readback, slot, length, packed ? imageSize : 0))
+		return 0;
+
+	if (readback->pbo)
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, slot->buffer);
+	target = readback->pbo ? NULL : slot->memory;
+	if (format == 0)
+		glGetCompressedTexImage (GL_TEXTURE_2D, level, target);
+	else if (packed)
+		glGetTexImage (GL_TEXTURE_2D, level, GL_RGBA, GL_FLOAT, target);
+	else
+		glGetTexImage (GL_TEXTURE_2D, level, format, type, target);
+
+	slot->format = format;
+	slot->type = type;
+	slot->imageSize = imageSize;
+	slot->length = length;
+	slot->queued = 1;
+	return 1;
+}
+
+int readback_level (readback_t *readback, GLint level, GLenum format, GLenum type, uint32_t imageSize)
+{
+	readback_slot_t *slot = &readback->slots[readback->next];
+	readback_slot_t *previous = &readback->slots[readback->next ^ 1];
+	int result;
+
+	/* the level last read into this slot has to be written before its
+	 * buffer is reused; the previous level is written while this one is
+	 * transferred */
+	if (!wait_idle (readback))
+		return 0;
+	release_slot (readback, slot);
+	result = (!previous->queued || submit_slot (readback, previous))
+			&& read_slot (readback, slot, level, format, type, imageSize);
+	if (!result)
+		mark_failed (readback);
+	readback->next ^= 1;
+
+	/* other reads of the caller go to client memory again */
+	if (readback->pbo)
+		glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+	return result;
+}
+
+int readback_close (readback_t *readback)
+{
+	readback_slot_t *last = &readback->slots[readback->next ^ 1];
+	int result = wait_idle (readback);
+
+	if (result && last->queued)
+	{
+		if (!submit_slot (readback, last))
+			mark_failed (readback);
+		result = wait_idle (readback);
+	}
+
+	pthread_mutex_lock (&readback->lock);
+	readback->quit = 1;
+	pthread_cond_broadcast (&readback->cond);
+	pthread_mutex_unlock (&readback->lock);
+	pthread_join (readback->thread, NULL);
+
+	destroy_readback (readback);
+	return result;
+}
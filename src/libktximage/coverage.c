@@ -0,0 +1,150 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "image.h"
+#include "tasks.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define COVERAGE_BAND_HEIGHT 16
+#define COVERAGE_BINS 4096
+
+typedef struct coverage_state {
+	image_t *image;
+	size_t bands;
+	float cutoff;
+	float scale;
+	size_t *counts;
+	uint32_t *histograms;
+} coverage_state_t;
+
+static size_t band_end (const image_t *image, size_t band)
+{
+	size_t end = (band + 1) * COVERAGE_BAND_HEIGHT;
+	return (end > image->height) ? image->height : end;
+}
+
+static void count_band (size_t band, void *arg)
+{
+	coverage_state_t *state = (coverage_state_t*) arg;
+	const image_t *image = state->image;
+	size_t i, end = band_end (image, band) * image->width;
+	size_t count = 0;
+
+	for (i = band * COVERAGE_BAND_HEIGHT * image->width; i < end; i++)
+		count += (image->data[i * 4 + 3] >= state->cutoff);
+	state->counts[band] = count;
+}
+
+/* every band fills its own histogram, which are summed up afterwards */
+static void histogram_band (size_t band, void *arg)
+{
+	coverage_state_t *state = (coverage_state_t*) arg;
+	const image_t *image = state->image;
+	uint32_t *histogram = &state->histograms[band * COVERAGE_BINS];
+	size_t i, end = band_end (image, band) * image->width;
+
+	memset (histogram, 0, COVERAGE_BINS * sizeof (uint32_t));
+	for (i = band * COVERAGE_BAND_HEIGHT * image->width; i < end; i++)
+	{
+		float alpha = image->data[i * 4 + 3];
+		int bin = (alpha <= 0.0f) ? 0 : ((alpha >= 1.0f) ? COVERAGE_BINS - 1 : (int) (alpha * COVERAGE_BINS));
+		histogram[bin]++;
+	}
+}
+
+static void scale_band (size_t band, void *arg)
+{
+	coverage_state_t *state = (coverage_state_t*) arg;
+	image_t *image = state->image;
+	size_t i, end = band_end (image, band) * image->width;
+
+	for (i = band * COVERAGE_BAND_HEIGHT * image->width; i < end; i++)
+	{
+		float alpha = image->data[i * 4 + 3] * state->scale;
+		image->data[i * 4 + 3] = (alpha > 1.0f) ? 1.0f : alpha;
+	}
+}
+
+float alpha_coverage (const image_t *image, float cutoff)
+{
+	coverage_state_t state;
+	size_t band, count = 0;
+
+	state.image = (image_t*) image;
+	state.bands = (image->height + COVERAGE_BAND_HEIGHT - 1) / COVERAGE_BAND_HEIGHT;
+	state.cutoff = cutoff;
+	state.counts = (size_t*) malloc (state.bands * sizeof (size_t));
+	if (state.counts == NULL)
+		return -1.0f;
+
+	parallel_for (state.bands, count_band, &state);
+	for (band = 0; band < state.bands; band++)
+		count += state.counts[band];
+	free (state.counts);
+	return (float) count / (image->width * image->height);
+}
+
+float alpha_coverage_scale (const image_t *image, float cutoff, float coverage)
+{
+	coverage_state_t state;
+	uint32_t histogram[COVERAGE_BINS];
+	size_t band, target, above = 0;
+	int bin;
+
+	state.image = (image_t*) image;
+	state.bands = (image->height + COVERAGE_BAND_HEIGHT - 1) / COVERAGE_BAND_HEIGHT;
+	state.histograms = (uint32_t*) malloc (state.bands * COVERAGE_BINS * sizeof (uint32_t));
+	if (state.histograms == NULL)
+		return -1.0f;
+
+	parallel_for (state.bands, histogram_band, &state);
+	memcpy (histogram, state.histograms, sizeof (histogram));
+	for (band = 1; band < state.bands; band++)
+		for (bin = 0; bin < COVERAGE_BINS; bin++)
+			histogram[bin] += state.histograms[band * COVERAGE_BINS + bin];
+	free (state.histograms);
+
+	/* find the alpha value above which the requested number of texels lie,
+	 * interpolating linearly within its bin */
+	target = (size_t) (coverage * image->width * image->height + 0.5f);
+	if (target == 0)
+		return 1.0f;
+	for (bin = COVERAGE_BINS - 1; bin > 0; bin--)
+	{
+		if (above + histogram[bin] >= target)
+			break;
+		above += histogram[bin];
+	}
+	{
+		float fraction = (histogram[bin] == 0) ? 0.0f : (float) (target - above) / histogram[bin];
+		float threshold = (bin + 1.0f - fraction) / COVERAGE_BINS;
+		if (threshold <= 0.0f)
+			threshold = 0.5f / COVERAGE_BINS;
+		return cutoff / threshold;
+	}
+}
+
+void scale_alpha (image_t *image, float scale)
+{
+	coverage_state_t state;
+
+	state.image = image;
+	state.scale = scale;
+	parallel_for ((image->height + COVERAGE_BAND_HEIGHT - 1) / COVERAGE_BAND_HEIGHT, scale_band, &state);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cubemap.h"
+#include <math.h>
+
+void cubemap_direction (int face, float s, float t, float *dir)
+{
+	switch (face)
+	{
+	case 0: dir[0] = 1.0f; dir[1] = -t; dir[2] = -s; break;
+	case 1: dir[0] = -1.0f; dir[1] = -t; dir[2] = s; break;
+	case 2: dir[0] = s; dir[1] = 1.0f; dir[2] = t; break;
+	case 3: dir[0] = s; dir[1] = -1.0f; dir[2] = -t; break;
+	case 4: dir[0] = s; dir[1] = -t; dir[2] = 1.0f; break;
+	default: dir[0] = -s; dir[1] = -t; dir[2] = -1.0f; break;
+	}
+}
+
+int cubemap_face (const float *dir, float *s, float *t)
+{
+	float ax = fabsf (dir[0]), ay = fabsf (dir[1]), az = fabsf (dir[2]);
+	if (ax >= ay && ax >= az)
+	{
+		if (dir[0] > 0) { *s = -dir[2] / ax; *t = -dir[1] / ax; return 0; }
+		*s = dir[2] / ax; *t = -dir[1] / ax; return 1;
+	}
+	if (ay >= az)
+	{
+		if (dir[1] > 0) { *s = dir[0] / ay; *t = dir[2] / ay; return 2; }
+		*s = dir[0] / ay; *t = -dir[2] / ay; return 3;
+	}
+	if (dir[2] > 0) { *s = dir[0] / az; *t = -dir[1] / az; return 4; }
+	*s = -dir[0] / az; *t = -dir[1] / az; return 5;
+}
+
+static float area_element (float x, float y)
+{
+	return atan2f (x * y, sqrtf (x * x + y * y + 1.0f));
+}
+
+float cubemap_texel_solid_angle (unsigned int size, unsigned int x, unsigned int y)
+{
+	float inv = 1.0f / size;
+	float x0 = 2.0f * x * inv - 1.0f, x1 = x0 + 2.0f * inv;
+	float y0 = 2.0f * y * inv - 1.0f, y1 = y0 + 2.0f * inv;
+	return area_element (x0, y0) - area_element (x0, y1) - area_element (x1, y0) + area_element (x1, y1);
+}
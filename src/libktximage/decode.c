@@ -0,0 +1,246 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "decode.h"
+#include "tasks.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define DECODE_BAND_HEIGHT 32
+
+typedef struct convert_state {
+	const uint8_t *data;
+	size_t stride;
+	int components;
+	int depth;
+	image_t *image;
+} convert_state_t;
+
+static void convert_band (size_t band, void *arg)
+{
+	const convert_state_t *state = (const convert_state_t*) arg;
+	image_t *image = state->image;
+	size_t x, y, yend = (band + 1) * DECODE_BAND_HEIGHT;
+	float scale = (state->depth == 16) ? 1.0f / 65535.0f : 1.0f / 255.0f;
+	int components = state->components;
+	int color = (components >= 3) ? 3 : 1;
+	int alpha = (components == 2 || components == 4);
+	const float *bytes = import_byte_table ();
+
+	if (yend > image->height)
+		yend = image->height;
+
+	for (y = band * DECODE_BAND_HEIGHT; y < yend; y++)
+	{
+		const uint8_t *row = state->data + y * state->stride;
+		float *out = &image->data[y * image->width * 4];
+		for (x = 0; x < image->width; x++)
+		{
+			float v[4];
+			int c;
+			for (c = 0; c < components; c++)
+			{
+				if (state->depth == 16)
+					v[c] = ((const uint16_t*) row)[x * components + c] * scale;
+				else if (c < color)
+					v[c] = bytes[row[x * components + c]];
+				else
+					v[c] = row[x * components + c] * scale;
+			}
+			out[x * 4 + 0] = v[0];
+			out[x * 4 + 1] = v[(color == 3) ? 1 : 0];
+			out[x * 4 + 2] = v[(color == 3) ? 2 : 0];
+			out[x * 4 + 3] = alpha ? v[components - 1] : 1.0f;
+		}
+		/* 8 bit colors were already linearized by the table */
+		import_row (out, image->width, alpha, state->depth != 8);
+	}
+}
+
+image_t *convert_image (const void *data, size_t width, size_t height, size_t stride, int components, int depth)
+{
+	convert_state_t state;
+
+	state.image = create_image (width, height);
+	if (state.image == NULL)
+		return NULL;
+	state.data = (const uint8_t*) data;
+	state.stride = stride;
+	state.components = components;
+	state.depth = depth;
+
+	parallel_for ((height + DECODE_BAND_HEIGHT - 1) / DECODE_BAND_HEIGHT, convert_band, &state);
+	return state.image;
+}
+
+/* reads the pixel data of an uncompressed or run length encoded TGA file
+ * into top down RGB(A) or gray rows; color mapped and 16 bit images are
+ * left to ImageMagick */
+image_t *decode_tga (FILE *f)
+{
+	uint8_t header[18];
+	size_t width, height, bpp, x, y, size, i;
+	uint8_t *data, *pixels;
+	image_t *image;
+	int rle, components;
+
+	if (fread (header, 1, 18, f) != 18)
+		return NULL;
+
+	width = header[12] | (header[13] << 8);
+	height = header[14] | (header[15] << 8);
+	bpp = header[16] / 8;
+	rle = (header[2] == 10 || header[2] == 11);
+	if (header[1] != 0 || width == 0 || height == 0 || (header[17] & 0x10))
+		return NULL;
+	if (!((header[2] == 2 || header[2] == 10) && (bpp == 3 || bpp == 4))
+			&& !((header[2] == 3 || header[2] == 11) && bpp == 1))
+		return NULL;
+	components = bpp;
+
+	if (fseek (f, header[0], SEEK_CUR))
+		return NULL;
+
+	size = width * height * bpp;
+	pixels = (uint8_t*) malloc (size);
+	if (pixels == NULL)
+		return NULL;
+
+	if (!rle)
+	{
+		if (fread (pixels, 1, size, f) != size)
+		{
+			free (pixels);
+			return NULL;
+		}
+	}
+	else
+	{
+		for (i = 0; i < size;)
+		{
+			int packet = fgetc (f);
+			size_t count = (packet & 0x7F) + 1;
+			if (packet == EOF || i + count * bpp > size)
+			{
+				free (pixels);
+				return NULL;
+			}
+			if (packet & 0x80)
+			{
+				uint8_t value[4];
+				if (fread (value, 1, bpp, f) != bpp)
+				{
+					free (pixels);
+					return NULL;
+				}
+				for (; count > 0; count--, i += bpp)
+					memcpy (&pixels[i], value, bpp);
+			}
+			else
+			{
+				if (fread (&pixels[i], 1, count * bpp, f) != count * bpp)
+				{
+					free (pixels);
+					return NULL;
+				}
+				i += count * bpp;
+			}
+		}
+	}
+
+	/* rows are stored bottom up unless the origin is at the top */
+	data = (uint8_t*) malloc (size);
+	if (data == NULL)
+	{
+		free (pixels);
+		return NULL;
+	}
+	for (y = 0; y < height; y++)
+	{
+		const uint8_t *src = &pixels[((header[17] & 0x20) ? y : height - 1 - y) * width * bpp];
+		uint8_t *dst = &data[y * width * bpp];
+		if (bpp == 1)
+		{
+			memcpy (dst, src, width);
+			continue;
+		}
+		for (x = 0; x < width; x++)
+		{
+			dst[x * bpp + 0] = src[x * bpp + 2];
+			dst[x * bpp + 1] = src[x * bpp + 1];
+			dst[x * bpp + 2] = src[x * bpp + 0];
+			if (bpp == 4)
+				dst[x * bpp + 3] = src[x * bpp + 3];
+		}
+	}
+	free (pixels);
+
+	image = convert_image (data, width, height, width * bpp, components, 8);
+	free (data);
+	return image;
+}
+
+static int has_extension (const char *filename, const char *extension)
+{
+	size_t len = strlen (filename), extlen = strlen (extension);
+	return len > extlen && !strcasecmp (filename + len - extlen, extension);
+}
+
+/* the file name is only used to recognize TGA files, which have no magic
+ * number, and may be NULL */
+image_t *decode_native_image (FILE *f, const char *filename)
+{
+	uint8_t magic[4];
+
+	if (fread (magic, 1, 4, f) != 4 || fseek (f, 0, SEEK_SET))
+		return NULL;
+
+	if (magic[0] == 0x89 && magic[1] == 'P' && magic[2] == 'N' && magic[3] == 'G')
+		return decode_png (f);
+	if (magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF)
+		return decode_jpeg (f);
+	if (filename != NULL && has_extension (filename, ".tga"))
+		return decode_tga (f);
+	return NULL;
+}
+
+image_t *load_native_image (const char *filename)
+{
+	image_t *image;
+	FILE *f = fopen (filename, "rb");
+	if (f == NULL)
+		return NULL;
+
+	image = decode_native_image (f, filename);
+	fclose (f);
+	return image;
+}
+
+image_t *load_native_image_memory (const void *data, size_t size)
+{
+	image_t *image;
+	FILE *f = fmemopen ((void*) data, size, "rb");
+	if (f == NULL)
+		return NULL;
+
+	image = decode_native_image (f, NULL);
+	fclose (f);
+	return image;
+}
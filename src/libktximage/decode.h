@@ -0,0 +1,48 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdio.h>
+#include "image.h"
+
+/* native decoders for common formats; they return NULL for anything they
+ * cannot handle, in which case the file is passed on to ImageMagick */
+image_t *decode_png (FILE *f);
+image_t *decode_jpeg (FILE *f);
+image_t *decode_tga (FILE *f);
+
+image_t *decode_native_image (FILE *f, const char *filename);
+image_t *load_native_image (const char *filename);
+image_t *load_native_image_memory (const void *data, size_t size);
+
+/* converts 8 or 16 bit gray, gray alpha, RGB or RGBA rows into a float
+ * RGBA image and applies the import conversions */
+image_t *convert_image (const void *data, size_t width, size_t height, size_t stride, int components, int depth);
+
+/* the import stage of image.c; rows are passed in as they are decoded,
+ * while they are still in the cache */
+void import_init (void);
+void import_row (float *row, size_t count, int has_alpha, int convert_colorspace);
+void import_image (image_t *image, int has_alpha);
+
+/* maps 8 bit color values to floats, linearized if requested */
+const float *import_byte_table (void);
+
+#endif /* DECODE_H */
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "decode.h"
+
+#ifdef HAVE_JPEG
+
+#include <jpeglib.h>
+#include <setjmp.h>
+#include <stdlib.h>
+
+typedef struct jpeg_error {
+	struct jpeg_error_mgr mgr;
+	jmp_buf jmpbuf;
+} jpeg_error_t;
+
+/* errors are not reported, the file is passed on to ImageMagick instead */
+static void jpeg_error_exit (j_common_ptr cinfo)
+{
+	longjmp (((jpeg_error_t*) cinfo->err)->jmpbuf, 1);
+}
+
+static void jpeg_output_message (j_common_ptr cinfo)
+{
+	(void) cinfo;
+}
+
+image_t *decode_jpeg (FILE *f)
+{
+	struct jpeg_decompress_struct cinfo;
+	jpeg_error_t error;
+	uint8_t *volatile data = NULL;
+	image_t *image;
+	size_t rowbytes;
+
+	cinfo.err = jpeg_std_error (&error.mgr);
+	error.mgr.error_exit = jpeg_error_exit;
+	error.mgr.output_message = jpeg_output_message;
+	if (setjmp (error.jmpbuf))
+	{
+		jpeg_destroy_decompress (&cinfo);
+		free (data);
+		return NULL;
+	}
+
+	jpeg_create_decompress (&cinfo);
+	jpeg_stdio_src (&cinfo, f);
+	jpeg_read_header (&cinfo, TRUE);
+
+	/* CMYK images need ImageMagick's color management */
+	if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK)
+	{
+		jpeg_destroy_decompress (&cinfo);
+		return NULL;
+	}
+	cinfo.out_color_space = (cinfo.num_components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_start_decompress (&cinfo);
+
+	rowbytes = (size_t) cinfo.output_width * cinfo.output_components;
+	data = (uint8_t*) malloc (rowbytes * cinfo.output_height);
+	if (data == NULL)
+	{
+		jpeg_destroy_decompress (&cinfo);
+		return NULL;
+	}
+
+	while (cinfo.output_scanline < cinfo.output_height)
+	{
+		JSAMPROW rows[16];
+		JDIMENSION i, count = cinfo.output_height - cinfo.output_scanline;
+		if (count > 16)
+			count = 16;
+		for (i = 0; i < count; i++)
+			rows[i] = data + (cinfo.output_scanline + i) * rowbytes;
+		jpeg_read_scanlines (&cinfo, rows, count);
+	}
+
+	image = convert_image (data, cinfo.output_width, cinfo.output_height, rowbytes, cinfo.output_components, 8);
+	jpeg_finish_decompress (&cinfo);
+	jpeg_destroy_decompress (&cinfo);
+	free (data);
+	return image;
+}
+
+#else
+
+image_t *decode_jpeg (FILE *f)
+{
+	return NULL;
+}
+
+#endif /* HAVE_JPEG */
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "decode.h"
+
+#ifdef HAVE_PNG
+
+#include <png.h>
+#include <setjmp.h>
+#include <stdlib.h>
+
+/* errors are not reported, the file is passed on to ImageMagick instead */
+static void png_error_handler (png_structp png, png_const_charp message)
+{
+	(void) message;
+	longjmp (png_jmpbuf (png), 1);
+}
+
+static void png_warning_handler (png_structp png, png_const_charp message)
+{
+	(void) png;
+	(void) message;
+}
+
+image_t *decode_png (FILE *f)
+{
+	png_structp png;
+	png_infop info;
+	png_bytep *volatile rows = NULL;
+	uint8_t *volatile data = NULL;
+	image_t *image;
+	png_uint_32 width, height, y;
+	size_t rowbytes;
+	int channels, depth;
+
+	png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, png_error_handler, png_warning_handler);
+	if (png == NULL)
+		return NULL;
+	info = png_create_info_struct (png);
+	if (info == NULL || setjmp (png_jmpbuf (png)))
+	{
+		png_destroy_read_struct (&png, &info, NULL);
+		free (rows);
+		free (data);
+		return NULL;
+	}
+
+	png_init_io (png, f);
+	png_read_info (png, info);
+
+	/* palettes, low bit depths and transparency chunks are expanded, gray
+	 * images stay single channel until the conversion to float */
+	png_set_expand (png);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (png_get_bit_depth (png, info) == 16)
+		png_set_swap (png);
+#endif
+	png_set_interlace_handling (png);
+	png_read_update_info (png, info);
+
+	width = png_get_image_width (png, info);
+	height = png_get_image_height (png, info);
+	channels = png_get_channels (png, info);
+	depth = png_get_bit_depth (png, info);
+	rowbytes = png_get_rowbytes (png, info);
+
+	data = (uint8_t*) malloc (rowbytes * height);
+	rows = (png_bytep*) malloc (height * sizeof (png_bytep));
+	if (data == NULL || rows == NULL)
+		png_error (png, "out of memory");
+	for (y = 0; y < height; y++)
+		rows[y] = data + y * rowbytes;
+
+	png_read_image (png, rows);
+	png_read_end (png, NULL);
+	png_destroy_read_struct (&png, &info, NULL);
+
+	image = convert_image (data, width, height, rowbytes, channels, depth);
+	free (rows);
+	free (data);
+	return image;
+}
+
+#else
+
+image_t *decode_png (FILE *f)
+{
+	return NULL;
+}
+
+#endif /* HAVE_PNG */
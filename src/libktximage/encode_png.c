@@ -0,0 +1,156 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PNG
+
+#include <png.h>
+#include <setjmp.h>
+
+struct png_writer {
+	png_structp png;
+	png_infop info;
+	FILE *f;
+	size_t width;
+	int depth;
+	int failed;
+};
+
+static void png_error_handler (png_structp png, png_const_charp message)
+{
+	fprintf (stderr, "Cannot write PNG: %s\n", message);
+	longjmp (png_jmpbuf (png), 1);
+}
+
+static void png_warning_handler (png_structp png, png_const_charp message)
+{
+	(void) png;
+	(void) message;
+}
+
+int png_writer_available (void)
+{
+	return 1;
+}
+
+png_writer_t *png_writer_open (const char *filename, size_t width, size_t height, int depth)
+{
+	png_writer_t *writer = (png_writer_t*) calloc (1, sizeof (png_writer_t));
+	if (writer == NULL)
+		return NULL;
+	writer->width = width;
+	writer->depth = depth;
+
+	if (!strcmp (filename, "-"))
+		writer->f = stdout;
+	else
+		writer->f = fopen (filename, "wb");
+	if (writer->f == NULL)
+	{
+		fprintf (stderr, "Cannot open %s.\n", filename);
+		free (writer);
+		return NULL;
+	}
+
+	writer->png = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, png_error_handler, png_warning_handler);
+	if (writer->png != NULL)
+		writer->info = png_create_info_struct (writer->png);
+	if (writer->info == NULL || setjmp (png_jmpbuf (writer->png)))
+	{
+		writer->failed = 1;
+		png_writer_close (writer);
+		return NULL;
+	}
+
+	png_init_io (writer->png, writer->f);
+	png_set_IHDR (writer->png, writer->info, width, height, depth, PNG_COLOR_TYPE_RGBA,
+			PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info (writer->png, writer->info);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (depth == 16)
+		png_set_swap (writer->png);
+#endif
+	return writer;
+}
+
+int png_writer_write (png_writer_t *writer, const void *rows, size_t count, size_t stride)
+{
+	size_t y;
+	if (writer->failed)
+		return 0;
+	if (setjmp (png_jmpbuf (writer->png)))
+	{
+		writer->failed = 1;
+		return 0;
+	}
+	for (y = 0; y < count; y++)
+		png_write_row (writer->png, (png_const_bytep) rows + y * stride);
+	return 1;
+}
+
+int png_writer_close (png_writer_t *writer)
+{
+	int result = !writer->failed;
+
+	if (result && !setjmp (png_jmpbuf (writer->png)))
+		png_write_end (writer->png, NULL);
+	else
+		result = 0;
+	png_destroy_write_struct (&writer->png, &writer->info);
+
+	if (writer->f == stdout)
+	{
+		if (fflush (stdout))
+			result = 0;
+	}
+	else if (fclose (writer->f))
+		result = 0;
+	if (!result)
+		fprintf (stderr, "Could not write image.\n");
+	free (writer);
+	return result;
+}
+
+#else
+
+int png_writer_available (void)
+{
+	return 0;
+}
+
+png_writer_t *png_writer_open (const char *filename, size_t width, size_t height, int depth)
+{
+	fprintf (stderr, "PNG output is not supported.\n");
+	return NULL;
+}
+
+int png_writer_write (png_writer_t *writer, const void *rows, size_t count, size_t stride)
+{
+	return 0;
+}
+
+int png_writer_close (png_writer_t *writer)
+{
+	return 0;
+}
+
+#endif /* HAVE_PNG */
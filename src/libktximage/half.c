@@ -0,0 +1,148 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "half.h"
+#include <string.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#include <immintrin.h>
+#define HAVE_F16C_PATH 1
+#endif
+
+static uint16_t float_to_half_scalar (float value)
+{
+	uint32_t f, h, rem;
+	uint16_t sign;
+
+	memcpy (&f, &value, sizeof (uint32_t));
+	sign = (f >> 16) & 0x8000;
+	f &= 0x7FFFFFFF;
+
+	/* infinity and NaN, which stays quiet */
+	if (f >= 0x7F800000)
+		return sign | 0x7C00 | ((f > 0x7F800000) ? 0x200 | ((f >> 13) & 0x3FF) : 0);
+	/* 65520 and above round to infinity */
+	if (f >= 0x477FF000)
+		return sign | 0x7C00;
+	/* below 2^-14 the result is denormal, at most 2^-25 rounds to zero */
+	if (f < 0x38800000)
+	{
+		uint32_t mantissa = (f & 0x7FFFFF) | 0x800000;
+		int shift;
+		if (f <= 0x33000000)
+			return sign;
+		shift = 126 - (int) (f >> 23);
+		h = mantissa >> shift;
+		rem = mantissa & ((1u << shift) - 1);
+		if (rem > (1u << (shift - 1)) || (rem == (1u << (shift - 1)) && (h & 1)))
+			h++;
+		return sign | h;
+	}
+	/* rebias the exponent; a carry out of the mantissa correctly increments
+	 * the exponent */
+	h = (f - 0x38000000) >> 13;
+	rem = f & 0x1FFF;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++;
+	return sign | h;
+}
+
+static float half_to_float_scalar (uint16_t h)
+{
+	uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1F, mantissa = h & 0x3FF, f;
+	float value;
+
+	/* NaNs are made quiet, as by F16C */
+	if (exponent == 0x1F)
+		f = sign | 0x7F800000 | (mantissa ? 0x400000 : 0) | (mantissa << 13);
+	else if (exponent != 0)
+		f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	else if (mantissa == 0)
+		f = sign;
+	else
+	{
+		/* denormals become normal floats */
+		exponent = 113;
+		while (!(mantissa & 0x400))
+		{
+			mantissa <<= 1;
+			exponent--;
+		}
+		f = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+	}
+	memcpy (&value, &f, sizeof (float));
+	return value;
+}
+
+#ifdef HAVE_F16C_PATH
+
+__attribute__ ((target ("avx,f16c")))
+static void float_to_half_f16c (const float *src, uint16_t *dst, size_t count)
+{
+	size_t i;
+	for (i = 0; i + 8 <= count; i += 8)
+		_mm_storeu_si128 ((__m128i*) &dst[i], _mm256_cvtps_ph (_mm256_loadu_ps (&src[i]), _MM_FROUND_TO_NEAREST_INT));
+	for (; i < count; i++)
+		dst[i] = float_to_half_scalar (src[i]);
+}
+
+__attribute__ ((target ("avx,f16c")))
+static void half_to_float_f16c (const uint16_t *src, float *dst, size_t count)
+{
+	size_t i;
+	for (i = 0; i + 8 <= count; i += 8)
+		_mm256_storeu_ps (&dst[i], _mm256_cvtph_ps (_mm_loadu_si128 ((const __m128i*) &src[i])));
+	for (; i < count; i++)
+		dst[i] = half_to_float_scalar (src[i]);
+}
+
+static int have_f16c (void)
+{
+	return __builtin_cpu_supports ("avx") && __builtin_cpu_supports ("f16c");
+}
+
+#endif /* HAVE_F16C_PATH */
+
+void float_to_half (const float *src, uint16_t *dst, size_t count)
+{
+	size_t i;
+#ifdef HAVE_F16C_PATH
+	if (count >= 8 && have_f16c ())
+	{
+		float_to_half_f16c (src, dst, count);
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++)
+		dst[i] = float_to_half_scalar (src[i]);
+}
+
+void half_to_float (const uint16_t *src, float *dst, size_t count)
+{
+	size_t i;
+#ifdef HAVE_F16C_PATH
+	if (count >= 8 && have_f16c ())
+	{
+		half_to_float_f16c (src, dst, count);
+		return;
+	}
+#endif
+	for (i = 0; i < count; i++)
+		dst[i] = half_to_float_scalar (src[i]);
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image.h"
+#include "decode.h"
+#include "ktxfile.h"
+#define MAGICKCORE_QUANTUM_DEPTH 32
+#define MAGICKCORE_HDRI_ENABLE 1
+#include <MagickWand/MagickWand.h>
+#include <stdlib.h>
+#include <string.h>
+
+void WandException (MagickWand *wand)
+{
+	char *desc;
+	ExceptionType type;
+	desc = MagickGetException (wand, &type);
+	fprintf(stderr,"%s %s %lu %s\n", GetMagickModule (), desc);
+	MagickRelinquishMemory (desc);
+}
+
+float defaultalpha = 1.0f;
+
+void image_init (void)
+{
+	import_init ();
+	MagickWandGenesis ();
+}
+
+void image_terminate (void)
+{
+	MagickWandTerminus ();
+}
+
+/* exports the pixels of an image read into the wand and destroys it */
+static image_t *export_image (MagickWand *wand, MagickBooleanType status)
+{
+	if (status != MagickTrue)
+	{
+		WandException (wand);
+		DestroyMagickWand (wand);
+		return NULL;
+	}
+
+	image_t *image = (image_t*) malloc (sizeof (image_t));
+
+	image->width = MagickGetImageWidth (wand);
+	image->height = MagickGetImageHeight (wand);
+
+	image->data = (float*) malloc (image->width * image->height * 4 * sizeof (float));
+
+	status = MagickExportImagePixels (wand, 0, 0, image->width, image->height, "RGBA", FloatPixel, image->data);
+
+	if (status != MagickTrue)
+	{
+		free (image->data);
+		free (image);
+		WandException (wand);
+		DestroyMagickWand (wand);
+		return NULL;
+	}
+
+	import_image (image, MagickGetImageAlphaChannel (wand) != MagickFalse);
+
+	DestroyMagickWand (wand);
+
+	return image;
+}
+
+/* reads all of stdin, which need not be seekable */
+static image_t *load_stdin_image (void)
+{
+	size_t size;
+	uint8_t *data = ktx_read_stream (stdin, &size);
+	image_t *image;
+
+	if (data == NULL)
+	{
+		fprintf (stderr, "Cannot read image from stdin.\n");
+		return NULL;
+	}
+
+	image = load_image_memory (data, size);
+	free (data);
+	return image;
+}
+
+image_t *load_image (const char *filename)
+{
+	MagickWand *wand;
+	image_t *native;
+
+	if (!strcmp (filename, "-"))
+		return load_stdin_image ();
+
+	native = load_native_image (filename);
+	if (native != NULL)
+		return native;
+
+	wand = NewMagickWand ();
+	return export_image (wand, MagickReadImage (wand, filename));
+}
+
+image_t *load_image_memory (const void *data, size_t size)
+{
+	MagickWand *wand;
+	image_t *native;
+
+	native = load_native_image_memory (data, size);
+	if (native != NULL)
+		return native;
+
+	wand = NewMagickWand ();
+	return export_image (wand, MagickReadImageBlob (wand, data, size));
+}
+
+/* without a file name to derive the format from, stdout gets PNG */
+static int write_stdout_image (MagickWand *wand)
+{
+	unsigned char *blob;
+	size_t size = 0;
+
+	if (MagickSetImageFormat (wand, "PNG") != MagickTrue
+			|| (blob = MagickGetImageBlob (wand, &size)) == NULL)
+	{
+		WandException (wand);
+		return 0;
+	}
+	if (fwrite (blob, 1, size, stdout) != size || fflush (stdout))
+	{
+		fprintf (stderr, "Could not write image.\n");
+		MagickRelinquishMemory (blob);
+		return 0;
+	}
+	MagickRelinquishMemory (blob);
+	return 1;
+}
+
+int save_image (const image_t *image, const char *filename)
+{
+	MagickWand *wand = NewMagickWand ();
+	PixelWand *color = NewPixelWand ();
+	int result;
+
+	PixelSetColor (color, "black");
+	if (MagickNewImage (wand, image->width, image->height, color) != MagickTrue
+			|| MagickImportImagePixels (wand, 0, 0, image->width, image->height, "RGBA", FloatPixel, image->data) != MagickTrue)
+	{
+		WandException (wand);
+		result = 0;
+	}
+	else if (!strcmp (filename, "-"))
+		result = write_stdout_image (wand);
+	else if (MagickWriteImage (wand, filename) != MagickTrue)
+	{
+		WandException (wand);
+		result = 0;
+	}
+	else
+		result = 1;
+
+	DestroyPixelWand (color);
+	DestroyMagickWand (wand);
+	return result;
+}
+
+image_t *create_image (size_t width, size_t height)
+{
+	image_t *image = (image_t*) malloc (sizeof (image_t));
+	if (image == NULL)
+		return NULL;
+	image->width = width;
+	image->height = height;
+	image->data = (float*) malloc (width * height * 4 * sizeof (float));
+	if (image->data == NULL)
+	{
+		free (image);
+		return NULL;
+	}
+	return image;
+}
+
+void free_image (image_t *image)
+{
+	if (image) {
+		free (image->data);
+		free (image);
+	}
+}
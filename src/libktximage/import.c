@@ -0,0 +1,143 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "image.h"
+#include "tasks.h"
+#include <math.h>
+
+#define IMPORT_BAND_HEIGHT 16
+#define IMPORT_TABLE_SIZE 4096
+
+import_settings_t import_settings = { IMPORT_COLORSPACE_KEEP, 0, { 0, 1, 2, 3 } };
+
+/* sRGB transfer functions sampled at IMPORT_TABLE_SIZE + 1 points, plus
+ * exact values for 8 bit inputs */
+static float linearize_table[IMPORT_TABLE_SIZE + 1];
+static float encode_table[IMPORT_TABLE_SIZE + 1];
+static float byte_table[256];
+
+static float srgb_to_linear (float v)
+{
+	return (v <= 0.04045f) ? v / 12.92f : powf ((v + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linear_to_srgb (float v)
+{
+	return (v <= 0.0031308f) ? v * 12.92f : 1.055f * powf (v, 1.0f / 2.4f) - 0.055f;
+}
+
+static float transfer_lookup (const float *table, float v, float (*exact) (float))
+{
+	float x;
+	int i;
+	if (v < 0.0f || v > 1.0f)
+		return (v < 0.0f) ? -exact (-v) : exact (v);
+	x = v * IMPORT_TABLE_SIZE;
+	i = (int) x;
+	if (i >= IMPORT_TABLE_SIZE)
+		return table[IMPORT_TABLE_SIZE];
+	return table[i] + (table[i + 1] - table[i]) * (x - i);
+}
+
+void import_init (void)
+{
+	int i;
+	for (i = 0; i <= IMPORT_TABLE_SIZE; i++)
+	{
+		linearize_table[i] = srgb_to_linear ((float) i / IMPORT_TABLE_SIZE);
+		encode_table[i] = linear_to_srgb ((float) i / IMPORT_TABLE_SIZE);
+	}
+	for (i = 0; i < 256; i++)
+		byte_table[i] = (import_settings.colorspace == IMPORT_COLORSPACE_LINEARIZE)
+				? srgb_to_linear (i / 255.0f) : i / 255.0f;
+}
+
+const float *import_byte_table (void)
+{
+	return byte_table;
+}
+
+void import_row (float *row, size_t count, int has_alpha, int convert_colorspace)
+{
+	const import_settings_t *s = &import_settings;
+	int swizzle = (s->swizzle[0] != 0 || s->swizzle[1] != 1 || s->swizzle[2] != 2 || s->swizzle[3] != 3);
+	size_t i;
+	int c;
+
+	for (i = 0; i < count; i++)
+	{
+		float *p = &row[i * 4];
+
+		if (!has_alpha)
+			p[3] = defaultalpha;
+
+		if (convert_colorspace && s->colorspace == IMPORT_COLORSPACE_LINEARIZE)
+		{
+			for (c = 0; c < 3; c++)
+				p[c] = transfer_lookup (linearize_table, p[c], srgb_to_linear);
+		}
+
+		if (s->premultiply)
+		{
+			p[0] *= p[3];
+			p[1] *= p[3];
+			p[2] *= p[3];
+		}
+
+		if (s->colorspace == IMPORT_COLORSPACE_ENCODE)
+		{
+			for (c = 0; c < 3; c++)
+				p[c] = transfer_lookup (encode_table, p[c], linear_to_srgb);
+		}
+
+		if (swizzle)
+		{
+			float v[6];
+			v[0] = p[0]; v[1] = p[1]; v[2] = p[2]; v[3] = p[3];
+			v[IMPORT_SWIZZLE_ZERO] = 0.0f;
+			v[IMPORT_SWIZZLE_ONE] = 1.0f;
+			for (c = 0; c < 4; c++)
+				p[c] = v[s->swizzle[c]];
+		}
+	}
+}
+
+typedef struct import_state {
+	image_t *image;
+	int has_alpha;
+} import_state_t;
+
+static void import_band (size_t band, void *arg)
+{
+	const import_state_t *state = (const import_state_t*) arg;
+	image_t *image = state->image;
+	size_t y, yend = (band + 1) * IMPORT_BAND_HEIGHT;
+
+	if (yend > image->height)
+		yend = image->height;
+	for (y = band * IMPORT_BAND_HEIGHT; y < yend; y++)
+		import_row (&image->data[y * image->width * 4], image->width, state->has_alpha, 1);
+}
+
+void import_image (image_t *image, int has_alpha)
+{
+	import_state_t state;
+	state.image = image;
+	state.has_alpha = has_alpha;
+	parallel_for ((image->height + IMPORT_BAND_HEIGHT - 1) / IMPORT_BAND_HEIGHT, import_band, &state);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image.h"
+#include "tasks.h"
+
+#define MIPMAP_BAND_HEIGHT 16
+
+typedef struct downsample_state {
+	const image_t *src;
+	image_t *dst;
+} downsample_state_t;
+
+static void downsample_band (size_t band, void *arg)
+{
+	const downsample_state_t *state = (const downsample_state_t*) arg;
+	const image_t *src = state->src;
+	image_t *dst = state->dst;
+	size_t x, y, c;
+	size_t yend = (band + 1) * MIPMAP_BAND_HEIGHT;
+
+	if (yend > dst->height)
+		yend = dst->height;
+
+	for (y = band * MIPMAP_BAND_HEIGHT; y < yend; y++)
+	{
+		const float *row0 = &src->data[(2 * y) * src->width * 4];
+		const float *row1 = (2 * y + 1 < src->height) ? row0 + src->width * 4 : row0;
+		float *out = &dst->data[y * dst->width * 4];
+		for (x = 0; x < dst->width; x++)
+		{
+			size_t x0 = 2 * x * 4;
+			size_t x1 = (2 * x + 1 < src->width) ? x0 + 4 : x0;
+			for (c = 0; c < 4; c++)
+				out[x * 4 + c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+		}
+	}
+}
+
+image_t *downsample_image (const image_t *image)
+{
+	downsample_state_t state;
+	size_t width = (image->width > 1) ? image->width >> 1 : 1;
+	size_t height = (image->height > 1) ? image->height >> 1 : 1;
+
+	state.src = image;
+	state.dst = create_image (width, height);
+	if (state.dst == NULL)
+		return NULL;
+
+	parallel_for ((height + MIPMAP_BAND_HEIGHT - 1) / MIPMAP_BAND_HEIGHT, downsample_band, &state);
+	return state.dst;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "image.h"
+#include "tasks.h"
+#include <math.h>
+
+#define NORMALMAP_BAND_HEIGHT 16
+
+typedef struct normalmap_state {
+	image_t *image;
+	image_t *dst;
+	image_t *variance;
+	int snorm;
+} normalmap_state_t;
+
+static size_t band_size (const image_t *image, size_t band, size_t *begin)
+{
+	size_t end = (band + 1) * NORMALMAP_BAND_HEIGHT;
+	if (end > image->height)
+		end = image->height;
+	*begin = band * NORMALMAP_BAND_HEIGHT * image->width;
+	return end * image->width;
+}
+
+static void decode_band (size_t band, void *arg)
+{
+	normalmap_state_t *state = (normalmap_state_t*) arg;
+	float *data = state->image->data;
+	size_t i, end = band_size (state->image, band, &i);
+
+	for (; i < end; i++)
+	{
+		float x = data[i * 4 + 0] * 2.0f - 1.0f;
+		float y = data[i * 4 + 1] * 2.0f - 1.0f;
+		float z = data[i * 4 + 2] * 2.0f - 1.0f;
+		float len = sqrtf (x * x + y * y + z * z);
+		float scale = (len > 0.0f) ? 1.0f / len : 0.0f;
+		data[i * 4 + 0] = x * scale;
+		data[i * 4 + 1] = y * scale;
+		data[i * 4 + 2] = (len > 0.0f) ? z * scale : 1.0f;
+		data[i * 4 + 3] = 1.0f;
+	}
+}
+
+static void encode_band (size_t band, void *arg)
+{
+	normalmap_state_t *state = (normalmap_state_t*) arg;
+	const float *src = state->image->data;
+	float *dst = state->dst->data;
+	float *variance = (state->variance != NULL) ? state->variance->data : NULL;
+	float bias = state->snorm ? 0.0f : 0.5f;
+	float factor = state->snorm ? 1.0f : 0.5f;
+	size_t i, end = band_size (state->image, band, &i);
+
+	for (; i < end; i++)
+	{
+		float x = src[i * 4 + 0], y = src[i * 4 + 1], z = src[i * 4 + 2];
+		float len = sqrtf (x * x + y * y + z * z);
+		float scale = (len > 0.0f) ? 1.0f / len : 0.0f;
+
+		dst[i * 4 + 0] = x * scale * factor + bias;
+		dst[i * 4 + 1] = y * scale * factor + bias;
+		dst[i * 4 + 2] = 0.0f;
+		dst[i * 4 + 3] = 1.0f;
+
+		if (variance != NULL)
+		{
+			/* a von Mises-Fisher lobe fitted to the length of the average */
+			float kappa, v = 0.0f;
+			if (len < 0.0001f) len = 0.0001f;
+			if (len < 0.9999f)
+			{
+				kappa = (3.0f * len - len * len * len) / (1.0f - len * len);
+				v = 0.5f / kappa;
+			}
+			variance[i * 4 + 0] = v;
+			variance[i * 4 + 1] = v;
+			variance[i * 4 + 2] = v;
+			variance[i * 4 + 3] = 1.0f;
+		}
+	}
+}
+
+void decode_normals (image_t *image)
+{
+	normalmap_state_t state;
+	state.image = image;
+	parallel_for ((image->height + NORMALMAP_BAND_HEIGHT - 1) / NORMALMAP_BAND_HEIGHT, decode_band, &state);
+}
+
+void encode_normals (const image_t *image, image_t *dst, image_t *variance, int snorm)
+{
+	normalmap_state_t state;
+	state.image = (image_t*) image;
+	state.dst = dst;
+	state.variance = variance;
+	state.snorm = snorm;
+	parallel_for ((image->height + NORMALMAP_BAND_HEIGHT - 1) / NORMALMAP_BAND_HEIGHT, encode_band, &state);
+}
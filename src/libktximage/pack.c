@@ -0,0 +1,410 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pack.h"
+#include "half.h"
+#include "tasks.h"
+#include <stdint.h>
+#include <string.h>
+
+static int format_components (GLenum format, int *swizzle)
+{
+	switch (format)
+	{
+	case GL_RED:
+		swizzle[0] = 0;
+		return 1;
+	case GL_RG:
+		swizzle[0] = 0; swizzle[1] = 1;
+		return 2;
+	case GL_RGB:
+		swizzle[0] = 0; swizzle[1] = 1; swizzle[2] = 2;
+		return 3;
+	case GL_BGR:
+		swizzle[0] = 2; swizzle[1] = 1; swizzle[2] = 0;
+		return 3;
+	case GL_RGBA:
+		swizzle[0] = 0; swizzle[1] = 1; swizzle[2] = 2; swizzle[3] = 3;
+		return 4;
+	case GL_BGRA:
+		swizzle[0] = 2; swizzle[1] = 1; swizzle[2] = 0; swizzle[3] = 3;
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+/* number of pixels converted to or from half floats at once */
+#define HALF_CHUNK 256
+
+/* number of rows packed by a single task */
+#define PACK_BAND_HEIGHT 32
+
+static float clamp_unorm (float v)
+{
+	return (v < 0.0f) ? 0.0f : ((v > 1.0f) ? 1.0f : v);
+}
+
+/* the encoders below avoid branches, so that the pixel loops calling them
+ * can be vectorized */
+
+static uint32_t float_bits (float value)
+{
+	uint32_t f;
+	memcpy (&f, &value, sizeof (uint32_t));
+	return f;
+}
+
+static float bits_float (uint32_t f)
+{
+	float value;
+	memcpy (&value, &f, sizeof (float));
+	return value;
+}
+
+/* converts to an unsigned float with a 5 bit exponent and the given number
+ * of mantissa bits, rounding to the nearest even value; as required by
+ * OpenGL, negative values become zero, finite values too large to be
+ * represented become the largest finite value and NaNs become positive */
+static uint32_t float_to_ufloat (float value, uint32_t bits)
+{
+	uint32_t f = float_bits (value);
+	uint32_t shift = 23 - bits;
+	uint32_t max_finite = (0x1E << bits) | ((1u << bits) - 1);
+	uint32_t denormal, normal, result;
+
+	/* below 2^-14 the float addition rounds to the denormal mantissa */
+	denormal = float_bits (value * bits_float ((127 + 14 + bits) << 23) + 8388608.0f) & 0x7FFFFF;
+	normal = ((f + (1u << (shift - 1)) - 1 + ((f >> shift) & 1)) >> shift) - (112u << bits);
+
+	result = (f < 0x38800000) ? denormal : normal;
+	result = (result > max_finite) ? max_finite : result;
+	result = (f == 0x7F800000) ? (0x1Fu << bits) : result;
+	result = (f & 0x80000000) ? 0 : result;
+	result = ((f & 0x7FFFFFFF) > 0x7F800000) ? ((0x1Fu << bits) | (1u << (bits - 1))) : result;
+	return result;
+}
+
+static float ufloat_to_float (uint32_t value, uint32_t bits)
+{
+	uint32_t exponent = value >> bits, mantissa = value & ((1u << bits) - 1);
+	if (exponent == 0)
+		return mantissa * bits_float ((127 - 14 - bits) << 23);
+	if (exponent == 0x1F)
+		return bits_float (0x7F800000 | (mantissa << (23 - bits)));
+	return bits_float (((exponent + 112) << 23) | (mantissa << (23 - bits)));
+}
+
+static uint32_t pack_r11f_g11f_b10f (const float *rgba)
+{
+	return float_to_ufloat (rgba[0], 6) | (float_to_ufloat (rgba[1], 6) << 11) | (float_to_ufloat (rgba[2], 5) << 22);
+}
+
+static float clamp_rgb9e5 (float v)
+{
+	/* the largest representable value is 511 / 512 * 2^16; NaN becomes 0 */
+	return (v > 0.0f) ? ((v < 65408.0f) ? v : 65408.0f) : 0.0f;
+}
+
+/* floor (v + 0.5) without the rounding of the float addition */
+static uint32_t round_half_up (float v)
+{
+	uint32_t t = (uint32_t) v;
+	return t + (v - (float) t >= 0.5f);
+}
+
+/* computes the shared exponent as specified by EXT_texture_shared_exponent
+ * and rounds the components to 9 bit mantissas */
+static uint32_t pack_rgb9_e5 (const float *rgba)
+{
+	float r = clamp_rgb9e5 (rgba[0]), g = clamp_rgb9e5 (rgba[1]), b = clamp_rgb9e5 (rgba[2]);
+	float maxc = (r > g) ? ((r > b) ? r : b) : ((g > b) ? g : b);
+	int32_t exponent = (int32_t) (float_bits (maxc) >> 23) - 127;
+	float scale;
+
+	/* the exponent of the largest component, at least -16, plus the bias
+	 * of 15 and 1 */
+	exponent = ((exponent < -16) ? -16 : exponent) + 16;
+	/* rounding the largest component may overflow its mantissa */
+	scale = bits_float ((127 + 24 - exponent) << 23);
+	exponent += (round_half_up (maxc * scale) == 512);
+	scale = bits_float ((127 + 24 - exponent) << 23);
+
+	return round_half_up (r * scale) | (round_half_up (g * scale) << 9)
+			| (round_half_up (b * scale) << 18) | ((uint32_t) exponent << 27);
+}
+
+static void unpack_rgb9_e5 (uint32_t value, float *rgba)
+{
+	float scale = bits_float ((127 + (value >> 27) - 24) << 23);
+	rgba[0] = (value & 0x1FF) * scale;
+	rgba[1] = ((value >> 9) & 0x1FF) * scale;
+	rgba[2] = ((value >> 18) & 0x1FF) * scale;
+}
+
+int packed_float_type (GLenum type)
+{
+	return type == GL_UNSIGNED_INT_5_9_9_9_REV || type == GL_UNSIGNED_INT_10F_11F_11F_REV;
+}
+
+size_t packed_pixel_size (GLenum format, GLenum type)
+{
+	int swizzle[4];
+	int components = format_components (format, swizzle);
+	switch (type)
+	{
+	case GL_UNSIGNED_BYTE:
+		return components;
+	case GL_UNSIGNED_SHORT:
+	case GL_HALF_FLOAT:
+		return components * 2;
+	case GL_FLOAT:
+		return components * 4;
+	case GL_UNSIGNED_INT_5_9_9_9_REV:
+	case GL_UNSIGNED_INT_10F_11F_11F_REV:
+		return (format == GL_RGB) ? 4 : 0;
+	default:
+		return 0;
+	}
+}
+
+size_t packed_image_size (size_t width, size_t height, GLenum format, GLenum type)
+{
+	size_t rowsize = width * packed_pixel_size (format, type);
+	return ((rowsize + 3) & ~(size_t) 3) * height;
+}
+
+int pack_pixels (const float *src, size_t count, GLenum format, GLenum type, void *dst)
+{
+	int swizzle[4];
+	int components = format_components (format, swizzle);
+	size_t i;
+	int c;
+
+	if (components == 0)
+		return 0;
+
+	switch (type)
+	{
+	case GL_UNSIGNED_BYTE:
+	{
+		uint8_t *out = (uint8_t*) dst;
+		for (i = 0; i < count; i++)
+			for (c = 0; c < components; c++)
+				out[i * components + c] = (uint8_t) (clamp_unorm (src[i * 4 + swizzle[c]]) * 255.0f + 0.5f);
+		return 1;
+	}
+	case GL_UNSIGNED_SHORT:
+	{
+		uint16_t *out = (uint16_t*) dst;
+		for (i = 0; i < count; i++)
+			for (c = 0; c < components; c++)
+				out[i * components + c] = (uint16_t) (clamp_unorm (src[i * 4 + swizzle[c]]) * 65535.0f + 0.5f);
+		return 1;
+	}
+	case GL_HALF_FLOAT:
+	{
+		/* components are gathered into a small buffer, so that they can be
+		 * converted in bulk */
+		float buffer[HALF_CHUNK * 4];
+		uint16_t *out = (uint16_t*) dst;
+		size_t j, n;
+		if (format == GL_RGBA)
+		{
+			float_to_half (src, out, count * 4);
+			return 1;
+		}
+		for (i = 0; i < count; i += n)
+		{
+			n = (count - i < HALF_CHUNK) ? count - i : HALF_CHUNK;
+			for (j = 0; j < n; j++)
+				for (c = 0; c < components; c++)
+					buffer[j * components + c] = src[(i + j) * 4 + swizzle[c]];
+			float_to_half (buffer, &out[i * components], n * components);
+		}
+		return 1;
+	}
+	case GL_FLOAT:
+	{
+		float *out = (float*) dst;
+		for (i = 0; i < count; i++)
+			for (c = 0; c < components; c++)
+				out[i * components + c] = src[i * 4 + swizzle[c]];
+		return 1;
+	}
+	case GL_UNSIGNED_INT_5_9_9_9_REV:
+	{
+		uint32_t *out = (uint32_t*) dst;
+		if (format != GL_RGB)
+			return 0;
+		for (i = 0; i < count; i++)
+			out[i] = pack_rgb9_e5 (&src[i * 4]);
+		return 1;
+	}
+	case GL_UNSIGNED_INT_10F_11F_11F_REV:
+	{
+		uint32_t *out = (uint32_t*) dst;
+		if (format != GL_RGB)
+			return 0;
+		for (i = 0; i < count; i++)
+			out[i] = pack_r11f_g11f_b10f (&src[i * 4]);
+		return 1;
+	}
+	default:
+		return 0;
+	}
+}
+
+int unpack_pixels (const void *src, size_t count, GLenum format, GLenum type, float *dst)
+{
+	int swizzle[4];
+	int components = format_components (format, swizzle);
+	size_t i;
+	int c;
+
+	if (components == 0)
+		return 0;
+
+	for (i = 0; i < count; i++)
+	{
+		dst[i * 4 + 0] = 0.0f;
+		dst[i * 4 + 1] = 0.0f;
+		dst[i * 4 + 2] = 0.0f;
+		dst[i * 4 + 3] = 1.0f;
+	}
+
+	switch (type)
+	{
+	case GL_UNSIGNED_BYTE:
+	{
+		const uint8_t *in = (const uint8_t*) src;
+		for (i = 0; i < count; i++)
+			for (c = 0; c < components; c++)
+				dst[i * 4 + swizzle[c]] = in[i * components + c] * (1.0f / 255.0f);
+		return 1;
+	}
+	case GL_UNSIGNED_SHORT:
+	{
+		const uint16_t *in = (const uint16_t*) src;
+		for (i = 0; i < count; i++)
+			for (c = 0; c < components; c++)
+				dst[i * 4 + swizzle[c]] = in[i * components + c] * (1.0f / 65535.0f);
+		return 1;
+	}
+	case GL_HALF_FLOAT:
+	{
+		float buffer[HALF_CHUNK * 4];
+		const uint16_t *in = (const uint16_t*) src;
+		size_t j, n;
+		if (format == GL_RGBA)
+		{
+			half_to_float (in, dst, count * 4);
+			return 1;
+		}
+		for (i = 0; i < count; i += n)
+		{
+			n = (count - i < HALF_CHUNK) ? count - i : HALF_CHUNK;
+			half_to_float (&in[i * components], buffer, n * components);
+			for (j = 0; j < n; j++)
+				for (c = 0; c < components; c++)
+					dst[(i + j) * 4 + swizzle[c]] = buffer[j * components + c];
+		}
+		return 1;
+	}
+	case GL_FLOAT:
+	{
+		const float *in = (const float*) src;
+		for (i = 0; i < count; i++)
+			for (c = 0; c < components; c++)
+				dst[i * 4 + swizzle[c]] = in[i * components + c];
+		return 1;
+	}
+	case GL_UNSIGNED_INT_5_9_9_9_REV:
+	{
+		const uint32_t *in = (const uint32_t*) src;
+		if (format != GL_RGB)
+			return 0;
+		for (i = 0; i < count; i++)
+			unpack_rgb9_e5 (in[i], &dst[i * 4]);
+		return 1;
+	}
+	case GL_UNSIGNED_INT_10F_11F_11F_REV:
+	{
+		const uint32_t *in = (const uint32_t*) src;
+		if (format != GL_RGB)
+			return 0;
+		for (i = 0; i < count; i++)
+		{
+			dst[i * 4 + 0] = ufloat_to_float (in[i] & 0x7FF, 6);
+			dst[i * 4 + 1] = ufloat_to_float ((in[i] >> 11) & 0x7FF, 6);
+			dst[i * 4 + 2] = ufloat_to_float (in[i] >> 22, 5);
+		}
+		return 1;
+	}
+	default:
+		return 0;
+	}
+}
+
+typedef struct pack_state {
+	const image_t *image;
+	GLenum format;
+	GLenum type;
+	size_t rowsize;
+	size_t stride;
+	uint8_t *dst;
+} pack_state_t;
+
+static void pack_band (size_t band, void *arg)
+{
+	pack_state_t *state = (pack_state_t*) arg;
+	const image_t *image = state->image;
+	size_t y = band * PACK_BAND_HEIGHT;
+	size_t end = (y + PACK_BAND_HEIGHT > image->height) ? image->height : y + PACK_BAND_HEIGHT;
+	uint8_t *out = state->dst + y * state->stride;
+
+	for (; y < end; y++)
+	{
+		pack_pixels (&image->data[y * image->width * 4], image->width, state->format, state->type, out);
+		memset (out + state->rowsize, 0, state->stride - state->rowsize);
+		out += state->stride;
+	}
+}
+
+/* bands of rows are packed in parallel, which also spreads the work of
+ * images packed from within other parallel loops over idle threads */
+int pack_image (const image_t *image, GLenum format, GLenum type, void *dst)
+{
+	pack_state_t state;
+	size_t size = packed_pixel_size (format, type);
+
+	/* pack_pixels fails exactly for the combinations without a size */
+	if (size == 0)
+		return 0;
+
+	state.image = image;
+	state.format = format;
+	state.type = type;
+	state.rowsize = image->width * size;
+	state.stride = (state.rowsize + 3) & ~(size_t) 3;
+	state.dst = (uint8_t*) dst;
+
+	parallel_for ((image->height + PACK_BAND_HEIGHT - 1) / PACK_BAND_HEIGHT, pack_band, &state);
+	return 1;
+}
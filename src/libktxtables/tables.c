@@ -31,6 +31,7 @@ table_entry_t type_table[] = {
 		TABLE_ENTRY (GL_UNSIGNED_INT),
 		TABLE_ENTRY (GL_INT),
 		TABLE_ENTRY (GL_FLOAT),
+		TABLE_ENTRY (GL_HALF_FLOAT),
 		TABLE_ENTRY (GL_UNSIGNED_BYTE_3_3_2),
 		TABLE_ENTRY (GL_UNSIGNED_BYTE_2_3_3_REV),
 		TABLE_ENTRY (GL_UNSIGNED_SHORT_5_6_5),
@@ -43,6 +44,8 @@ table_entry_t type_table[] = {
 		TABLE_ENTRY (GL_UNSIGNED_INT_8_8_8_8_REV),
 		TABLE_ENTRY (GL_UNSIGNED_INT_10_10_10_2),
 		TABLE_ENTRY (GL_UNSIGNED_INT_2_10_10_10_REV),
+		TABLE_ENTRY (GL_UNSIGNED_INT_5_9_9_9_REV),
+		TABLE_ENTRY (GL_UNSIGNED_INT_10F_11F_11F_REV),
 		{ NULL, 0 }
 };
 
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "keyvalue.h"
+#include "ktxfile.h"
+#include <stdlib.h>
+#include <string.h>
+
+static keyvaluedata_t *keyvalue_create (const char *key, const void *value, uint32_t valuelen)
+{
+	uint32_t keylen = strlen (key);
+	keyvaluedata_t *data = (keyvaluedata_t*) malloc (sizeof (keyvaluedata_t) + keylen + 1 + valuelen);
+	if (data == NULL)
+		return NULL;
+	data->next = NULL;
+	data->len = keylen + 1 + valuelen;
+	memcpy (&data->data[0], key, keylen + 1);
+	memcpy (&data->data[keylen + 1], value, valuelen);
+	return data;
+}
+
+int keyvalue_add (keyvaluelist_t *list, const char *key, const void *value, uint32_t valuelen)
+{
+	keyvaluedata_t *data = keyvalue_create (key, value, valuelen);
+	if (data == NULL)
+		return 0;
+	if (list->first == NULL)
+		list->first = data;
+	else
+		list->last->next = data;
+	list->last = data;
+	return 1;
+}
+
+int keyvalue_set (keyvaluelist_t *list, const char *key, const void *value, uint32_t valuelen)
+{
+	keyvaluedata_t **entry;
+	for (entry = &list->first; *entry != NULL; entry = &(*entry)->next)
+	{
+		if (!strcmp ((*entry)->data, key))
+		{
+			keyvaluedata_t *data = keyvalue_create (key, value, valuelen);
+			if (data == NULL)
+				return 0;
+			data->next = (*entry)->next;
+			if (list->last == *entry)
+				list->last = data;
+			free (*entry);
+			*entry = data;
+			return 1;
+		}
+	}
+	return keyvalue_add (list, key, value, valuelen);
+}
+
+int keyvalue_remove (keyvaluelist_t *list, const char *key)
+{
+	keyvaluedata_t **entry, *prev = NULL;
+	for (entry = &list->first; *entry != NULL; prev = *entry, entry = &(*entry)->next)
+	{
+		if (!strcmp ((*entry)->data, key))
+		{
+			keyvaluedata_t *data = *entry;
+			*entry = data->next;
+			if (list->last == data)
+				list->last = prev;
+			free (data);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+keyvaluedata_t *keyvalue_find (const keyvaluelist_t *list, const char *key)
+{
+	keyvaluedata_t *data;
+	for (data = list->first; data != NULL; data = data->next)
+	{
+		if (!strcmp (data->data, key))
+			return data;
+	}
+	return NULL;
+}
+
+const char *keyvalue_value (const keyvaluedata_t *data, uint32_t *valuelen)
+{
+	uint32_t keylen = strlen (data->data);
+	if (valuelen != NULL)
+		*valuelen = data->len - keylen - 1;
+	return &data->data[keylen + 1];
+}
+
+void keyvalue_free (keyvaluelist_t *list)
+{
+	while (list->first != NULL)
+	{
+		keyvaluedata_t *data = list->first;
+		list->first = list->first->next;
+		free (data);
+	}
+	list->last = NULL;
+}
+
+uint32_t keyvalue_size (const keyvaluelist_t *list)
+{
+	uint32_t size = 0;
+	keyvaluedata_t *data;
+	for (data = list->first; data != NULL; data = data->next)
+		size += sizeof (uint32_t) + data->len + KTX_PADDING (data->len);
+	return size;
+}
+
+int keyvalue_parse (keyvaluelist_t *list, const void *buffer, uint32_t size)
+{
+	const char *ptr = (const char*) buffer;
+	uint32_t offset = 0;
+
+	while (offset + sizeof (uint32_t) <= size)
+	{
+		uint32_t len;
+		keyvaluedata_t *data;
+
+		memcpy (&len, ptr + offset, sizeof (uint32_t));
+		offset += sizeof (uint32_t);
+		if (len > size - offset || memchr (ptr + offset, 0, len) == NULL)
+			return 0;
+
+		data = (keyvaluedata_t*) malloc (sizeof (keyvaluedata_t) + len);
+		if (data == NULL)
+			return 0;
+		data->next = NULL;
+		data->len = len;
+		memcpy (&data->data[0], ptr + offset, len);
+		if (list->first == NULL)
+			list->first = data;
+		else
+			list->last->next = data;
+		list->last = data;
+
+		offset += len + KTX_PADDING (len);
+	}
+
+	return offset == size;
+}
+
+void keyvalue_serialize (const keyvaluelist_t *list, void *buffer)
+{
+	char *ptr = (char*) buffer;
+	keyvaluedata_t *data;
+	for (data = list->first; data != NULL; data = data->next)
+	{
+		memcpy (ptr, &data->len, sizeof (uint32_t) + data->len);
+		ptr += sizeof (uint32_t) + data->len;
+		memset (ptr, 0, KTX_PADDING (data->len));
+		ptr += KTX_PADDING (data->len);
+	}
+}
+
+int keyvalue_write (const keyvaluelist_t *list, FILE *f)
+{
+	keyvaluedata_t *data;
+	for (data = list->first; data != NULL; data = data->next)
+	{
+		unsigned int i;
+		if (fwrite (&data->len, 1, sizeof (uint32_t) + data->len, f) != sizeof (uint32_t) + data->len)
+			return 0;
+		for (i = 0; i < KTX_PADDING (data->len); i++)
+		{
+			if (fputc (0, f) == EOF)
+				return 0;
+		}
+	}
+	return 1;
+}
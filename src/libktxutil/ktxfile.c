@@ -0,0 +1,589 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "ktxfile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COPY_BUFFER_SIZE (1 << 20)
+
+uint32_t ktx_level_count (const ktx_header_t *header)
+{
+	return (header->numberOfMipmapLevels == 0) ? 1 : header->numberOfMipmapLevels;
+}
+
+off_t ktx_level_data_size (const ktx_header_t *header, uint32_t imageSize)
+{
+	/* imageSize refers to a single face for non-array cubemaps only */
+	if (header->numberOfFaces == 6 && header->numberOfArrayElements == 0)
+		return 6 * (off_t) (imageSize + KTX_PADDING (imageSize));
+	return imageSize + KTX_PADDING (imageSize);
+}
+
+uint32_t ktx_layer_count (const ktx_header_t *header)
+{
+	return (header->numberOfArrayElements == 0) ? 1 : header->numberOfArrayElements;
+}
+
+uint32_t ktx_slice_count (const ktx_header_t *header, uint32_t level)
+{
+	uint32_t slices = header->pixelDepth >> level;
+	return (slices == 0) ? 1 : slices;
+}
+
+const uint8_t *ktx_subimage (const ktx_header_t *header, const uint8_t *data, uint32_t imageSize,
+		uint32_t level, uint32_t layer, uint32_t face, uint32_t slice, uint32_t *size)
+{
+	uint32_t slices = ktx_slice_count (header, level);
+	if (header->numberOfFaces == 6 && header->numberOfArrayElements == 0)
+	{
+		*size = imageSize;
+		return data + face * (size_t) (imageSize + KTX_PADDING (imageSize));
+	}
+	/* array elements contain all faces, which contain all slices */
+	*size = imageSize / (ktx_layer_count (header) * header->numberOfFaces * slices);
+	return data + ((layer * header->numberOfFaces + face) * slices + slice) * (size_t) *size;
+}
+
+int ktx_read_image_size (int fd, off_t offset, uint32_t *imageSize)
+{
+	return pread (fd, imageSize, sizeof (uint32_t), offset) == sizeof (uint32_t);
+}
+
+int ktx_levels_reversed (const keyvaluelist_t *list)
+{
+	keyvaluedata_t *data = keyvalue_find (list, KTX_LEVEL_ORDER_KEY);
+	uint32_t len;
+	const char *value;
+	if (data == NULL)
+		return 0;
+	value = keyvalue_value (data, &len);
+	return len >= 7 && !memcmp (value, "reverse", 7) && (len == 7 || value[7] == 0);
+}
+
+int ktx_index_levels_fd (int fd, const ktx_header_t *header, int reversed, off_t *offsets, uint32_t *image_sizes)
+{
+	off_t offset = sizeof (ktx_header_t) + header->bytesOfKeyValueData;
+	uint32_t i, count = ktx_level_count (header);
+
+	for (i = 0; i < count; i++)
+	{
+		uint32_t level = reversed ? count - 1 - i : i;
+		uint32_t imageSize;
+		if (!ktx_read_image_size (fd, offset, &imageSize))
+			return 0;
+		offsets[level] = offset;
+		if (image_sizes != NULL)
+			image_sizes[level] = imageSize;
+		offset += sizeof (uint32_t) + ktx_level_data_size (header, imageSize);
+	}
+	return 1;
+}
+
+int ktx_map (const char *filename, ktx_mapping_t *mapping)
+{
+	struct stat st;
+	void *data;
+	int fd = open (filename, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	if (fstat (fd, &st))
+	{
+		close (fd);
+		return 0;
+	}
+	if (st.st_size < (off_t) sizeof (ktx_header_t))
+	{
+		close (fd);
+		errno = EINVAL;
+		return 0;
+	}
+
+	data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (data == MAP_FAILED)
+		return 0;
+
+	madvise (data, st.st_size, MADV_SEQUENTIAL);
+	madvise (data, st.st_size, MADV_WILLNEED);
+	mapping->data = (const uint8_t*) data;
+	mapping->size = st.st_size;
+	return 1;
+}
+
+void ktx_unmap (ktx_mapping_t *mapping)
+{
+	if (mapping->data != NULL)
+		munmap ((void*) mapping->data, mapping->size);
+	mapping->data = NULL;
+	mapping->size = 0;
+}
+
+const ktx_header_t *ktx_mapped_header (const ktx_mapping_t *mapping)
+{
+	const uint8_t ktx_magic[] = KTX_MAGIC;
+	if (mapping->data == NULL || mapping->size < sizeof (ktx_header_t)
+			|| memcmp (mapping->data, &ktx_magic[0], sizeof (ktx_magic)))
+		return NULL;
+	return (const ktx_header_t*) mapping->data;
+}
+
+int ktx_index_level_data (const ktx_header_t *header, int reversed, const uint8_t *data, size_t size, size_t *offsets)
+{
+	size_t offset = 0;
+	uint32_t i, count = ktx_level_count (header);
+
+	for (i = 0; i < count; i++)
+	{
+		uint32_t level = reversed ? count - 1 - i : i;
+		uint32_t imageSize;
+		if (size - offset < sizeof (uint32_t))
+			return 0;
+		memcpy (&imageSize, data + offset, sizeof (uint32_t));
+		offsets[level] = offset;
+		offset += sizeof (uint32_t);
+		if ((off_t) (size - offset) < ktx_level_data_size (header, imageSize))
+			return 0;
+		offset += ktx_level_data_size (header, imageSize);
+	}
+	return 1;
+}
+
+int ktx_index_levels (const ktx_mapping_t *mapping, size_t *offsets)
+{
+	const ktx_header_t *header = ktx_mapped_header (mapping);
+	keyvaluelist_t list = KEYVALUELIST_INIT;
+	size_t start;
+	uint32_t i;
+	int reversed;
+
+	if (header == NULL || header->bytesOfKeyValueData > mapping->size - sizeof (ktx_header_t))
+		return 0;
+
+	/* malformed key value data is tolerated, as it was before the level
+	 * order could be chosen */
+	keyvalue_parse (&list, mapping->data + sizeof (ktx_header_t), header->bytesOfKeyValueData);
+	reversed = ktx_levels_reversed (&list);
+	keyvalue_free (&list);
+
+	start = sizeof (ktx_header_t) + header->bytesOfKeyValueData;
+	if (!ktx_index_level_data (header, reversed, mapping->data + start, mapping->size - start, offsets))
+		return 0;
+	for (i = 0; i < ktx_level_count (header); i++)
+		offsets[i] += start;
+	return 1;
+}
+
+static int copy_data_fallback (int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t length)
+{
+	char *buffer = (char*) malloc (COPY_BUFFER_SIZE);
+	if (buffer == NULL)
+		return 0;
+
+	while (length > 0)
+	{
+		ssize_t n = pread (in_fd, buffer, (length < COPY_BUFFER_SIZE) ? length : COPY_BUFFER_SIZE, in_offset);
+		if (n <= 0)
+		{
+			if (n < 0 && errno == EINTR) continue;
+			free (buffer);
+			return 0;
+		}
+		ssize_t written = 0;
+		while (written < n)
+		{
+			ssize_t w = pwrite (out_fd, buffer + written, n - written, out_offset + written);
+			if (w < 0)
+			{
+				if (errno == EINTR) continue;
+				free (buffer);
+				return 0;
+			}
+			written += w;
+		}
+		in_offset += n;
+		out_offset += n;
+		length -= n;
+	}
+
+	free (buffer);
+	return 1;
+}
+
+uint8_t *ktx_read_stream (FILE *f, size_t *size)
+{
+	size_t capacity = 1 << 20;
+	uint8_t *data = (uint8_t*) malloc (capacity);
+
+	*size = 0;
+	while (data != NULL)
+	{
+		uint8_t *p;
+		*size += fread (data + *size, 1, capacity - *size, f);
+		if (*size < capacity)
+			break;
+		capacity *= 2;
+		p = (uint8_t*) realloc (data, capacity);
+		if (p == NULL)
+			free (data);
+		data = p;
+	}
+	if (data != NULL && ferror (f))
+	{
+		free (data);
+		return NULL;
+	}
+	return data;
+}
+
+int ktx_copy_data (int in_fd, off_t in_offset, int out_fd, off_t out_offset, off_t length)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+	while (length > 0)
+	{
+		loff_t in = in_offset, out = out_offset;
+		ssize_t n = copy_file_range (in_fd, &in, out_fd, &out, length, 0);
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			/* not supported between these files, e.g. across file systems
+			 * on older kernels */
+			if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+				break;
+			return 0;
+		}
+		if (n == 0)
+			return 0;
+		in_offset += n;
+		out_offset += n;
+		length -= n;
+	}
+	if (length == 0)
+		return 1;
+#endif
+	return copy_data_fallback (in_fd, in_offset, out_fd, out_offset, length);
+}
+
+FILE *ktx_fopen (const char *filename, const char *mode)
+{
+	if (!strcmp (filename, "-"))
+		return (mode[0] == 'r') ? stdin : stdout;
+	return fopen (filename, mode);
+}
+
+int ktx_fskip (FILE *f, off_t length)
+{
+	char buffer[4096];
+	while (length > 0)
+	{
+		size_t n = fread (buffer, 1, (length < (off_t) sizeof (buffer)) ? (size_t) length : sizeof (buffer), f);
+		if (n == 0)
+			return 0;
+		length -= n;
+	}
+	return 1;
+}
+
+int ktx_fcopy (FILE *in, FILE *out, off_t length)
+{
+	char *buffer = (char*) malloc (COPY_BUFFER_SIZE);
+	if (buffer == NULL)
+		return 0;
+
+	while (length > 0)
+	{
+		size_t n = fread (buffer, 1, (length < COPY_BUFFER_SIZE) ? (size_t) length : COPY_BUFFER_SIZE, in);
+		if (n == 0 || fwrite (buffer, 1, n, out) != n)
+		{
+			free (buffer);
+			return 0;
+		}
+		length -= n;
+	}
+
+	free (buffer);
+	return 1;
+}
+
+/* maps the file once all levels are known to lie within it, so that
+ * accessing them cannot fault */
+static int map_reader (ktx_reader_t *reader)
+{
+	struct stat st;
+	uint32_t level;
+	void *data;
+
+	if (fstat (reader->fd, &st))
+		return 0;
+	for (level = 0; level < ktx_level_count (&reader->header); level++)
+	{
+		if (reader->offsets[level] + (off_t) sizeof (uint32_t) + ktx_reader_level_size (reader, level) > st.st_size)
+		{
+			errno = EINVAL;
+			return 0;
+		}
+	}
+
+	data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+	if (data == MAP_FAILED)
+		return 0;
+	reader->mapping.data = (const uint8_t*) data;
+	reader->mapping.size = st.st_size;
+	return 1;
+}
+
+int ktx_reader_open (const char *filename, ktx_reader_t *reader)
+{
+	const uint8_t ktx_magic[] = KTX_MAGIC;
+	keyvaluelist_t list = KEYVALUELIST_INIT;
+
+	reader->mapping.data = NULL;
+	reader->mapping.size = 0;
+	reader->fd = open (filename, O_RDONLY);
+	if (reader->fd < 0)
+		return 0;
+
+	if (pread (reader->fd, &reader->header, sizeof (ktx_header_t), 0) != sizeof (ktx_header_t)
+			|| memcmp (&reader->header.identifier[0], &ktx_magic[0], sizeof (ktx_magic))
+			|| reader->header.endianness != KTX_ENDIANNESS
+			|| reader->header.numberOfMipmapLevels > KTX_MAX_LEVELS)
+	{
+		ktx_reader_close (reader);
+		errno = EINVAL;
+		return 0;
+	}
+
+	/* the level order is part of the key value data, so the levels cannot
+	 * be located without it */
+	if (!ktx_read_keyvalue (reader->fd, &reader->header, &list))
+	{
+		keyvalue_free (&list);
+		ktx_reader_close (reader);
+		return 0;
+	}
+	reader->reversed = ktx_levels_reversed (&list);
+	keyvalue_free (&list);
+
+	if (!ktx_index_levels_fd (reader->fd, &reader->header, reader->reversed, reader->offsets, reader->image_sizes)
+			|| !map_reader (reader))
+	{
+		ktx_reader_close (reader);
+		return 0;
+	}
+	return 1;
+}
+
+void ktx_reader_close (ktx_reader_t *reader)
+{
+	if (reader->fd >= 0)
+		close (reader->fd);
+	reader->fd = -1;
+	ktx_unmap (&reader->mapping);
+}
+
+off_t ktx_reader_level_size (const ktx_reader_t *reader, uint32_t level)
+{
+	return ktx_level_data_size (&reader->header, reader->image_sizes[level]);
+}
+
+void ktx_reader_prefetch (const ktx_reader_t *reader, uint32_t first, uint32_t last)
+{
+	off_t start = reader->offsets[first], end = start;
+	uint32_t level;
+
+	/* the range is contiguous in either level order */
+	for (level = first; level <= last; level++)
+	{
+		off_t level_end = reader->offsets[level] + sizeof (uint32_t) + ktx_reader_level_size (reader, level);
+		if (reader->offsets[level] < start)
+			start = reader->offsets[level];
+		if (level_end > end)
+			end = level_end;
+	}
+	posix_fadvise (reader->fd, start, end - start, POSIX_FADV_WILLNEED);
+}
+
+const uint8_t *ktx_reader_level_data (const ktx_reader_t *reader, uint32_t level)
+{
+	return reader->mapping.data + reader->offsets[level] + sizeof (uint32_t);
+}
+
+int ktx_reader_read_level (const ktx_reader_t *reader, uint32_t level, void *data)
+{
+	off_t offset = reader->offsets[level] + sizeof (uint32_t);
+	off_t size = ktx_reader_level_size (reader, level);
+	uint8_t *p = (uint8_t*) data;
+
+	while (size > 0)
+	{
+		ssize_t n = pread (reader->fd, p, size, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return 0;
+		p += n;
+		offset += n;
+		size -= n;
+	}
+	return 1;
+}
+
+int ktx_read_keyvalue (int fd, const ktx_header_t *header, keyvaluelist_t *list)
+{
+	char *buffer;
+	int result;
+
+	if (header->bytesOfKeyValueData == 0)
+		return 1;
+
+	buffer = (char*) malloc (header->bytesOfKeyValueData);
+	if (buffer == NULL)
+		return 0;
+	if (pread (fd, buffer, header->bytesOfKeyValueData, sizeof (ktx_header_t)) != header->bytesOfKeyValueData)
+	{
+		free (buffer);
+		errno = EINVAL;
+		return 0;
+	}
+	result = keyvalue_parse (list, buffer, header->bytesOfKeyValueData);
+	free (buffer);
+	if (!result)
+		errno = EINVAL;
+	return result;
+}
+
+static int read_header (int fd, ktx_header_t *header)
+{
+	const uint8_t ktx_magic[] = KTX_MAGIC;
+	if (pread (fd, header, sizeof (ktx_header_t), 0) != sizeof (ktx_header_t)
+			|| memcmp (&header->identifier[0], &ktx_magic[0], sizeof (ktx_magic))
+			|| header->endianness != KTX_ENDIANNESS)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+	return 1;
+}
+
+static int rewrite_keyvalue (int fd, const char *filename, ktx_header_t *header, const keyvaluelist_t *list)
+{
+	struct stat st;
+	off_t data_offset = sizeof (ktx_header_t) + header->bytesOfKeyValueData;
+	uint32_t size = keyvalue_size (list);
+	char *tmpname, *buffer;
+	int out, error, result;
+
+	if (fstat (fd, &st))
+		return 0;
+
+	tmpname = (char*) malloc (strlen (filename) + 8);
+	buffer = (char*) malloc (sizeof (ktx_header_t) + size);
+	if (tmpname == NULL || buffer == NULL)
+	{
+		free (tmpname);
+		free (buffer);
+		return 0;
+	}
+
+	sprintf (tmpname, "%s.XXXXXX", filename);
+	out = mkstemp (tmpname);
+	if (out < 0)
+	{
+		free (tmpname);
+		free (buffer);
+		return 0;
+	}
+
+	header->bytesOfKeyValueData = size;
+	memcpy (buffer, header, sizeof (ktx_header_t));
+	keyvalue_serialize (list, buffer + sizeof (ktx_header_t));
+
+	result = (!fchmod (out, st.st_mode & 07777)
+			&& pwrite (out, buffer, sizeof (ktx_header_t) + size, 0) == (ssize_t) (sizeof (ktx_header_t) + size)
+			&& ktx_copy_data (fd, data_offset, out, sizeof (ktx_header_t) + size, st.st_size - data_offset));
+	/* the descriptor is closed exactly once, even if that fails */
+	error = errno;
+	if (close (out) && result)
+	{
+		error = errno;
+		result = 0;
+	}
+	if (result && rename (tmpname, filename))
+	{
+		error = errno;
+		result = 0;
+	}
+	if (!result)
+		unlink (tmpname);
+	free (tmpname);
+	free (buffer);
+	errno = error;
+	return result;
+}
+
+int ktx_replace_keyvalue (const char *filename, const keyvaluelist_t *list)
+{
+	ktx_header_t header;
+	uint32_t size = keyvalue_size (list);
+	int fd, result, error;
+
+	fd = open (filename, O_RDWR);
+	if (fd < 0)
+		return 0;
+
+	if (!read_header (fd, &header))
+	{
+		close (fd);
+		errno = EINVAL;
+		return 0;
+	}
+
+	/* padding the data to the old size would change the length of a value,
+	 * so only data of the same size is written in place */
+	if (size == header.bytesOfKeyValueData)
+	{
+		char *buffer = (char*) malloc (size + 1);
+		if (buffer == NULL)
+		{
+			close (fd);
+			return 0;
+		}
+		keyvalue_serialize (list, buffer);
+		result = (pwrite (fd, buffer, size, sizeof (ktx_header_t)) == size);
+		free (buffer);
+	}
+	else
+	{
+		result = rewrite_keyvalue (fd, filename, &header, list);
+	}
+
+	error = errno;
+	close (fd);
+	errno = error;
+	return result;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "ktxpack.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t mix (uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDULL;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+uint64_t ktxpack_hash (const char *name, size_t length)
+{
+	/* FNV-1a */
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	size_t i;
+	for (i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t) name[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return mix (hash);
+}
+
+uint32_t ktxpack_bucket (const ktxpack_header_t *header, uint64_t hash)
+{
+	return hash % header->bucket_count;
+}
+
+uint32_t ktxpack_slot (const ktxpack_header_t *header, uint64_t hash, uint32_t seed)
+{
+	return mix (hash + seed * 0x9E3779B97F4A7C15ULL) % header->slot_count;
+}
+
+/* checks the header and the directory of a mapped pack before any pointer
+ * is derived from the offsets it contains */
+static int validate (const ktx_mapping_t *mapping)
+{
+	const uint8_t magic[] = KTXPACK_MAGIC;
+	const ktxpack_header_t *h = (const ktxpack_header_t*) mapping->data;
+	size_t size = mapping->size;
+	const ktxpack_entry_t *slots;
+	const char *names;
+	uint32_t i;
+
+	if (memcmp (h->identifier, magic, sizeof (magic)) || h->endianness != KTX_ENDIANNESS
+			|| h->version != KTXPACK_VERSION || h->bucket_count == 0 || h->slot_count == 0
+			|| h->slot_count < h->entry_count)
+		return 0;
+	if (h->directory_size > size
+			|| h->seeds_offset > h->directory_size || h->seeds_offset % sizeof (uint32_t)
+			|| (h->directory_size - h->seeds_offset) / sizeof (uint32_t) < h->bucket_count
+			|| h->slots_offset > h->directory_size || h->slots_offset % sizeof (uint64_t)
+			|| (h->directory_size - h->slots_offset) / sizeof (ktxpack_entry_t) < h->slot_count
+			|| h->names_offset > h->directory_size || h->directory_size - h->names_offset < h->names_size)
+		return 0;
+
+	slots = (const ktxpack_entry_t*) (mapping->data + h->slots_offset);
+	names = (const char*) (mapping->data + h->names_offset);
+	for (i = 0; i < h->slot_count; i++)
+	{
+		const ktxpack_entry_t *e = &slots[i];
+		if (e->name_offset == KTXPACK_EMPTY_SLOT)
+			continue;
+		if (e->name_offset >= h->names_size || h->names_size - e->name_offset <= e->name_length
+				|| names[e->name_offset + e->name_length] != 0)
+			return 0;
+		if (e->offset > size || size - e->offset < e->size || e->size < sizeof (ktx_header_t))
+			return 0;
+	}
+	return 1;
+}
+
+int ktxpack_open (const char *filename, ktxpack_t *pack)
+{
+	struct stat st;
+	void *data;
+	int fd = open (filename, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	if (fstat (fd, &st) || st.st_size < (off_t) sizeof (ktxpack_header_t))
+	{
+		close (fd);
+		return 0;
+	}
+
+	data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (data == MAP_FAILED)
+		return 0;
+
+	pack->mapping.data = (const uint8_t*) data;
+	pack->mapping.size = st.st_size;
+	if (!validate (&pack->mapping))
+	{
+		ktxpack_close (pack);
+		return 0;
+	}
+	pack->header = (const ktxpack_header_t*) data;
+	pack->seeds = (const uint32_t*) (pack->mapping.data + pack->header->seeds_offset);
+	pack->slots = (const ktxpack_entry_t*) (pack->mapping.data + pack->header->slots_offset);
+	pack->names = (const char*) (pack->mapping.data + pack->header->names_offset);
+
+	/* only the directory is needed right away, the files are paged in as
+	 * they are used */
+	madvise (data, pack->header->directory_size, MADV_WILLNEED);
+	return 1;
+}
+
+void ktxpack_close (ktxpack_t *pack)
+{
+	ktx_unmap (&pack->mapping);
+	pack->header = NULL;
+	pack->seeds = NULL;
+	pack->slots = NULL;
+	pack->names = NULL;
+}
+
+const ktxpack_entry_t *ktxpack_find (const ktxpack_t *pack, const char *name)
+{
+	size_t length = strlen (name);
+	uint64_t hash = ktxpack_hash (name, length);
+	uint32_t seed = pack->seeds[ktxpack_bucket (pack->header, hash)];
+	const ktxpack_entry_t *entry = &pack->slots[ktxpack_slot (pack->header, hash, seed)];
+
+	/* names that are not in the pack map to arbitrary slots */
+	if (entry->name_offset == KTXPACK_EMPTY_SLOT || entry->name_length != length
+			|| memcmp (pack->names + entry->name_offset, name, length))
+		return NULL;
+	return entry;
+}
+
+const char *ktxpack_name (const ktxpack_t *pack, const ktxpack_entry_t *entry)
+{
+	return pack->names + entry->name_offset;
+}
+
+void ktxpack_view (const ktxpack_t *pack, const ktxpack_entry_t *entry, ktx_mapping_t *view)
+{
+	view->data = pack->mapping.data + entry->offset;
+	view->size = entry->size;
+}
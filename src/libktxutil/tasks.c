@@ -0,0 +1,282 @@
+/*
+ * Copyright 2014 Daniel Kirchner
+ *
+ * This file is part of ktxutils.
+ *
+ * ktxutils is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ktxutils is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ktxutils.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tasks.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* work is shared as groups of iterations, one per parallel_for call; each
+ * thread pushes its groups onto its own deque and runs the newest one,
+ * while idle threads steal the oldest, i.e. the outermost and largest,
+ * group of another thread */
+typedef struct task_group {
+	size_t next;
+	size_t count;
+	size_t finished;
+	/* threads that took the group from a deque and may still claim one of
+	 * its iterations; the group lives on the stack of its parallel_for */
+	unsigned int users;
+	task_func_t func;
+	void *arg;
+} task_group_t;
+
+/* deeper nesting than this runs serially */
+#define TASK_DEQUE_SIZE 64
+
+typedef struct task_deque {
+	pthread_mutex_t lock;
+	task_group_t *groups[TASK_DEQUE_SIZE];
+	size_t size;
+} task_deque_t;
+
+static unsigned int concurrency = 0;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+/* one deque per worker thread and one shared by all other threads */
+static task_deque_t *deques = NULL;
+static unsigned int deque_count = 0;
+static __thread int deque_index = -1;
+
+/* sleeping threads wait for the generation to change, which happens
+ * whenever work is pushed or a group finishes */
+static pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleep_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long generation = 0;
+
+void task_set_concurrency (unsigned int n)
+{
+	concurrency = n;
+}
+
+unsigned int task_concurrency (void)
+{
+	long n;
+	if (concurrency != 0)
+		return concurrency;
+	n = sysconf (_SC_NPROCESSORS_ONLN);
+	return (n < 1) ? 1 : (unsigned int) n;
+}
+
+static void notify (void)
+{
+	pthread_mutex_lock (&sleep_lock);
+	generation++;
+	pthread_cond_broadcast (&sleep_cond);
+	pthread_mutex_unlock (&sleep_lock);
+}
+
+static unsigned long current_generation (void)
+{
+	unsigned long g;
+	pthread_mutex_lock (&sleep_lock);
+	g = generation;
+	pthread_mutex_unlock (&sleep_lock);
+	return g;
+}
+
+static void wait_for_change (unsigned long seen)
+{
+	pthread_mutex_lock (&sleep_lock);
+	while (generation == seen)
+		pthread_cond_wait (&sleep_cond, &sleep_lock);
+	pthread_mutex_unlock (&sleep_lock);
+}
+
+static task_deque_t *own_deque (void)
+{
+	return &deques[(deque_index < 0) ? deque_count - 1 : (unsigned int) deque_index];
+}
+
+static int push_group (task_group_t *group)
+{
+	task_deque_t *d = own_deque ();
+	int pushed = 0;
+	pthread_mutex_lock (&d->lock);
+	if (d->size < TASK_DEQUE_SIZE)
+	{
+		d->groups[d->size++] = group;
+		pushed = 1;
+	}
+	pthread_mutex_unlock (&d->lock);
+	if (pushed)
+		notify ();
+	return pushed;
+}
+
+static void remove_group (task_group_t *group)
+{
+	task_deque_t *d = own_deque ();
+	size_t i;
+	pthread_mutex_lock (&d->lock);
+	for (i = 0; i < d->size; i++)
+	{
+		if (d->groups[i] == group)
+		{
+			d->size--;
+			for (; i < d->size; i++)
+				d->groups[i] = d->groups[i + 1];
+			break;
+		}
+	}
+	pthread_mutex_unlock (&d->lock);
+}
+
+/* takes the newest group with unclaimed iterations from the own deque or
+ * the oldest one from another deque; groups without unclaimed iterations
+ * are dropped on the way */
+static task_group_t *acquire_group (void)
+{
+	task_deque_t *own = own_deque ();
+	unsigned int i;
+
+	for (i = 0; i < deque_count; i++)
+	{
+		task_deque_t *d = &deques[(own - deques + i) % deque_count];
+		task_group_t *group = NULL;
+
+		pthread_mutex_lock (&d->lock);
+		while (d->size > 0 && group == NULL)
+		{
+			size_t k = (d == own) ? d->size - 1 : 0;
+			group = d->groups[k];
+			if (__sync_fetch_and_add (&group->next, 0) < group->count)
+			{
+				__sync_fetch_and_add (&group->users, 1);
+				break;
+			}
+			group = NULL;
+			d->size--;
+			for (; k < d->size; k++)
+				d->groups[k] = d->groups[k + 1];
+		}
+		pthread_mutex_unlock (&d->lock);
+
+		if (group != NULL)
+			return group;
+	}
+	return NULL;
+}
+
+static int group_done (task_group_t *group)
+{
+	return __sync_fetch_and_add (&group->finished, 0) == group->count
+			&& __sync_fetch_and_add (&group->users, 0) == 0;
+}
+
+/* claims and runs one iteration; returns 0 once all have been claimed */
+static int run_iteration (task_group_t *group)
+{
+	size_t i = __sync_fetch_and_add (&group->next, 1);
+	if (i >= group->count)
+		return 0;
+	group->func (i, group->arg);
+	if (__sync_add_and_fetch (&group->finished, 1) == group->count)
+		notify ();
+	return 1;
+}
+
+/* the group may be gone as soon as the last user is released, so the
+ * joining thread is woken without looking at the group again */
+static void release_group (task_group_t *group)
+{
+	if (__sync_sub_and_fetch (&group->users, 1) == 0)
+		notify ();
+}
+
+static void *worker (void *arg)
+{
+	deque_index = (int) (size_t) arg;
+	while (1)
+	{
+		unsigned long seen = current_generation ();
+		task_group_t *group = acquire_group ();
+		if (group == NULL)
+		{
+			wait_for_change (seen);
+			continue;
+		}
+		while (run_iteration (group))
+			;
+		release_group (group);
+	}
+	return NULL;
+}
+
+static void start_pool (void)
+{
+	unsigned int i, workers = task_concurrency () - 1;
+
+	deques = (task_deque_t*) calloc (workers + 1, sizeof (task_deque_t));
+	if (deques == NULL)
+		return;
+	for (i = 0; i <= workers; i++)
+		pthread_mutex_init (&deques[i].lock, NULL);
+	/* the deques of workers that cannot be started stay empty */
+	deque_count = workers + 1;
+	for (i = 0; i < workers; i++)
+	{
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init (&attr);
+		pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create (&thread, &attr, worker, (void*) (size_t) i))
+			i = workers;
+		pthread_attr_destroy (&attr);
+	}
+}
+
+void parallel_for (size_t count, task_func_t func, void *arg)
+{
+	task_group_t group = { 0, count, 0, 0, func, arg };
+	size_t i;
+
+	if (count > 1)
+		pthread_once (&pool_once, start_pool);
+
+	/* the calling thread runs all iterations itself if there is nobody to
+	 * share them with */
+	if (count <= 1 || deque_count <= 1 || !push_group (&group))
+	{
+		for (i = 0; i < count; i++)
+			func (i, arg);
+		return;
+	}
+
+	while (run_iteration (&group))
+		;
+	remove_group (&group);
+
+	/* while other threads finish the remaining iterations, the calling
+	 * thread helps with any other work instead of blocking */
+	while (!group_done (&group))
+	{
+		unsigned long seen = current_generation ();
+		task_group_t *other;
+
+		if (group_done (&group))
+			break;
+		other = acquire_group ();
+		if (other != NULL)
+		{
+			run_iteration (other);
+			release_group (other);
+		}
+		else
+			wait_for_change (seen);
+	}
+}